@@ -136,6 +136,191 @@ static int ident_matches(struct mddev_ident *ident,
 	return 1;
 }
 
+/* "--assemble --scan" calls select_devices() once for every array in
+ * mdadm.conf and again on every retry, each time over the full device
+ * list.  Rather than re-reading every superblock each time, we remember
+ * what was found on each device for the rest of this invocation and
+ * reject devices that cannot belong to the array without any I/O.
+ * ->ss is NULL when no superblock was found at all.
+ * Devices that are chosen for an array are forgotten as their metadata
+ * is about to change.  "No superblock" is not remembered for md devices
+ * as they may yet be assembled and turn out to be stacked members.
+ * Devices are first probed all together by probe_devices(), and ->st
+ * holds the superblock so found until select_devices() claims it.
+ */
+struct probe_ent {
+	struct probe_ent *next;
+	char *devname;
+	dev_t rdev;
+	struct superswitch *ss;
+	struct supertype *st;
+	struct mdinfo info;
+};
+static struct probe_ent *probe_cache;
+
+static void probe_free(struct probe_ent *p)
+{
+	if (p->st) {
+		p->st->ss->free_super(p->st);
+		free(p->st);
+	}
+	free(p->devname);
+	free(p);
+}
+
+static struct probe_ent *probe_find(char *devname)
+{
+	struct probe_ent **pp, *p;
+	struct stat stb;
+
+	for (pp = &probe_cache; (p = *pp) != NULL; pp = &p->next)
+		if (strcmp(p->devname, devname) == 0)
+			break;
+	if (!p)
+		return NULL;
+	if (stat(devname, &stb) == 0 && S_ISBLK(stb.st_mode) &&
+	    stb.st_rdev == p->rdev)
+		return p;
+	/* Name now refers to something else */
+	*pp = p->next;
+	probe_free(p);
+	return NULL;
+}
+
+static struct probe_ent *probe_record(char *devname, dev_t rdev,
+				      struct supertype *tst,
+				      struct mdinfo *info)
+{
+	struct probe_ent *p;
+	char *kname;
+
+	if (!tst) {
+		kname = devid2kname(rdev);
+		if (kname && strncmp(kname, "md", 2) == 0)
+			return NULL;
+	}
+	if (probe_find(devname))
+		return NULL;
+	p = xcalloc(1, sizeof(*p));
+	p->devname = xstrdup(devname);
+	p->rdev = rdev;
+	if (tst) {
+		p->ss = tst->ss;
+		p->info = *info;
+		p->info.next = NULL;
+		p->info.devs = NULL;
+	}
+	p->next = probe_cache;
+	probe_cache = p;
+	return p;
+}
+
+static void probe_forget(char *devname)
+{
+	struct probe_ent **pp, *p;
+
+	for (pp = &probe_cache; (p = *pp) != NULL; pp = &p->next)
+		if (strcmp(p->devname, devname) == 0) {
+			*pp = p->next;
+			probe_free(p);
+			return;
+		}
+}
+
+static void assemble_probe(struct dev_probe *dp, void *arg)
+{
+	/* Same tests as select_devices() makes before
+	 * looking for a superblock.  Containers are left
+	 * for select_devices() to handle.
+	 */
+	struct supertype *st;
+	int dfd;
+
+	dfd = dev_open(dp->devname, O_RDONLY);
+	if (dfd < 0) {
+		dp->err = errno;
+		return;
+	}
+	if (fstat(dfd, &dp->stb) < 0 ||
+	    !S_ISBLK(dp->stb.st_mode) ||
+	    must_be_container(dfd)) {
+		dp->err = -1;
+		close(dfd);
+		return;
+	}
+	st = guess_super(dfd);
+	if (st) {
+		st->ignore_hw_compat = 0;
+		if (st->ss->load_super(st, dfd, NULL)) {
+			free(st);
+			st = NULL;
+		}
+	}
+	dp->st = st;
+	close(dfd);
+}
+
+static void probe_all(struct mddev_dev *devlist, struct mddev_ident *ident)
+{
+	/* Probe, in parallel, all devices that might be wanted and
+	 * haven't been looked at yet.
+	 */
+	struct mddev_dev *tmpdev;
+	struct dev_probe *probes;
+	int cnt = 0;
+	int i;
+
+	for (tmpdev = devlist; tmpdev; tmpdev = tmpdev->next)
+		cnt++;
+	probes = xcalloc(cnt, sizeof(*probes));
+	cnt = 0;
+	for (tmpdev = devlist; tmpdev; tmpdev = tmpdev->next) {
+		if (tmpdev->used > 1)
+			continue;
+		if (ident->devices &&
+		    !match_oneof(ident->devices, tmpdev->devname))
+			continue;
+		if (probe_find(tmpdev->devname))
+			continue;
+		probes[cnt++].devname = tmpdev->devname;
+	}
+	if (cnt > 1)
+		probe_devices(probes, cnt, assemble_probe, NULL);
+	else
+		cnt = 0;
+
+	for (i = 0; i < cnt; i++) {
+		struct dev_probe *dp = &probes[i];
+		struct probe_ent *pe;
+		struct mdinfo info;
+
+		if (dp->err)
+			continue;
+		if (!dp->st) {
+			probe_record(dp->devname, dp->stb.st_rdev, NULL, NULL);
+			continue;
+		}
+		dp->st->ss->getinfo_super(dp->st, &info, NULL);
+		pe = probe_record(dp->devname, dp->stb.st_rdev, dp->st, &info);
+		if (pe)
+			pe->st = dp->st;
+		else {
+			dp->st->ss->free_super(dp->st);
+			free(dp->st);
+		}
+	}
+	free(probes);
+}
+
+static int compare_super_timed(struct supertype *st, struct supertype *tst)
+{
+	unsigned long long t = trace_start();
+	int rv = st->ss->compare_super(st, tst);
+
+	trace_end(t, "compare_super", NULL);
+	return rv;
+}
+
 static int select_devices(struct mddev_dev *devlist,
 			  struct mddev_ident *ident,
 			  struct supertype **stp,
@@ -150,6 +335,9 @@ static int select_devices(struct mddev_dev *devlist,
 	int report_mismatch = ((inargv && c->verbose >= 0) || c->verbose > 0);
 	struct domainlist *domains = NULL;
 
+	if (!st && !ident->container)
+		probe_all(devlist, ident);
+
 	tmpdev = devlist; num_devs = 0;
 	while (tmpdev) {
 		if (tmpdev->used)
@@ -172,6 +360,7 @@ static int select_devices(struct mddev_dev *devlist,
 		struct stat stb;
 		struct supertype *tst;
 		struct dev_policy *pol = NULL;
+		struct probe_ent *pe;
 		int found_container = 0;
 
 		if (tmpdev->used > 1)
@@ -196,10 +385,27 @@ static int select_devices(struct mddev_dev *devlist,
 			continue;
 		}
 
+		pe = probe_find(devname);
+		if (pe && pe->ss && (!st || st->ss == pe->ss)) {
+			struct supertype cached = { .ss = pe->ss };
+
+			tst = NULL;
+			if (!ident_matches(ident, &pe->info, &cached,
+					   c->homehost, c->require_homehost,
+					   c->update,
+					   report_mismatch ? devname : NULL))
+				goto loop;
+		}
+
 		tst = dup_super(st);
 
-		dfd = dev_open(devname, O_RDONLY);
-		if (dfd < 0) {
+		dfd = -1;
+		if (pe && !pe->ss) {
+			if (report_mismatch)
+				pr_err("no recogniseable superblock on %s\n",
+				       devname);
+			tmpdev->used = 2;
+		} else if ((dfd = dev_open(devname, O_RDONLY)) < 0) {
 			if (report_mismatch)
 				pr_err("cannot open device %s: %s\n",
 				       devname, strerror(errno));
@@ -245,17 +451,30 @@ static int select_devices(struct mddev_dev *devlist,
 			} else
 				found_container = 1;
 		} else {
+			int loaded = 0;
+
+			if (!tst && pe && pe->st) {
+				/* Already loaded by probe_all() */
+				tst = pe->st;
+				pe->st = NULL;
+				loaded = 1;
+			}
 			if (!tst && (tst = guess_super(dfd)) == NULL) {
 				if (report_mismatch)
 					pr_err("no recogniseable superblock on %s\n",
 					       devname);
+				probe_record(devname, stb.st_rdev, NULL, NULL);
 				tmpdev->used = 2;
-			} else if ((tst->ignore_hw_compat = 0),
-				   tst->ss->load_super(tst, dfd,
-						       report_mismatch ? devname : NULL)) {
+			} else if (!loaded &&
+				   ((tst->ignore_hw_compat = 0),
+				    tst->ss->load_super(tst, dfd,
+							report_mismatch ? devname : NULL))) {
 				if (report_mismatch)
 					pr_err("no RAID superblock on %s\n",
 					       devname);
+				if (!st)
+					probe_record(devname, stb.st_rdev,
+						     NULL, NULL);
 				tmpdev->used = 2;
 			} else if (tst->ss->compare_super == NULL) {
 				if (report_mismatch)
@@ -374,6 +593,7 @@ static int select_devices(struct mddev_dev *devlist,
 		} else {
 			content = *contentp;
 			tst->ss->getinfo_super(tst, content, NULL);
+			probe_record(devname, stb.st_rdev, tst, content);
 
 			if (!ident_matches(ident, content, tst,
 					   c->homehost, c->require_homehost,
@@ -440,7 +660,7 @@ static int select_devices(struct mddev_dev *devlist,
 
 			if (st->ss != tst->ss ||
 			    st->minor_version != tst->minor_version ||
-			    st->ss->compare_super(st, tst) != 0) {
+			    compare_super_timed(st, tst) != 0) {
 				/* Some mismatch. If exactly one array matches this host,
 				 * we can resolve on that one.
 				 * Or, if we are auto assembling, we just ignore the second
@@ -1116,7 +1336,12 @@ static int start_array(int mdfd,
 					   "array_state", "readonly");
 		} else
 #endif
+		{
+			unsigned long long t = trace_start();
+
 			rv = ioctl(mdfd, RUN_ARRAY, NULL);
+			trace_end(t, "RUN_ARRAY", mddev);
+		}
 		reopen_mddev(mdfd); /* drop O_EXCL */
 		if (rv == 0) {
 			if (c->verbose >= 0) {
@@ -1320,6 +1545,7 @@ int Assemble(struct supertype *st, char *mddev,
 	char chosen_name[1024];
 	struct map_ent *map = NULL;
 	struct map_ent *mp;
+	unsigned long long t;
 
 	/*
 	 * If any subdevs are listed, then any that don't
@@ -1359,14 +1585,21 @@ try_again:
 	content = &info;
 	if (st && c->force)
 		st->ignore_hw_compat = 1;
+	t = trace_start();
 	num_devs = select_devices(devlist, ident, &st, &content, c,
 				  inargv, auto_assem);
+	trace_end(t, "select_devices", mddev);
 	if (num_devs < 0)
 		return 1;
 
 	if (!st || !st->sb || !content)
 		return 2;
 
+	/* Metadata on the chosen devices is about to be updated */
+	for (tmpdev = devlist; tmpdev; tmpdev = tmpdev->next)
+		if (tmpdev->used == 1)
+			probe_forget(tmpdev->devname);
+
 	/* We have a full set of devices - we now need to find the
 	 * array device.
 	 * However there is a risk that we are racing with "mdadm -I"
@@ -1512,9 +1745,11 @@ try_again:
 	/* Ok, no bad inconsistancy, we can try updating etc */
 	devices = xcalloc(num_devs, sizeof(*devices));
 	devmap = xcalloc(num_devs, content->array.raid_disks);
+	t = trace_start();
 	devcnt = load_devices(devices, devmap, ident, &st, devlist,
 			      c, content, mdfd, mddev,
 			      &most_recent, &bestcnt, &best, inargv);
+	trace_end(t, "load_devices", mddev);
 	if (devcnt < 0)
 		return 1;
 
@@ -1813,7 +2048,10 @@ try_again:
 
 	map_update(&map, fd2devnm(mdfd), content->text_version,
 		   content->uuid, chosen_name);
+	/* in case "mdadm -I" had started on this array */
+	sbcache_remove(fd2devnm(mdfd));
 
+	t = trace_start();
 	rv = start_array(mdfd, mddev, content,
 			 st, ident, best, bestcnt,
 			 chosen_drive, devices, okcnt, sparecnt,
@@ -1822,6 +2060,7 @@ try_again:
 			 clean, avail, start_partial_ok,
 			 pre_exist != NULL,
 			 was_forced);
+	trace_end(t, "start_array", mddev);
 	if (rv == 1 && !pre_exist)
 		ioctl(mdfd, STOP_ARRAY, NULL);
 	free(devices);
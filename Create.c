@@ -112,6 +112,7 @@ int Create(struct supertype *st, char *mddev,
 	char chosen_name[1024];
 	struct map_ent *map = NULL;
 	unsigned long long newsize;
+	unsigned long long t;
 
 	int major_num = BITMAP_MAJOR_HI;
 	if (s->bitmap_file && strcmp(s->bitmap_file, "clustered") == 0)
@@ -957,7 +958,10 @@ int Create(struct supertype *st, char *mddev,
 				me = map_by_devnm(&map, st->container_devnm);
 			}
 
-			if (st->ss->write_init_super(st)) {
+			t = trace_start();
+			rv = st->ss->write_init_super(st);
+			trace_end(t, "write_init_super", chosen_name);
+			if (rv) {
 				st->ss->free_super(st);
 				goto abort_locked;
 			}
@@ -1024,7 +1028,11 @@ int Create(struct supertype *st, char *mddev,
 		} else {
 			/* param is not actually used */
 			mdu_param_t param;
-			if (ioctl(mdfd, RUN_ARRAY, &param)) {
+
+			t = trace_start();
+			rv = ioctl(mdfd, RUN_ARRAY, &param);
+			trace_end(t, "RUN_ARRAY", chosen_name);
+			if (rv) {
 				pr_err("RUN_ARRAY failed: %s\n",
 				       strerror(errno));
 				if (info.array.chunk_size & (info.array.chunk_size-1)) {
@@ -564,20 +564,24 @@ This is pretty boring
 			/* This looks like a container.  Find any active arrays
 			 * That claim to be a member.
 			 */
-			DIR *dir = opendir("/sys/block");
+			char path[PATH_MAX];
+			DIR *dir;
 			struct dirent *de;
 
+			snprintf(path, sizeof(path), "%s/sys/block", sys_root());
+			dir = opendir(path);
+
 			printf("  Member Arrays :");
 
 			while (dir && (de = readdir(dir)) != NULL) {
-				char path[200];
 				char vbuf[1024];
 				int nlen = strlen(sra->sys_name);
 				int devid;
 				if (de->d_name[0] == '.')
 					continue;
-				sprintf(path, "/sys/block/%s/md/metadata_version",
-					de->d_name);
+				snprintf(path, sizeof(path),
+					 "%s/sys/block/%s/md/metadata_version",
+					 sys_root(), de->d_name);
 				if (load_sys(path, vbuf) < 0)
 					continue;
 				if (strncmp(vbuf, "external:", 9) != 0 ||
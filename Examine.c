@@ -30,6 +30,57 @@
 #endif
 #include	"md_u.h"
 #include	"md_p.h"
+
+struct examine_args {
+	struct context *c;
+	struct supertype *forcest;
+};
+
+static void examine_probe(struct dev_probe *dp, void *arg)
+{
+	struct examine_args *ea = arg;
+	struct context *c = ea->c;
+	struct supertype *st;
+	int container = 0;
+	int fd;
+
+	fd = dev_open(dp->devname, O_RDONLY);
+	if (fd < 0) {
+		dp->err = errno;
+		return;
+	}
+	if (ea->forcest)
+		st = dup_super(ea->forcest);
+	else if (must_be_container(fd)) {
+		/* might be a container */
+		probe_lock();
+		st = super_by_fd(fd, NULL);
+		probe_unlock();
+		container = 1;
+	} else
+		st = guess_super(fd);
+	dp->rv = 1;
+	if (st) {
+		st->ignore_hw_compat = 1;
+		if (!container)
+			dp->rv = st->ss->load_super(st, fd,
+						    (c->brief||c->scan) ? NULL
+						    :dp->devname);
+		if (dp->rv && st->ss->load_container) {
+			probe_lock();
+			dp->rv = st->ss->load_container(st, fd,
+							(c->brief||c->scan) ? NULL
+							:dp->devname);
+			probe_unlock();
+			if (!dp->rv)
+				dp->container = 1;
+		}
+		st->ignore_hw_compat = 0;
+	}
+	dp->st = st;
+	close(fd);
+}
+
 int Examine(struct mddev_dev *devlist,
 	    struct context *c,
 	    struct supertype *forcest)
@@ -51,9 +102,12 @@ int Examine(struct mddev_dev *devlist,
 	 * line including devices=
 	 * if devlist==NULL, use conf_get_devs()
 	 */
-	int fd;
 	int rv = 0;
 	int err = 0;
+	struct examine_args ea = { c, forcest };
+	struct dev_probe *probes, *dp;
+	int cnt = 0;
+	struct mddev_dev *dv;
 
 	struct array {
 		struct supertype *st;
@@ -63,53 +117,40 @@ int Examine(struct mddev_dev *devlist,
 		int spares;
 	} *arrays = NULL;
 
-	for (; devlist ; devlist = devlist->next) {
+	for (dv = devlist; dv; dv = dv->next)
+		cnt++;
+	probes = xcalloc(cnt, sizeof(*probes));
+	for (dv = devlist, dp = probes; dv; dv = dv->next, dp++)
+		dp->devname = dv->devname;
+	/* When brief, nothing is reported while probing,
+	 * so all devices can be probed at once.
+	 */
+	if (c->brief || c->scan)
+		probe_devices(probes, cnt, examine_probe, &ea);
+
+	for (dp = probes; devlist ; devlist = devlist->next, dp++) {
 		struct supertype *st;
-		int have_container = 0;
+		int have_container;
 
-		fd = dev_open(devlist->devname, O_RDONLY);
-		if (fd < 0) {
+		if (!(c->brief || c->scan))
+			examine_probe(dp, &ea);
+		st = dp->st;
+		have_container = dp->container;
+		if (dp->err) {
 			if (!c->scan) {
 				pr_err("cannot open %s: %s\n",
-				       devlist->devname, strerror(errno));
+				       devlist->devname, strerror(dp->err));
 				rv = 1;
 			}
 			err = 1;
-		}
-		else {
-			int container = 0;
-			if (forcest)
-				st = dup_super(forcest);
-			else if (must_be_container(fd)) {
-				/* might be a container */
-				st = super_by_fd(fd, NULL);
-				container = 1;
-			} else
-				st = guess_super(fd);
-			if (st) {
-				err = 1;
-				st->ignore_hw_compat = 1;
-				if (!container)
-					err = st->ss->load_super(st, fd,
-								 (c->brief||c->scan) ? NULL
-								 :devlist->devname);
-				if (err && st->ss->load_container) {
-					err = st->ss->load_container(st, fd,
-								 (c->brief||c->scan) ? NULL
-								 :devlist->devname);
-					if (!err)
-						have_container = 1;
-				}
-				st->ignore_hw_compat = 0;
-			} else {
-				if (!c->brief) {
-					pr_err("No md superblock detected on %s.\n", devlist->devname);
-					rv = 1;
-				}
-				err = 1;
+		} else if (!st) {
+			if (!c->brief) {
+				pr_err("No md superblock detected on %s.\n", devlist->devname);
+				rv = 1;
 			}
-			close(fd);
-		}
+			err = 1;
+		} else
+			err = dp->rv;
 		if (err)
 			continue;
 
@@ -185,6 +226,7 @@ int Examine(struct mddev_dev *devlist,
 				printf("\n");
 		}
 	}
+	free(probes);
 	return rv;
 }
 
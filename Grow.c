@@ -2766,12 +2766,12 @@ static int continue_via_systemd(char *devnm)
 	return 0;
 }
 
-static int reshape_array(char *container, int fd, char *devname,
-			 struct supertype *st, struct mdinfo *info,
-			 int force, struct mddev_dev *devlist,
-			 unsigned long long data_offset,
-			 char *backup_file, int verbose, int forked,
-			 int restart, int freeze_reshape)
+static int __reshape_array(char *container, int fd, char *devname,
+			   struct supertype *st, struct mdinfo *info,
+			   int force, struct mddev_dev *devlist,
+			   unsigned long long data_offset,
+			   char *backup_file, int verbose, int forked,
+			   int restart, int freeze_reshape)
 {
 	struct reshape reshape;
 	int spares_needed;
@@ -3419,6 +3419,22 @@ release:
 	return 1;
 }
 
+static int reshape_array(char *container, int fd, char *devname,
+			 struct supertype *st, struct mdinfo *info,
+			 int force, struct mddev_dev *devlist,
+			 unsigned long long data_offset,
+			 char *backup_file, int verbose, int forked,
+			 int restart, int freeze_reshape)
+{
+	unsigned long long t = trace_start();
+	int rv = __reshape_array(container, fd, devname, st, info, force,
+				 devlist, data_offset, backup_file, verbose,
+				 forked, restart, freeze_reshape);
+
+	trace_end(t, "reshape_array", devname);
+	return rv;
+}
+
 /* mdfd handle is passed to be closed in child process (after fork).
  */
 int reshape_container(char *container, char *devname,
@@ -32,6 +32,9 @@
 #include	<sys/wait.h>
 #include	<dirent.h>
 #include	<ctype.h>
+#include	<poll.h>
+#include	<sys/socket.h>
+#include	<sys/un.h>
 
 static int count_active(struct supertype *st, struct mdinfo *sra,
 			int mdfd, char **availp,
@@ -45,9 +48,17 @@ static int try_spare(char *devname, int *dfdp, struct dev_policy *pol,
 
 static int Incremental_container(struct supertype *st, char *devname,
 				 struct context *c, char *only);
+static int Incremental_dev(struct mddev_dev *devlist, struct context *c,
+			   struct supertype *st, int start);
 
 int Incremental(struct mddev_dev *devlist, struct context *c,
 		struct supertype *st)
+{
+	return Incremental_dev(devlist, c, st, 1);
+}
+
+static int Incremental_dev(struct mddev_dev *devlist, struct context *c,
+			   struct supertype *st, int start)
 {
 	/* Add this device to an array, creating the array if necessary
 	 * and starting the array if sensible or - if runstop>0 - if possible.
@@ -85,6 +96,11 @@ int Incremental(struct mddev_dev *devlist, struct context *c,
 	 * - read all metadata and arrange devices like -A does
 	 * - if number of OK devices match expected, or -R and there are enough,
 	 *   start the array (auto-readonly).
+	 *
+	 * If 'st' already has the superblock loaded it is not read
+	 * again.  If 'start' is zero we stop after step 6: more members
+	 * are about to be added and the caller decides about starting
+	 * once they are all in.
 	 */
 	struct stat stb;
 	struct mdinfo info, dinfo;
@@ -105,6 +121,7 @@ int Incremental(struct mddev_dev *devlist, struct context *c,
 	int have_target;
 	char *devname = devlist->devname;
 	int journal_device_missing = 0;
+	unsigned long long t;
 
 	struct createinfo *ci = conf_get_create_info();
 
@@ -206,7 +223,8 @@ int Incremental(struct mddev_dev *devlist, struct context *c,
 	st->ignore_hw_compat = 0;
 
 	if (st->ss->compare_super == NULL ||
-	    st->ss->load_super(st, dfd, c->verbose >= 0 ? devname : NULL)) {
+	    (!st->sb &&
+	     st->ss->load_super(st, dfd, c->verbose >= 0 ? devname : NULL))) {
 		if (c->verbose >= 0)
 			pr_err("no RAID superblock on %s.\n",
 				devname);
@@ -486,6 +504,16 @@ int Incremental(struct mddev_dev *devlist, struct context *c,
 		printf("MD_FOREIGN=%s\n", trustworthy == FOREIGN ? "yes" : "no");
 	}
 
+	if (!start) {
+		if (c->export) {
+			if (info.array.level != LEVEL_CONTAINER)
+				printf("MD_STARTED=no\n");
+		} else if (c->verbose >= 0)
+			pr_err("%s attached to %s.\n", devname, chosen_name);
+		rv = 0;
+		goto out_unlock;
+	}
+
 	/* 7/ Is there enough devices to possibly start the array? */
 	/* 7a/ if not, finish with success. */
 	if (info.array.level == LEVEL_CONTAINER) {
@@ -520,7 +548,9 @@ int Incremental(struct mddev_dev *devlist, struct context *c,
 	sysfs_free(sra);
 	sra = sysfs_read(mdfd, NULL, (GET_DEVS | GET_STATE |
 				    GET_OFFSET | GET_SIZE));
+	t = trace_start();
 	active_disks = count_active(st, sra, mdfd, &avail, &info);
+	trace_end(t, "count_active", devname);
 
 	journal_device_missing = (info.journal_device_required) && (info.journal_clean == 0);
 
@@ -587,10 +617,15 @@ int Incremental(struct mddev_dev *devlist, struct context *c,
 			if (d->disk.state & (1<<MD_DISK_REMOVED))
 				remove_disk(mdfd, st, sra, d);
 
+		/* Once running, superblocks will be updated */
+		if (sra)
+			sbcache_remove(sra->sys_name);
 		if ((sra == NULL || active_disks >= info.array.working_disks)
-		    && trustworthy != FOREIGN)
+		    && trustworthy != FOREIGN) {
+			t = trace_start();
 			rv = ioctl(mdfd, RUN_ARRAY, NULL);
-		else
+			trace_end(t, "RUN_ARRAY", chosen_name);
+		} else
 			rv = sysfs_set_str(sra, NULL,
 					   "array_state", "read-auto");
 		/* Array might be O_EXCL which  will interfere with
@@ -691,6 +726,24 @@ static void find_reject(int mdfd, struct supertype *st, struct mdinfo *sra,
 	}
 }
 
+static void count_active_probe(struct dev_probe *dp, void *arg)
+{
+	struct supertype *st = arg;
+	int dfd;
+
+	if (!dp->devname)
+		/* already known from the cache */
+		return;
+	dfd = dev_open(dp->devname, O_RDONLY);
+	if (dfd < 0) {
+		dp->err = errno;
+		return;
+	}
+	dp->st = dup_super(st);
+	dp->rv = dp->st->ss->load_super(dp->st, dfd, NULL);
+	close(dfd);
+}
+
 static int count_active(struct supertype *st, struct mdinfo *sra,
 			int mdfd, char **availp,
 			struct mdinfo *bestinfo)
@@ -707,29 +760,78 @@ static int count_active(struct supertype *st, struct mdinfo *sra,
 	int devnum;
 	int b, i;
 	int raid_disks = 0;
+	struct dev_probe *probes;
+	struct sbcache_ent *sbc = NULL, **ses;
+	unsigned long long *gens;
+	int use_cache, cache_changed = 0;
+	mdu_array_info_t ra;
+	int uuid[4];
 
 	if (!sra)
 		return 0;
 
+	/* Superblocks only change under us once the array is active.
+	 * bestinfo holds the details of the device just added, so
+	 * gives us the uuid to check the cache against.
+	 */
+	memcpy(uuid, bestinfo->uuid, sizeof(uuid));
+	use_cache = !st->ss->external &&
+		ioctl(mdfd, GET_ARRAY_INFO, &ra) != 0;
+	if (use_cache)
+		sbc = sbcache_read(sra->sys_name, uuid);
+	else
+		sbcache_remove(sra->sys_name);
+
 	for (d = sra->devs ; d ; d = d->next)
 		numdevs++;
+	probes = xcalloc(numdevs, sizeof(*probes));
+	ses = xcalloc(numdevs, sizeof(*ses));
+	gens = xcalloc(numdevs, sizeof(*gens));
 	for (d = sra->devs, devnum = 0 ; d ; d = d->next, devnum++) {
-		char dn[30];
-		int dfd;
-		int ok;
+		if (use_cache)
+			ses[devnum] = sbcache_find(sbc,
+						   makedev(d->disk.major,
+							   d->disk.minor),
+						   &gens[devnum]);
+		if (!ses[devnum])
+			xasprintf(&probes[devnum].devname, "%d:%d",
+				  d->disk.major, d->disk.minor);
+	}
+	probe_devices(probes, numdevs, count_active_probe, st);
+
+	for (d = sra->devs, devnum = 0 ; d ; d = d->next, devnum++) {
+		dev_t devid = makedev(d->disk.major, d->disk.minor);
+		struct supertype *tst = probes[devnum].st;
+		struct sbcache_ent *se;
 		struct mdinfo info;
 
-		sprintf(dn, "%d:%d", d->disk.major, d->disk.minor);
-		dfd = dev_open(dn, O_RDONLY);
-		if (dfd < 0)
-			continue;
-		ok =  st->ss->load_super(st, dfd, NULL);
-		close(dfd);
-		if (ok != 0)
-			continue;
+		se = ses[devnum];
+		if (!se) {
+			char *map;
+			int maplen;
 
-		info.array.raid_disks = raid_disks;
-		st->ss->getinfo_super(st, &info, devmap + raid_disks * devnum);
+			free(probes[devnum].devname);
+			if (!tst)
+				continue;
+			if (probes[devnum].rv != 0) {
+				free(tst);
+				continue;
+			}
+			maplen = tst->max_devs;
+			map = xcalloc(maplen, 1);
+			info.array.raid_disks = maplen;
+			tst->ss->getinfo_super(tst, &info, map);
+			tst->ss->free_super(tst);
+			free(tst);
+			if (info.array.raid_disks < maplen)
+				maplen = info.array.raid_disks;
+			sbcache_add(&sbc, devid, gens[devnum],
+				    &info, map, maplen);
+			free(map);
+			cache_changed = 1;
+			se = sbc;
+		}
+		info = se->info;
 		if (info.disk.raid_disk == MD_DISK_ROLE_JOURNAL)
 			bestinfo->journal_clean = 1;
 		if (!avail) {
@@ -739,9 +841,9 @@ static int count_active(struct supertype *st, struct mdinfo *sra,
 
 			best = xcalloc(raid_disks, sizeof(int));
 			devmap = xcalloc(raid_disks, numdevs);
-
-			st->ss->getinfo_super(st, &info, devmap);
 		}
+		memcpy(devmap + raid_disks * devnum, se->map,
+		       min(se->maplen, raid_disks));
 
 		if (info.disk.state & (1<<MD_DISK_SYNC))
 		{
@@ -750,7 +852,7 @@ static int count_active(struct supertype *st, struct mdinfo *sra,
 				max_events = info.events;
 				avail[info.disk.raid_disk] = 2;
 				best[info.disk.raid_disk] = devnum;
-				st->ss->getinfo_super(st, bestinfo, NULL);
+				*bestinfo = se->info;
 			} else if (info.events == max_events) {
 				avail[info.disk.raid_disk] = 2;
 				best[info.disk.raid_disk] = devnum;
@@ -769,18 +871,23 @@ static int count_active(struct supertype *st, struct mdinfo *sra,
 						avail[i]--;
 				avail[info.disk.raid_disk] = 2;
 				best[info.disk.raid_disk] = devnum;
-				st->ss->getinfo_super(st, bestinfo, NULL);
+				*bestinfo = se->info;
 			} else { /* info.events much bigger */
 				memset(avail, 0, raid_disks);
 				max_events = info.events;
 				avail[info.disk.raid_disk] = 2;
 				best[info.disk.raid_disk] = devnum;
-				st->ss->getinfo_super(st, bestinfo, NULL);
+				*bestinfo = se->info;
 			}
 		} else if (info.disk.state & (1<<MD_DISK_REPLACEMENT))
 			replcnt++;
-		st->ss->free_super(st);
 	}
+	free(probes);
+	free(ses);
+	free(gens);
+	if (use_cache && cache_changed)
+		sbcache_write(sra->sys_name, uuid, sbc);
+	sbcache_free(sbc);
 
 	if (!avail)
 		return 0;
@@ -1802,3 +1909,465 @@ int IncrementalRemove(char *devname, char *id_path, int verbose)
 	free_mdstat(ent);
 	return rv;
 }
+
+/*
+ * When many devices appear at once, udev runs "mdadm -I" for each of
+ * them and every one re-reads the config file, re-scans the devices and
+ * then queues on the map lock.  "mdadm -I --service" listens on
+ * INCR_SOCK instead, and a plain "mdadm -I device" hands its device over
+ * if the service is running.  Requests arriving close together form a
+ * batch which a child process handles: all superblocks are loaded in
+ * parallel, members of the same array are added one after the other,
+ * and only once the last of them is in is it decided whether to start
+ * the array.  Whatever each would have printed is captured and sent back
+ * with its exit status, so the caller cannot tell the difference.
+ * A batch which takes more than INCR_BATCH_SECS is abandoned, and the
+ * callers still waiting then handle their devices themselves.
+ */
+#define INCR_SOCK	MAP_DIR "/incremental.sock"
+#define INCR_BATCH_MS	100	/* keep collecting this long after each request */
+#define INCR_BATCH_MAX	1000	/* but never longer than this in total */
+#define INCR_BATCH_DEVS	256
+#define INCR_BATCH_SECS	30	/* to handle a batch once collected */
+
+struct incr_req {
+	int fd;
+	struct context c;
+	struct mddev_dev *devlist;
+	struct supertype *st;	/* with the superblock loaded */
+	int uuid[4];
+	int have_uuid;
+};
+
+static int incr_connect(void)
+{
+	struct sockaddr_un addr;
+	int sfd;
+
+	sfd = socket(PF_LOCAL, SOCK_STREAM, 0);
+	if (sfd < 0)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = PF_LOCAL;
+	strcpy(addr.sun_path, INCR_SOCK);
+	if (connect(sfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(sfd);
+		return -1;
+	}
+	return sfd;
+}
+
+static void incr_write(int fd, char *buf, int len)
+{
+	while (len > 0) {
+		int n = write(fd, buf, len);
+
+		if (n <= 0)
+			break;
+		buf += n;
+		len -= n;
+	}
+}
+
+int IncrementalForward(struct mddev_dev *devlist, struct context *c)
+{
+	/* Pass 'devlist' to a running "mdadm -I --service" and relay
+	 * its reply.  Returns -1 if there is no service, or it went
+	 * away before answering, so the caller should do the work itself.
+	 */
+	struct metadata_update msg, rv, out, err;
+	struct mddev_dev *dv;
+	int sfd;
+	int ret = -1;
+
+	sfd = incr_connect();
+	if (sfd < 0)
+		return -1;
+
+	msg.len = xasprintf(&msg.buf, "%d\n%d\n%d\n%d\n%d\n%s",
+			    c->runstop, c->export, c->verbose,
+			    c->require_homehost, c->freeze_reshape,
+			    c->homehost ?: "");
+	for (dv = devlist; dv; dv = dv->next) {
+		char *b;
+
+		msg.len = xasprintf(&b, "%s\n%s", msg.buf, dv->devname);
+		free(msg.buf);
+		msg.buf = b;
+	}
+	msg.len += 1;
+	if (send_message(sfd, &msg, 5) != 0 ||
+	    receive_message(sfd, &rv, (INCR_BATCH_MAX + 999) / 1000 +
+			    INCR_BATCH_SECS) != 0)
+		goto out;
+	if (receive_message(sfd, &out, 5) != 0)
+		goto free_rv;
+	if (receive_message(sfd, &err, 5) != 0)
+		goto free_out;
+	if (rv.len > 0 && rv.buf[rv.len - 1] == 0) {
+		incr_write(1, out.buf, out.len);
+		incr_write(2, err.buf, err.len);
+		ret = atoi(rv.buf);
+	}
+	free(err.buf);
+free_out:
+	free(out.buf);
+free_rv:
+	free(rv.buf);
+out:
+	free(msg.buf);
+	close(sfd);
+	return ret;
+}
+
+static void incr_free(struct incr_req *r)
+{
+	while (r->devlist) {
+		struct mddev_dev *dv = r->devlist;
+
+		r->devlist = dv->next;
+		free(dv->devname);
+		free(dv);
+	}
+	free(r->c.homehost);
+	r->c.homehost = NULL;
+	if (r->st) {
+		r->st->ss->free_super(r->st);
+		free(r->st);
+		r->st = NULL;
+	}
+}
+
+static int incr_parse(struct incr_req *r, struct context *base, char *buf)
+{
+	/* Fields are newline separated: runstop, export, verbose,
+	 * require_homehost, freeze_reshape, homehost, then the device
+	 * and any other names it is known by.
+	 */
+	struct mddev_dev **dvp = &r->devlist;
+	char *field[6];
+	int i;
+
+	for (i = 0; i < 6; i++) {
+		field[i] = buf;
+		buf = strchr(buf, '\n');
+		if (!buf)
+			return -1;
+		*buf++ = 0;
+	}
+	r->c = *base;
+	r->c.runstop = atoi(field[0]);
+	r->c.export = atoi(field[1]);
+	r->c.verbose = atoi(field[2]);
+	r->c.require_homehost = atoi(field[3]);
+	r->c.freeze_reshape = atoi(field[4]);
+	r->c.homehost = *field[5] ? xstrdup(field[5]) : NULL;
+	while (buf) {
+		char *nl = strchr(buf, '\n');
+
+		if (nl)
+			*nl++ = 0;
+		if (*buf) {
+			*dvp = xcalloc(1, sizeof(**dvp));
+			(*dvp)->devname = xstrdup(buf);
+			dvp = &(*dvp)->next;
+		}
+		buf = nl;
+	}
+	if (!r->devlist) {
+		incr_free(r);
+		return -1;
+	}
+	return 0;
+}
+
+static int incr_accept(int lsock, struct incr_req *r, struct context *base)
+{
+	struct metadata_update msg;
+	int fd;
+
+	/* not to be inherited by mdmon and the like */
+	fd = accept4(lsock, NULL, NULL, SOCK_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (receive_message(fd, &msg, 5) != 0) {
+		close(fd);
+		return -1;
+	}
+	if (msg.len <= 0 || msg.buf[msg.len - 1] != 0 ||
+	    incr_parse(r, base, msg.buf) != 0) {
+		free(msg.buf);
+		close(fd);
+		return -1;
+	}
+	free(msg.buf);
+	r->fd = fd;
+	return 0;
+}
+
+static int incr_gather(int lsock, struct incr_req *reqs, struct context *base)
+{
+	/* Wait for a first request, then collect whatever else arrives
+	 * until things go quiet for INCR_BATCH_MS.
+	 */
+	struct pollfd pfd = { .fd = lsock, .events = POLLIN };
+	struct timeval start, now;
+	int cnt = 0;
+
+	while (cnt == 0) {
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+			return -1;
+		if (incr_accept(lsock, &reqs[cnt], base) == 0)
+			cnt++;
+	}
+	gettimeofday(&start, NULL);
+	while (cnt < INCR_BATCH_DEVS) {
+		long left;
+
+		gettimeofday(&now, NULL);
+		left = INCR_BATCH_MAX - ((now.tv_sec - start.tv_sec) * 1000 +
+					 (now.tv_usec - start.tv_usec) / 1000);
+		if (left <= 0)
+			break;
+		if (poll(&pfd, 1, left < INCR_BATCH_MS ? left : INCR_BATCH_MS) <= 0)
+			break;
+		if (incr_accept(lsock, &reqs[cnt], base) == 0)
+			cnt++;
+	}
+	return cnt;
+}
+
+static void incr_probe(struct dev_probe *dp, void *arg)
+{
+	/* Load the superblock the way Incremental() would, so it
+	 * needn't be read again there.  Containers are left to it.
+	 */
+	int dfd;
+
+	dfd = dev_open(dp->devname, O_RDONLY);
+	if (dfd < 0) {
+		dp->err = errno;
+		return;
+	}
+	if (!must_be_container(dfd))
+		dp->st = guess_super_type(dfd, guess_array);
+	if (dp->st) {
+		dp->st->ignore_hw_compat = 0;
+		dp->rv = 1;
+		if (dp->st->ss->compare_super)
+			dp->rv = dp->st->ss->load_super(dp->st, dfd, NULL);
+	}
+	close(dfd);
+}
+
+static char *incr_slurp(FILE *f, int *lenp)
+{
+	long len;
+	char *buf;
+
+	*lenp = 0;
+	if (!f || fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) <= 0)
+		return NULL;
+	rewind(f);
+	buf = xmalloc(len);
+	*lenp = fread(buf, 1, len, f);
+	return buf;
+}
+
+static void incr_reply(int fd, char *buf, int len)
+{
+	struct metadata_update msg;
+
+	msg.buf = buf;
+	msg.len = len;
+	send_message(fd, &msg, 5);
+}
+
+static void incr_run(struct incr_req *r, int start)
+{
+	/* Handle one request with stdout and stderr captured so they
+	 * can be passed back to whoever asked.  An mdmon started
+	 * meanwhile gets our own instead.
+	 */
+	FILE *out = tmpfile();
+	FILE *err = tmpfile();
+	int ofd = -1, efd = -1;
+	char rvbuf[16], *buf;
+	int rv, len;
+
+	fflush(stdout);
+	fflush(stderr);
+	if (out && err) {
+		ofd = fcntl(1, F_DUPFD_CLOEXEC, 0);
+		efd = fcntl(2, F_DUPFD_CLOEXEC, 0);
+		fcntl(fileno(out), F_SETFD, FD_CLOEXEC);
+		fcntl(fileno(err), F_SETFD, FD_CLOEXEC);
+		dup2(fileno(out), 1);
+		dup2(fileno(err), 2);
+		set_mdmon_stdio(ofd, efd);
+	}
+
+	/* Incremental_dev() takes over the superblock */
+	rv = Incremental_dev(r->devlist, &r->c, r->st, start);
+	r->st = NULL;
+
+	fflush(stdout);
+	fflush(stderr);
+	if (ofd >= 0) {
+		set_mdmon_stdio(-1, -1);
+		dup2(ofd, 1);
+		dup2(efd, 2);
+		close(ofd);
+		close(efd);
+	}
+
+	len = snprintf(rvbuf, sizeof(rvbuf), "%d", rv) + 1;
+	incr_reply(r->fd, rvbuf, len);
+	buf = incr_slurp(ofd >= 0 ? out : NULL, &len);
+	incr_reply(r->fd, buf, len);
+	free(buf);
+	buf = incr_slurp(efd >= 0 ? err : NULL, &len);
+	incr_reply(r->fd, buf, len);
+	free(buf);
+	if (out)
+		fclose(out);
+	if (err)
+		fclose(err);
+}
+
+static void incr_batch(struct incr_req *reqs, int cnt)
+{
+	struct dev_probe *probes = xcalloc(cnt, sizeof(*probes));
+	int *order = xcalloc(cnt, sizeof(*order));
+	char *placed = xcalloc(cnt, 1);
+	int i, j, n;
+
+	for (i = 0; i < cnt; i++)
+		probes[i].devname = reqs[i].devlist->devname;
+	probe_devices(probes, cnt, incr_probe, NULL);
+	for (i = 0; i < cnt; i++) {
+		struct supertype *st = probes[i].st;
+		struct mdinfo info;
+
+		if (!st)
+			continue;
+		if (probes[i].rv == 0) {
+			memset(&info, 0, sizeof(info));
+			st->ss->getinfo_super(st, &info, NULL);
+			memcpy(reqs[i].uuid, info.uuid, sizeof(reqs[i].uuid));
+			reqs[i].have_uuid = 1;
+			reqs[i].st = st;
+			continue;
+		}
+		st->ss->free_super(st);
+		free(st);
+	}
+
+	/* Keep members of one array together, in order of first arrival */
+	for (i = 0, n = 0; i < cnt; i++) {
+		if (placed[i])
+			continue;
+		order[n++] = i;
+		placed[i] = 1;
+		if (!reqs[i].have_uuid)
+			continue;
+		for (j = i + 1; j < cnt; j++)
+			if (!placed[j] && reqs[j].have_uuid &&
+			    same_uuid(reqs[i].uuid, reqs[j].uuid, 0)) {
+				order[n++] = j;
+				placed[j] = 1;
+			}
+	}
+
+	for (n = 0; n < cnt; n++) {
+		struct incr_req *r = &reqs[order[n]];
+		int more;
+
+		/* Only the last member added decides about starting */
+		more = n + 1 < cnt && r->have_uuid &&
+			reqs[order[n + 1]].have_uuid &&
+			same_uuid(r->uuid, reqs[order[n + 1]].uuid, 0);
+		incr_run(r, !more);
+	}
+	free(probes);
+	free(order);
+	free(placed);
+}
+
+int IncrementalService(struct context *c)
+{
+	struct incr_req *reqs;
+	struct sockaddr_un addr;
+	mode_t mask;
+	int lsock;
+
+	if (mkdir(MAP_DIR, 0755) < 0 && errno != EEXIST) {
+		pr_err("cannot create %s: %s\n", MAP_DIR, strerror(errno));
+		return 1;
+	}
+	lsock = socket(PF_LOCAL, SOCK_STREAM, 0);
+	if (lsock < 0) {
+		pr_err("cannot create socket: %s\n", strerror(errno));
+		return 1;
+	}
+	fcntl(lsock, F_SETFD, FD_CLOEXEC);
+	unlink(INCR_SOCK);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = PF_LOCAL;
+	strcpy(addr.sun_path, INCR_SOCK);
+	/* only root may connect, but what is created later
+	 * (the map file, mdmon's files) gets the usual mode
+	 */
+	mask = umask(077);
+	if (bind(lsock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		umask(mask);
+		pr_err("cannot listen on %s: %s\n", INCR_SOCK, strerror(errno));
+		close(lsock);
+		return 1;
+	}
+	umask(mask);
+	if (listen(lsock, SOMAXCONN) < 0) {
+		pr_err("cannot listen on %s: %s\n", INCR_SOCK, strerror(errno));
+		close(lsock);
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	/* Read the config file once, every batch inherits it */
+	conf_get_ident(NULL);
+
+	reqs = xcalloc(INCR_BATCH_DEVS, sizeof(*reqs));
+	while (1) {
+		int cnt = incr_gather(lsock, reqs, c);
+		int i;
+		pid_t pid;
+
+		if (cnt < 0) {
+			pr_err("%s: %s\n", INCR_SOCK, strerror(errno));
+			break;
+		}
+		/* A crash or leak while handling a batch must not take
+		 * the service with it.
+		 */
+		pid = fork();
+		if (pid == 0) {
+			close(lsock);
+			alarm(INCR_BATCH_SECS);
+			incr_batch(reqs, cnt);
+			exit(0);
+		}
+		if (pid > 0)
+			waitpid(pid, NULL, 0);
+		else
+			incr_batch(reqs, cnt);
+		for (i = 0; i < cnt; i++) {
+			close(reqs[i].fd);
+			incr_free(&reqs[i]);
+		}
+		memset(reqs, 0, INCR_BATCH_DEVS * sizeof(*reqs));
+	}
+	free(reqs);
+	close(lsock);
+	unlink(INCR_SOCK);
+	return 1;
+}
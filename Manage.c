@@ -501,6 +501,8 @@ done:
 		ioctl(fd, BLKRRPART, 0);
 	if (mdi)
 		sysfs_uevent(mdi, "change");
+	if (devnm[0])
+		sysfs_uncache(devnm, NULL);
 
 	if (devnm[0] && use_udev()) {
 		struct map_ent *mp = map_by_devnm(&map, devnm);
@@ -29,6 +29,18 @@
 #include	<signal.h>
 #include	<limits.h>
 #include	<syslog.h>
+#include	<sys/socket.h>
+#include	<sys/un.h>
+
+/* Events reported through alert(), counted per array for --metrics.
+ * All RebuildNN events share one counter.
+ */
+static char *alert_events[] = {
+	"Fail", "FailSpare", "SpareActive", "DegradedArray", "SparesMissing",
+	"RebuildStarted", "RebuildNN", "RebuildFinished", "DeviceDisappeared",
+	"NewArray", "MoveSpare", "TestMessage", NULL
+};
+#define NR_ALERT_EVENTS (ARRAY_SIZE(alert_events) - 1)
 
 struct state {
 	char *devname;
@@ -53,6 +65,14 @@ struct state {
 	struct state *parent;  /* for a subarray it is a link to its container
 				*/
 	struct state *next;
+
+	/* Only gathered when metrics are being published */
+	unsigned int alerts[NR_ALERT_EVENTS];
+	struct mdinfo *sra;	/* member devices with state and errors */
+	char sync_action[20];
+	unsigned long long sync_completed, sync_total;
+	unsigned long long sync_speed;
+	long long mismatch_cnt;
 };
 
 struct alert_info {
@@ -61,9 +81,18 @@ struct alert_info {
 	char *alert_cmd;
 	int dosyslog;
 };
+
+struct metrics_info {
+	char *file;		/* rewritten atomically after each poll */
+	char *sock_path;
+	int sock;		/* listening socket, or -1 */
+	char *buf;		/* last rendering, served on 'sock' */
+	size_t len;
+};
 static int make_daemon(char *pidfile);
 static int check_one_sharer(int scan);
-static void alert(char *event, char *dev, char *disc, struct alert_info *info);
+static void alert(char *event, struct state *st, char *disc,
+		  struct alert_info *info);
 static int check_array(struct state *st, struct mdstat_ent *mdstat,
 		       int test, struct alert_info *info,
 		       int increments, char *prefer);
@@ -71,13 +100,18 @@ static int add_new_arrays(struct mdstat_ent *mdstat, struct state **statelist,
 			  int test, struct alert_info *info);
 static void try_spare_migration(struct state *statelist, struct alert_info *info);
 static void link_containers_with_subarrays(struct state *list);
+static int metrics_open(struct metrics_info *mi);
+static void metrics_close(struct metrics_info *mi);
+static void metrics_read(struct state *st);
+static void metrics_publish(struct state *statelist, struct metrics_info *mi);
+static void metrics_wait(struct metrics_info *mi, int seconds);
 
 int Monitor(struct mddev_dev *devlist,
 	    char *mailaddr, char *alert_cmd,
 	    struct context *c,
 	    int daemonise, int oneshot,
 	    int dosyslog, char *pidfile, int increments,
-	    int share)
+	    int share, char *metrics_file, char *metrics_sock)
 {
 	/*
 	 * Every few seconds, scan every md device looking for changes
@@ -119,6 +153,10 @@ int Monitor(struct mddev_dev *devlist,
 	 * If devlist is NULL, then we can monitor everything because --scan
 	 * was given.  We get an initial list from config file and add anything
 	 * that appears in /proc/mdstat
+	 *
+	 * If metrics_file or metrics_sock is given, the state of every array
+	 * is also published after each poll in the Prometheus text format,
+	 * so that it can be scraped without forking mdadm each time.
 	 */
 
 	struct state *statelist = NULL;
@@ -127,6 +165,7 @@ int Monitor(struct mddev_dev *devlist,
 	struct mdstat_ent *mdstat = NULL;
 	char *mailfrom = NULL;
 	struct alert_info info;
+	struct metrics_info metrics;
 
 	if (!mailaddr) {
 		mailaddr = conf_get_mailaddr();
@@ -142,7 +181,8 @@ int Monitor(struct mddev_dev *devlist,
 			pr_err("Monitor using program \"%s\" from config file\n",
 			       alert_cmd);
 	}
-	if (c->scan && !mailaddr && !alert_cmd && !dosyslog) {
+	if (c->scan && !mailaddr && !alert_cmd && !dosyslog &&
+	    !metrics_file && !metrics_sock) {
 		pr_err("No mail address or alert command - not monitoring.\n");
 		return 1;
 	}
@@ -151,8 +191,22 @@ int Monitor(struct mddev_dev *devlist,
 	info.mailfrom = mailfrom;
 	info.dosyslog = dosyslog;
 
+	memset(&metrics, 0, sizeof(metrics));
+	metrics.file = metrics_file;
+	metrics.sock_path = metrics_sock;
+	metrics.sock = -1;
+	if (metrics_open(&metrics))
+		return 1;
+
 	if (daemonise) {
 		int rv = make_daemon(pidfile);
+		if (rv == 0 && metrics.sock >= 0)
+			/* the daemon is listening on it now, so
+			 * don't unlink it
+			 */
+			close(metrics.sock);
+		else if (rv > 0)
+			metrics_close(&metrics);
 		if (rv >= 0)
 			return rv;
 	}
@@ -230,11 +284,16 @@ int Monitor(struct mddev_dev *devlist,
 		 */
 		if (share && anydegraded)
 			try_spare_migration(statelist, &info);
+		if (metrics.file || metrics.sock >= 0) {
+			for (st = statelist; st; st = st->next)
+				metrics_read(st);
+			metrics_publish(statelist, &metrics);
+		}
 		if (!new_found) {
 			if (oneshot)
 				break;
 			else
-				mdstat_wait(c->delay);
+				metrics_wait(&metrics, c->delay);
 		}
 		c->test = 0;
 
@@ -243,6 +302,7 @@ int Monitor(struct mddev_dev *devlist,
 				*stp = st->next;
 				free(st->devname);
 				free(st->spare_group);
+				sysfs_free(st->sra);
 				free(st);
 			} else
 				stp = &st->next;
@@ -250,8 +310,10 @@ int Monitor(struct mddev_dev *devlist,
 	}
 	for (st2 = statelist; st2; st2 = statelist) {
 		statelist = st2->next;
+		sysfs_free(st2->sra);
 		free(st2);
 	}
+	metrics_close(&metrics);
 
 	if (pidfile)
 		unlink(pidfile);
@@ -337,9 +399,22 @@ static int check_one_sharer(int scan)
 	return 0;
 }
 
-static void alert(char *event, char *dev, char *disc, struct alert_info *info)
+static void alert(char *event, struct state *st, char *disc,
+		  struct alert_info *info)
 {
 	int priority;
+	char *dev = st->devname;
+	unsigned int e;
+
+	for (e = 0; e < NR_ALERT_EVENTS; e++)
+		if (strcmp(event, alert_events[e]) == 0)
+			break;
+	if (e == NR_ALERT_EVENTS && strncmp(event, "Rebuild", 7) == 0)
+		for (e = 0; e < NR_ALERT_EVENTS; e++)
+			if (strcmp(alert_events[e], "RebuildNN") == 0)
+				break;
+	if (e < NR_ALERT_EVENTS)
+		st->alerts[e]++;
 
 	if (!info->alert_cmd && !info->mailaddr && !info->dosyslog) {
 		time_t now = time(0);
@@ -368,6 +443,7 @@ static void alert(char *event, char *dev, char *disc, struct alert_info *info)
 		FILE *mp = popen(Sendmail, "w");
 		if (mp) {
 			FILE *mdstat;
+			char mdstat_path[PATH_MAX];
 			char hname[256];
 			gethostname(hname, sizeof(hname));
 			signal(SIGPIPE, SIG_IGN);
@@ -394,7 +470,9 @@ static void alert(char *event, char *dev, char *disc, struct alert_info *info)
 
 			fprintf(mp, "Faithfully yours, etc.\n");
 
-			mdstat = fopen("/proc/mdstat", "r");
+			snprintf(mdstat_path, sizeof(mdstat_path),
+				 "%s/proc/mdstat", sys_root());
+			mdstat = fopen(mdstat_path, "r");
 			if (mdstat) {
 				char buf[8192];
 				int n;
@@ -459,9 +537,13 @@ static int check_array(struct state *st, struct mdstat_ent *mdstat,
 	int new_array = 0;
 
 	if (test)
-		alert("TestMessage", dev, NULL, ainfo);
-	if (st->devnm[0])
-		fd = open("/sys/block", O_RDONLY|O_DIRECTORY);
+		alert("TestMessage", st, NULL, ainfo);
+	if (st->devnm[0]) {
+		char path[PATH_MAX];
+
+		snprintf(path, sizeof(path), "%s/sys/block", sys_root());
+		fd = open(path, O_RDONLY|O_DIRECTORY);
+	}
 	if (fd >= 0) {
 		/* Don't open the device unless it is present and
 		 * active in sysfs.
@@ -480,7 +562,7 @@ static int check_array(struct state *st, struct mdstat_ent *mdstat,
 				if (fd >= 0)
 					close(fd);
 				if (!st->err)
-					alert("DeviceDisappeared", dev, NULL, ainfo);
+					alert("DeviceDisappeared", st, NULL, ainfo);
 				st->err++;
 				return 0;
 			}
@@ -490,14 +572,14 @@ static int check_array(struct state *st, struct mdstat_ent *mdstat,
 	fd = open(dev, O_RDONLY);
 	if (fd < 0) {
 		if (!st->err)
-			alert("DeviceDisappeared", dev, NULL, ainfo);
+			alert("DeviceDisappeared", st, NULL, ainfo);
 		st->err++;
 		return 0;
 	}
 	fcntl(fd, F_SETFD, FD_CLOEXEC);
 	if (ioctl(fd, GET_ARRAY_INFO, &array)<0) {
 		if (!st->err)
-			alert("DeviceDisappeared", dev, NULL, ainfo);
+			alert("DeviceDisappeared", st, NULL, ainfo);
 		st->err++;
 		close(fd);
 		return 0;
@@ -507,7 +589,7 @@ static int check_array(struct state *st, struct mdstat_ent *mdstat,
 	 */
 	if (array.level == 0 || array.level == -1) {
 		if (!st->err && !st->from_config)
-			alert("DeviceDisappeared", dev, " Wrong-Level", ainfo);
+			alert("DeviceDisappeared", st, " Wrong-Level", ainfo);
 		st->err++;
 		close(fd);
 		return 0;
@@ -539,7 +621,7 @@ static int check_array(struct state *st, struct mdstat_ent *mdstat,
 		st->err = 0;
 		st->percent = RESYNC_NONE;
 		new_array = 1;
-		alert("NewArray", st->devname, NULL, ainfo);
+		alert("NewArray", st, NULL, ainfo);
 	}
 
 	if (st->utime == array.utime &&
@@ -558,15 +640,15 @@ static int check_array(struct state *st, struct mdstat_ent *mdstat,
 	if (st->utime == 0 && /* new array */
 	    mse->pattern && strchr(mse->pattern, '_') /* degraded */
 		)
-		alert("DegradedArray", dev, NULL, ainfo);
+		alert("DegradedArray", st, NULL, ainfo);
 
 	if (st->utime == 0 && /* new array */
 	    st->expected_spares > 0 &&
 	    array.spare_disks < st->expected_spares)
-		alert("SparesMissing", dev, NULL, ainfo);
+		alert("SparesMissing", st, NULL, ainfo);
 	if (st->percent < 0 && st->percent != RESYNC_UNKNOWN &&
 	    mse->percent >= 0)
-		alert("RebuildStarted", dev, NULL, ainfo);
+		alert("RebuildStarted", st, NULL, ainfo);
 	if (st->percent >= 0 &&
 	    mse->percent >= 0 &&
 	    (mse->percent / increments) > (st->percent / increments)) {
@@ -577,7 +659,7 @@ static int check_array(struct state *st, struct mdstat_ent *mdstat,
 		else
 			snprintf(percentalert, sizeof(percentalert), "Rebuild%02d", mse->percent);
 
-		alert(percentalert, dev, NULL, ainfo);
+		alert(percentalert, st, NULL, ainfo);
 	}
 
 	if (mse->percent == RESYNC_NONE &&
@@ -593,9 +675,9 @@ static int check_array(struct state *st, struct mdstat_ent *mdstat,
 			snprintf(cnt, sizeof(cnt),
 				 " mismatches found: %d (on raid level %d)",
 				sra->mismatch_cnt, array.level);
-			alert("RebuildFinished", dev, cnt, ainfo);
+			alert("RebuildFinished", st, cnt, ainfo);
 		} else
-			alert("RebuildFinished", dev, NULL, ainfo);
+			alert("RebuildFinished", st, NULL, ainfo);
 		if (sra)
 			free(sra);
 	}
@@ -659,13 +741,13 @@ static int check_array(struct state *st, struct mdstat_ent *mdstat,
 		change = newstate ^ st->devstate[i];
 		if (st->utime && change && !st->err && !new_array) {
 			if ((st->devstate[i]&change)&(1<<MD_DISK_SYNC))
-				alert("Fail", dev, dv, ainfo);
+				alert("Fail", st, dv, ainfo);
 			else if ((newstate & (1<<MD_DISK_FAULTY)) &&
 				 (disc.major || disc.minor) &&
 				 st->devid[i] == makedev(disc.major, disc.minor))
-				alert("FailSpare", dev, dv, ainfo);
+				alert("FailSpare", st, dv, ainfo);
 			else if ((newstate&change)&(1<<MD_DISK_SYNC))
-				alert("SpareActive", dev, dv, ainfo);
+				alert("SpareActive", st, dv, ainfo);
 		}
 		st->devstate[i] = newstate;
 		st->devid[i] = makedev(disc.major, disc.minor);
@@ -738,7 +820,7 @@ static int add_new_arrays(struct mdstat_ent *mdstat, struct state **statelist,
 				st->parent_devnm[0] = 0;
 			*statelist = st;
 			if (test)
-				alert("TestMessage", st->devname, NULL, info);
+				alert("TestMessage", st, NULL, info);
 			new_found = 1;
 		}
 	return new_found;
@@ -952,7 +1034,7 @@ static void try_spare_migration(struct state *statelist, struct alert_info *info
 							     min_size);
 				if (devid > 0
 				    && move_spare(from->devname, to->devname, devid)) {
-					alert("MoveSpare", to->devname, from->devname, info);
+					alert("MoveSpare", to, from->devname, info);
 					break;
 				}
 			}
@@ -987,6 +1069,297 @@ static void link_containers_with_subarrays(struct state *list)
 				}
 }
 
+static int metrics_open(struct metrics_info *mi)
+{
+	struct sockaddr_un addr;
+
+	if (!mi->sock_path)
+		return 0;
+	if (strlen(mi->sock_path) >= sizeof(addr.sun_path)) {
+		pr_err("metrics socket name too long: %s\n", mi->sock_path);
+		return 1;
+	}
+	mi->sock = socket(PF_LOCAL, SOCK_STREAM, 0);
+	if (mi->sock < 0) {
+		pr_err("cannot create metrics socket: %s\n", strerror(errno));
+		return 1;
+	}
+	fcntl(mi->sock, F_SETFD, FD_CLOEXEC);
+	unlink(mi->sock_path);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = PF_LOCAL;
+	strcpy(addr.sun_path, mi->sock_path);
+	if (bind(mi->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(mi->sock, 10) < 0) {
+		pr_err("cannot listen on %s: %s\n", mi->sock_path,
+		       strerror(errno));
+		close(mi->sock);
+		mi->sock = -1;
+		return 1;
+	}
+	return 0;
+}
+
+static void metrics_close(struct metrics_info *mi)
+{
+	if (mi->sock >= 0) {
+		close(mi->sock);
+		unlink(mi->sock_path);
+	}
+	mi->sock = -1;
+	free(mi->buf);
+	mi->buf = NULL;
+	mi->len = 0;
+}
+
+static void metrics_read(struct state *st)
+{
+	/* Refresh the parts of 'st' that check_array doesn't track
+	 * but which are worth exporting.  This only touches sysfs,
+	 * never the array device or the members' superblocks.
+	 */
+	struct mdinfo *sra;
+	unsigned long long v;
+	char *nl;
+
+	sysfs_free(st->sra);
+	st->sra = NULL;
+	st->sync_action[0] = 0;
+	st->sync_completed = st->sync_total = 0;
+	st->sync_speed = 0;
+	st->mismatch_cnt = -1;
+
+	if (st->err || !st->devnm[0])
+		return;
+	sra = sysfs_read(-1, st->devnm, GET_DEVS|GET_STATE|GET_ERROR);
+	if (!sra)
+		return;
+	st->sra = sra;
+
+	if (sysfs_get_str(sra, NULL, "sync_action", st->sync_action,
+			  sizeof(st->sync_action)) > 0) {
+		nl = strchr(st->sync_action, '\n');
+		if (nl)
+			*nl = 0;
+	} else
+		st->sync_action[0] = 0;
+	if (sysfs_get_two(sra, NULL, "sync_completed",
+			  &st->sync_completed, &st->sync_total) != 2)
+		st->sync_completed = st->sync_total = 0;
+	if (sysfs_get_ll(sra, NULL, "sync_speed", &v) == 0)
+		st->sync_speed = v;
+	if (sysfs_get_ll(sra, NULL, "mismatch_cnt", &v) == 0)
+		st->mismatch_cnt = v;
+}
+
+static void metrics_head(FILE *f, char *name, char *type, char *help)
+{
+	fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void metrics_label(FILE *f, char *label, char *val)
+{
+	fprintf(f, "%s=\"", label);
+	for (; *val; val++) {
+		if (*val == '\\' || *val == '"')
+			fputc('\\', f);
+		if (*val == '\n')
+			fputs("\\n", f);
+		else
+			fputc(*val, f);
+	}
+	fputc('"', f);
+}
+
+static void metrics_render(FILE *f, struct state *statelist)
+{
+	struct state *st;
+	struct mdinfo *d;
+	unsigned int e;
+
+	metrics_head(f, "mdadm_array_info", "gauge",
+		     "Arrays being monitored, by device name.");
+	for (st = statelist; st; st = st->next) {
+		if (st->err || !st->devnm[0])
+			continue;
+		fprintf(f, "mdadm_array_info{array=\"%s\",", st->devnm);
+		metrics_label(f, "device", st->devname);
+		if (st->parent_devnm[0])
+			fprintf(f, ",container=\"%s\"", st->parent_devnm);
+		fprintf(f, "} 1\n");
+	}
+
+	metrics_head(f, "mdadm_array_disks", "gauge",
+		     "Member devices of the array, by role.");
+	for (st = statelist; st; st = st->next) {
+		if (st->err || !st->devnm[0])
+			continue;
+		fprintf(f, "mdadm_array_disks{array=\"%s\",role=\"raid\"} %d\n",
+			st->devnm, st->raid);
+		fprintf(f, "mdadm_array_disks{array=\"%s\",role=\"active\"} %d\n",
+			st->devnm, st->active);
+		fprintf(f, "mdadm_array_disks{array=\"%s\",role=\"working\"} %d\n",
+			st->devnm, st->working);
+		fprintf(f, "mdadm_array_disks{array=\"%s\",role=\"failed\"} %d\n",
+			st->devnm, st->failed);
+		fprintf(f, "mdadm_array_disks{array=\"%s\",role=\"spare\"} %d\n",
+			st->devnm, st->spare);
+	}
+
+	metrics_head(f, "mdadm_array_degraded", "gauge",
+		     "Number of missing or failed devices in the array.");
+	for (st = statelist; st; st = st->next)
+		if (!st->err && st->devnm[0] && st->raid > 0)
+			fprintf(f, "mdadm_array_degraded{array=\"%s\"} %d\n",
+				st->devnm,
+				st->active < st->raid ? st->raid - st->active : 0);
+
+	metrics_head(f, "mdadm_array_sync_action", "gauge",
+		     "Current sync_action of the array.");
+	for (st = statelist; st; st = st->next)
+		if (!st->err && st->sync_action[0])
+			fprintf(f, "mdadm_array_sync_action{array=\"%s\",action=\"%s\"} 1\n",
+				st->devnm, st->sync_action);
+
+	metrics_head(f, "mdadm_array_sync_percent", "gauge",
+		     "Resync/recovery/reshape progress from /proc/mdstat, -1 if idle.");
+	for (st = statelist; st; st = st->next)
+		if (!st->err && st->devnm[0] && st->raid > 0)
+			fprintf(f, "mdadm_array_sync_percent{array=\"%s\"} %d\n",
+				st->devnm, st->percent >= 0 ? st->percent : -1);
+
+	metrics_head(f, "mdadm_array_sync_completed_sectors", "gauge",
+		     "Sectors completed by the current sync operation.");
+	for (st = statelist; st; st = st->next)
+		if (!st->err && st->sync_total)
+			fprintf(f, "mdadm_array_sync_completed_sectors{array=\"%s\"} %llu\n",
+				st->devnm, st->sync_completed);
+
+	metrics_head(f, "mdadm_array_sync_total_sectors", "gauge",
+		     "Sectors to be handled by the current sync operation.");
+	for (st = statelist; st; st = st->next)
+		if (!st->err && st->sync_total)
+			fprintf(f, "mdadm_array_sync_total_sectors{array=\"%s\"} %llu\n",
+				st->devnm, st->sync_total);
+
+	metrics_head(f, "mdadm_array_sync_speed_bytes", "gauge",
+		     "Recent speed of the current sync operation in bytes/second.");
+	for (st = statelist; st; st = st->next)
+		if (!st->err && st->sync_total)
+			fprintf(f, "mdadm_array_sync_speed_bytes{array=\"%s\"} %llu\n",
+				st->devnm, st->sync_speed * 1024);
+
+	metrics_head(f, "mdadm_array_mismatch_cnt", "gauge",
+		     "Value of mismatch_cnt after the last check or repair.");
+	for (st = statelist; st; st = st->next)
+		if (!st->err && st->mismatch_cnt >= 0)
+			fprintf(f, "mdadm_array_mismatch_cnt{array=\"%s\"} %lld\n",
+				st->devnm, st->mismatch_cnt);
+
+	metrics_head(f, "mdadm_array_events_total", "counter",
+		     "Events reported for the array since monitoring started.");
+	for (st = statelist; st; st = st->next) {
+		if (!st->devnm[0])
+			continue;
+		for (e = 0; e < NR_ALERT_EVENTS; e++)
+			fprintf(f, "mdadm_array_events_total{array=\"%s\",event=\"%s\"} %u\n",
+				st->devnm, alert_events[e], st->alerts[e]);
+	}
+
+	metrics_head(f, "mdadm_device_errors", "gauge",
+		     "Read errors corrected on the member device.");
+	for (st = statelist; st; st = st->next)
+		for (d = st->sra ? st->sra->devs : NULL; d; d = d->next)
+			fprintf(f, "mdadm_device_errors{array=\"%s\",device=\"%s\",slot=\"%d\"} %d\n",
+				st->devnm, d->sys_name + 4,
+				d->disk.raid_disk, d->errors);
+
+	metrics_head(f, "mdadm_device_faulty", "gauge",
+		     "1 if the member device has been marked faulty.");
+	for (st = statelist; st; st = st->next)
+		for (d = st->sra ? st->sra->devs : NULL; d; d = d->next)
+			fprintf(f, "mdadm_device_faulty{array=\"%s\",device=\"%s\"} %d\n",
+				st->devnm, d->sys_name + 4,
+				!!(d->disk.state & (1<<MD_DISK_FAULTY)));
+
+	metrics_head(f, "mdadm_device_in_sync", "gauge",
+		     "1 if the member device is fully in sync.");
+	for (st = statelist; st; st = st->next)
+		for (d = st->sra ? st->sra->devs : NULL; d; d = d->next)
+			fprintf(f, "mdadm_device_in_sync{array=\"%s\",device=\"%s\"} %d\n",
+				st->devnm, d->sys_name + 4,
+				!!(d->disk.state & (1<<MD_DISK_SYNC)));
+
+	metrics_head(f, "mdadm_monitor_last_poll_seconds", "gauge",
+		     "Time of the last poll, in seconds since the epoch.");
+	fprintf(f, "mdadm_monitor_last_poll_seconds %ld\n", (long)time(0));
+}
+
+static void metrics_publish(struct state *statelist, struct metrics_info *mi)
+{
+	FILE *f;
+	char *tmp;
+	int fd;
+
+	free(mi->buf);
+	mi->buf = NULL;
+	mi->len = 0;
+	f = open_memstream(&mi->buf, &mi->len);
+	if (!f)
+		return;
+	metrics_render(f, statelist);
+	if (fclose(f) != 0) {
+		free(mi->buf);
+		mi->buf = NULL;
+		mi->len = 0;
+		return;
+	}
+
+	if (!mi->file)
+		return;
+	/* Write a new file and rename it into place, so a
+	 * collector never sees a partial file.
+	 */
+	xasprintf(&tmp, "%s.tmp", mi->file);
+	fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+	if (fd < 0 ||
+	    write(fd, mi->buf, mi->len) != (ssize_t)mi->len ||
+	    rename(tmp, mi->file) < 0)
+		unlink(tmp);
+	if (fd >= 0)
+		close(fd);
+	free(tmp);
+}
+
+static void metrics_wait(struct metrics_info *mi, int seconds)
+{
+	/* Like mdstat_wait, but answer anyone who connects
+	 * to the metrics socket while we wait.
+	 */
+	struct timeval tm;
+	struct timeval snd = { 1, 0 };
+
+	tm.tv_sec = seconds;
+	tm.tv_usec = 0;
+	while (mdstat_wait_rfd(mi->sock, &tm)) {
+		size_t done = 0;
+		int fd = accept(mi->sock, NULL, NULL);
+
+		if (fd < 0)
+			continue;
+		/* Don't let a stuck reader stall the monitor */
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &snd, sizeof(snd));
+		while (done < mi->len) {
+			ssize_t n = send(fd, mi->buf + done, mi->len - done,
+					 MSG_NOSIGNAL);
+			if (n <= 0)
+				break;
+			done += n;
+		}
+		close(fd);
+	}
+}
+
 /* Not really Monitor but ... */
 int Wait(char *dev)
 {
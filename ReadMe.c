@@ -116,6 +116,7 @@ struct option long_options[] = {
     {"version",	  0, 0, 'V'},
     {"verbose",   0, 0, 'v'},
     {"quiet",	  0, 0, 'q'},
+    {"trace-timing", 2, 0, TraceTiming},
 
     /* For create or build: */
     {"chunk",	  1, 0, ChunkSize},
@@ -191,6 +192,8 @@ struct option long_options[] = {
     {"pid-file",  1, 0, 'i'},
     {"syslog",    0, 0, 'y'},
     {"no-sharing", 0, 0, NoSharing},
+    {"metrics",   1, 0, MetricsFile},
+    {"metrics-socket", 1, 0, MetricsSocket},
 
     /* For Grow */
     {"backup-file", 1,0, BackupFile},
@@ -201,6 +204,7 @@ struct option long_options[] = {
     /* For Incremental */
     {"rebuild-map", 0, 0, RebuildMapOpt},
     {"path", 1, 0, IncrementalPath},
+    {"service", 0, 0, IncrementalServiceOpt},
 
     {0, 0, 0, 0}
 };
@@ -256,6 +260,8 @@ char OptionHelp[] =
 "  --version     -V   : Print version information for mdadm\n"
 "  --verbose     -v   : Be more verbose about what is happening\n"
 "  --quiet       -q   : Don't print un-necessary messages\n"
+"  --trace-timing[=file]: Report where the time went, optionally as a\n"
+"                       trace-event JSON file\n"
 "  --brief       -b   : Be less verbose, more brief\n"
 "  --export      -Y   : With --detail, --detail-platform or --examine use\n"
 "                       key=value format for easy import into environment\n"
@@ -525,7 +531,7 @@ char Help_monitor[] =
 "The address for mailing advisories to, and the program to handle\n"
 "each change can be specified in the config file or on the command line.\n"
 "There must be at least one destination for advisories, whether\n"
-"an email address, a program, or --syslog\n"
+"an email address, a program, --syslog or --metrics\n"
 "\n"
 "Options that are valid with the monitor (-F --follow) mode are:\n"
 "  --mail=       -m   : Address to mail alerts of failure to\n"
@@ -540,6 +546,8 @@ char Help_monitor[] =
 "  --pid-file=   -i   : In daemon mode write pid to specified file instead of stdout\n"
 "  --oneshot     -1   : Check for degraded arrays, then exit\n"
 "  --test        -t   : Generate a TestMessage event against each array at startup\n"
+"  --metrics=         : Rewrite this file with Prometheus-style metrics after each poll\n"
+"  --metrics-socket=  : Serve the same metrics to anyone connecting to this socket\n"
 ;
 
 char Help_grow[] =
@@ -595,6 +603,8 @@ char Help_incr[] =
 "                   : required number of devices, but are not yet started.\n"
 "  --fail        -f : First fail (if needed) and then remove device from\n"
 "                   : any array that it is a member of.\n"
+"  --service        : Stay running and handle devices passed on by other\n"
+"                   : 'mdadm -I' invocations in batches.\n"
 ;
 
 char Help_config[] =
@@ -116,29 +116,149 @@ struct conf_dev {
 	char *name;
 } *cdevlist = NULL;
 
+/*
+ * "mdadm -As" calls conf_get_devs() once per array, and again after
+ * starting arrays in case they are stacked.  So each source of device
+ * names keeps the list it last produced, together with a key describing
+ * what it was built from (the text of /proc/partitions or /proc/mdstat,
+ * or the directories that DEVICE patterns search), and hands out a copy
+ * while the key is unchanged.
+ */
+struct devs_cache {
+	char *key;
+	struct mddev_dev *list;
+};
+
+static char *read_proc_file(char *path)
+{
+	int fd = open(path, O_RDONLY);
+	int size = 4096, len = 0, n;
+	char *buf;
+
+	if (fd < 0)
+		return NULL;
+	buf = xmalloc(size);
+	while ((n = read(fd, buf + len, size - len - 1)) > 0) {
+		len += n;
+		if (len == size - 1) {
+			size *= 2;
+			buf = xrealloc(buf, size);
+		}
+	}
+	close(fd);
+	if (n < 0) {
+		free(buf);
+		return NULL;
+	}
+	buf[len] = 0;
+	return buf;
+}
+
+static void free_dlist(struct mddev_dev *list)
+{
+	while (list) {
+		struct mddev_dev *t = list;
+		list = list->next;
+		free(t->devname);
+		free(t);
+	}
+}
+
+static struct mddev_dev *dup_dlist(struct mddev_dev *list)
+{
+	struct mddev_dev *rv = NULL, **dlp = &rv;
+
+	for (; list; list = list->next) {
+		*dlp = xcalloc(1, sizeof(**dlp));
+		(*dlp)->devname = xstrdup(list->devname);
+		dlp = &(*dlp)->next;
+	}
+	return rv;
+}
+
+static int devs_cache_get(struct devs_cache *dc, char *key,
+			  struct mddev_dev **listp)
+{
+	if (!key || !dc->key || strcmp(key, dc->key) != 0)
+		return 0;
+	*listp = dup_dlist(dc->list);
+	return 1;
+}
+
+static int mtime_settled(struct stat *stb)
+{
+	/* An mtime is only a usable key once the clock has moved on:
+	 * an entry added in the same tick as our scan would leave it
+	 * unchanged.
+	 */
+	return stb->st_mtim.tv_sec < time(NULL) - 1;
+}
+
+static void devs_cache_set(struct devs_cache *dc, char *key,
+			   struct mddev_dev *list)
+{
+	free(dc->key);
+	free_dlist(dc->list);
+	dc->key = key;
+	dc->list = dup_dlist(list);
+}
+
+static char *partition_name(int major, int minor, char *kname)
+{
+	/* The kernel's name is nearly always what map_dev() would
+	 * choose, and checking it costs a single stat().  md devices
+	 * are left to map_dev() so they get their /dev/md/ name.
+	 */
+	static char path[PATH_MAX];
+	struct stat stb;
+	char *c;
+
+	if (strncmp(kname, "md", 2) != 0) {
+		snprintf(path, sizeof(path), "/dev/%s", kname);
+		for (c = path; *c; c++)
+			if (*c == '!')
+				*c = '/';
+		if (stat(path, &stb) == 0 &&
+		    (stb.st_mode & S_IFMT) == S_IFBLK &&
+		    stb.st_rdev == makedev(major, minor))
+			return path;
+	}
+	return map_dev(major, minor, 1);
+}
+
 struct mddev_dev *load_partitions(void)
 {
-	FILE *f = fopen("/proc/partitions", "r");
-	char buf[1024];
+	static struct devs_cache cache;
+	char *buf = read_proc_file("/proc/partitions");
+	char *line, *next;
 	struct mddev_dev *rv = NULL;
-	if (f == NULL) {
+	if (buf == NULL) {
 		pr_err("cannot open /proc/partitions\n");
 		return NULL;
 	}
-	while (fgets(buf, 1024, f)) {
+	if (devs_cache_get(&cache, buf, &rv)) {
+		free(buf);
+		return rv;
+	}
+	for (line = buf; *line; line = next) {
 		int major, minor;
 		char *name, *mp;
+		char kname[256];
 		struct mddev_dev *d;
 
-		buf[1023] = '\0';
-		if (buf[0] != ' ')
+		next = strchrnul(line, '\n');
+		if (*next)
+			next++;
+		if (line[0] != ' ')
+			continue;
+		major = strtoul(line, &mp, 10);
+		if (mp == line || *mp != ' ')
 			continue;
-		major = strtoul(buf, &mp, 10);
-		if (mp == buf || *mp != ' ')
+		minor = strtoul(mp, &mp, 10);
+		if (sscanf(mp, " %*u %255s", kname) != 1)
 			continue;
-		minor = strtoul(mp, NULL, 10);
 
-		name = map_dev(major, minor, 1);
+		name = partition_name(major, minor, kname);
 		if (!name)
 			continue;
 		d = xmalloc(sizeof(*d));
@@ -147,21 +267,41 @@ struct mddev_dev *load_partitions(void)
 		d->next = rv;
 		rv = d;
 	}
-	fclose(f);
+	devs_cache_set(&cache, buf, rv);
 	return rv;
 }
 
 struct mddev_dev *load_containers(void)
 {
-	struct mdstat_ent *mdstat = mdstat_read(0, 0);
+	static struct devs_cache cache;
+	struct mdstat_ent *mdstat;
 	struct mdstat_ent *ent;
 	struct mddev_dev *d;
 	struct mddev_dev *rv = NULL;
 	struct map_ent *map = NULL, *me;
+	struct stat stb;
+	char *text, *key = NULL;
+	char path[PATH_MAX];
+
+	/* Names come from the map file, so it is part of the key */
+	snprintf(path, sizeof(path), "%s/proc/mdstat", sys_root());
+	text = read_proc_file(path);
+	if (text) {
+		if (stat(MAP_DIR "/" MAP_FILE, &stb) != 0)
+			memset(&stb, 0, sizeof(stb));
+		if (mtime_settled(&stb))
+			xasprintf(&key, "%lu %ld.%09ld\n%s",
+				  (unsigned long)stb.st_ino,
+				  (long)stb.st_mtim.tv_sec,
+				  stb.st_mtim.tv_nsec, text);
+		free(text);
+		if (devs_cache_get(&cache, key, &rv)) {
+			free(key);
+			return rv;
+		}
+	}
 
-	if (!mdstat)
-		return NULL;
-
+	mdstat = mdstat_read(0, 0);
 	for (ent = mdstat; ent; ent = ent->next)
 		if (ent->metadata_version &&
 		    strncmp(ent->metadata_version, "external:", 9) == 0 &&
@@ -181,6 +321,8 @@ struct mddev_dev *load_containers(void)
 	free_mdstat(mdstat);
 	map_free(map);
 
+	if (key)
+		devs_cache_set(&cache, key, rv);
 	return rv;
 }
 
@@ -933,20 +1075,58 @@ static void append_dlist(struct mddev_dev **dlp, struct mddev_dev *list)
 	*dlp = list;
 }
 
+static char *glob_key(void)
+{
+	/* What the DEVICE patterns would match can only change if one
+	 * of the directories they search changes.  Patterns with a
+	 * wildcard in the directory part, or whose directory changed
+	 * too recently to tell, are not cached.
+	 */
+	struct conf_dev *cd;
+	char *key = xstrdup("");
+
+	for (cd = cdevlist; cd; cd = cd->next) {
+		char dir[PATH_MAX];
+		char *sl, *k;
+		struct stat stb;
+
+		if (strcasecmp(cd->name, "partitions") == 0 ||
+		    strcasecmp(cd->name, "containers") == 0)
+			continue;
+		snprintf(dir, sizeof(dir), "%s", cd->name);
+		sl = strrchr(dir, '/');
+		if (sl == dir)
+			sl[1] = 0;
+		else if (sl)
+			*sl = 0;
+		else
+			strcpy(dir, ".");
+		if (strpbrk(dir, "*?[\\") || stat(dir, &stb) != 0 ||
+		    !mtime_settled(&stb)) {
+			free(key);
+			return NULL;
+		}
+		xasprintf(&k, "%s%s %ld.%09ld\n", key, cd->name,
+			  (long)stb.st_mtim.tv_sec, stb.st_mtim.tv_nsec);
+		free(key);
+		key = k;
+	}
+	return key;
+}
+
 struct mddev_dev *conf_get_devs()
 {
+	static struct devs_cache globbed;
 	glob_t globbuf;
 	struct conf_dev *cd;
 	int flags = 0;
 	static struct mddev_dev *dlist = NULL;
+	struct mddev_dev *glist = NULL;
 	unsigned int i;
+	char *key;
 
-	while (dlist) {
-		struct mddev_dev *t = dlist;
-		dlist = dlist->next;
-		free(t->devname);
-		free(t);
-	}
+	free_dlist(dlist);
+	dlist = NULL;
 
 	load_conffile();
 
@@ -961,22 +1141,34 @@ struct mddev_dev *conf_get_devs()
 			append_dlist(&dlist, load_partitions());
 		else if (strcasecmp(cd->name, "containers")==0)
 			append_dlist(&dlist, load_containers());
-		else {
+	}
+
+	key = glob_key();
+	if (devs_cache_get(&globbed, key, &glist)) {
+		free(key);
+	} else {
+		for (cd=cdevlist; cd; cd=cd->next) {
+			if (strcasecmp(cd->name, "partitions")==0 ||
+			    strcasecmp(cd->name, "containers")==0)
+				continue;
 			glob(cd->name, flags, NULL, &globbuf);
 			flags |= GLOB_APPEND;
 		}
-	}
-	if (flags & GLOB_APPEND) {
-		for (i=0; i<globbuf.gl_pathc; i++) {
-			struct mddev_dev *t = xmalloc(sizeof(*t));
-			memset(t, 0, sizeof(*t));
-			t->devname = xstrdup(globbuf.gl_pathv[i]);
-			t->next = dlist;
-			dlist = t;
+		if (flags & GLOB_APPEND) {
+			for (i=0; i<globbuf.gl_pathc; i++) {
+				struct mddev_dev *t = xmalloc(sizeof(*t));
+				memset(t, 0, sizeof(*t));
+				t->devname = xstrdup(globbuf.gl_pathv[i]);
+				t->next = glist;
+				glist = t;
 /*	printf("one dev is %s\n", t->devname);*/
+			}
+			globfree(&globbuf);
 		}
-		globfree(&globbuf);
+		devs_cache_set(&globbed, key, glist);
 	}
+	append_dlist(&glist, dlist);
+	dlist = glist;
 
 	return dlist;
 }
@@ -25,6 +25,7 @@
 #include	"mdadm.h"
 #include	"dlink.h"
 #include	<ctype.h>
+#include	<dirent.h>
 
 /* This fill contains various 'library' style function.  They
  * have no dependency on anything outside this file.
@@ -60,7 +61,7 @@ static int mdp_major = -1;
 
 char *devid2kname(int devid)
 {
-	char path[30];
+	char path[PATH_MAX];
 	char link[200];
 	static char devnm[32];
 	char *cp;
@@ -70,8 +71,8 @@ char *devid2kname(int devid)
 	 * /sys/dev/block/%d:%d link which must look like
 	 * and take the last component.
 	 */
-	sprintf(path, "/sys/dev/block/%d:%d", major(devid),
-		minor(devid));
+	sprintf(path, "%s/sys/dev/block/%d:%d", sys_root(),
+		major(devid), minor(devid));
 	n = readlink(path, link, sizeof(link)-1);
 	if (n > 0) {
 		link[n] = 0;
@@ -86,7 +87,7 @@ char *devid2kname(int devid)
 
 char *devid2devnm(int devid)
 {
-	char path[30];
+	char path[PATH_MAX];
 	char link[200];
 	static char devnm[32];
 	char *cp, *ep;
@@ -99,8 +100,8 @@ char *devid2devnm(int devid)
 	 * or
 	 *    ...../block/md_FOO
 	 */
-	sprintf(path, "/sys/dev/block/%d:%d", major(devid),
-		minor(devid));
+	sprintf(path, "%s/sys/dev/block/%d:%d", sys_root(),
+		major(devid), minor(devid));
 	n = readlink(path, link, sizeof(link)-1);
 	if (n > 0) {
 		link[n] = 0;
@@ -141,15 +142,84 @@ char *fd2devnm(int fd)
 
 /*
  * convert a major/minor pair for a block device into a name in /dev, if possible.
- * On the first call, walk /dev collecting name.
- * Put them in a simple linked listfor now.
+ * Names are kept in a small hash table indexed by major/minor.
+ * Rather than walking all of /dev on the first call, we look for
+ * the kernel name given by /sys/dev/block, and collect the
+ * /dev/md and /dev/disk/by-* symlinks once.  Only when none of
+ * those give a name do we fall back to walking /dev.  /dev/md is read
+ * again whenever it changes, as arrays get their names there while we
+ * run.
  */
 struct devmap {
 	int major, minor;
-	char *name;
+	char *name;		/* NULL just records that the kernel name
+				 * has been looked for */
 	struct devmap *next;
-} *devlist = NULL;
-int devlist_ready = 0;
+};
+#define DEVMAP_HASH 256
+static struct devmap *devmap_hash[DEVMAP_HASH];
+static int devlist_ready = 0;	/* /dev has been walked */
+static int devdirs_ready = 0;	/* /dev/md and /dev/disk have been read */
+static struct timespec devmd_mtime;	/* of /dev/md when last read */
+static time_t devmd_read;		/* when that was */
+
+static struct devmap **devmap_bucket(int major, int minor)
+{
+	return &devmap_hash[(major * 37 + minor) % DEVMAP_HASH];
+}
+
+static void devmap_add(int major, int minor, const char *name)
+{
+	struct devmap **b = devmap_bucket(major, minor);
+	struct devmap *dm;
+
+	for (dm = *b; dm; dm = dm->next)
+		if (dm->major == major && dm->minor == minor &&
+		    ((!name && !dm->name) ||
+		     (name && dm->name && strcmp(dm->name, name) == 0)))
+			return;
+	dm = xmalloc(sizeof(*dm));
+	dm->major = major;
+	dm->minor = minor;
+	dm->name = name ? xstrdup(name) : NULL;
+	dm->next = *b;
+	*b = dm;
+}
+
+static void devmap_forget(const char *prefix)
+{
+	/* Drop all names starting with 'prefix' */
+	int l = strlen(prefix);
+	int i;
+
+	for (i = 0; i < DEVMAP_HASH; i++) {
+		struct devmap **dp = &devmap_hash[i], *d;
+
+		while ((d = *dp) != NULL) {
+			if (d->name && strncmp(d->name, prefix, l) == 0) {
+				*dp = d->next;
+				free(d->name);
+				free(d);
+			} else
+				dp = &d->next;
+		}
+	}
+}
+
+static void devmap_free(void)
+{
+	int i;
+
+	for (i = 0; i < DEVMAP_HASH; i++)
+		while (devmap_hash[i]) {
+			struct devmap *d = devmap_hash[i];
+			devmap_hash[i] = d->next;
+			free(d->name);
+			free(d);
+		}
+	devlist_ready = 0;
+	devdirs_ready = 0;
+}
 
 int add_dev(const char *name, const struct stat *stb, int flag, struct FTW *s)
 {
@@ -163,20 +233,102 @@ int add_dev(const char *name, const struct stat *stb, int flag, struct FTW *s)
 
 	if ((stb->st_mode&S_IFMT)== S_IFBLK) {
 		char *n = xstrdup(name);
-		struct devmap *dm = xmalloc(sizeof(*dm));
 		if (strncmp(n, "/dev/./", 7)==0)
 			strcpy(n+4, name+6);
-		if (dm) {
-			dm->major = major(stb->st_rdev);
-			dm->minor = minor(stb->st_rdev);
-			dm->name = n;
-			dm->next = devlist;
-			devlist = dm;
-		}
+		devmap_add(major(stb->st_rdev), minor(stb->st_rdev), n);
+		free(n);
 	}
 	return 0;
 }
 
+static void add_dev_dir(char *dir)
+{
+	DIR *d = opendir(dir);
+	struct dirent *de;
+	char path[PATH_MAX];
+	struct stat stb;
+
+	if (!d)
+		return;
+	while ((de = readdir(d)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		if (stat(path, &stb) == 0)
+			add_dev(path, &stb, 0, NULL);
+	}
+	closedir(d);
+}
+
+static void add_dev_dirs(void)
+{
+	/* Collect the names that are most likely to be
+	 * preferred: /dev/md/ and the /dev/disk/by-* links.
+	 */
+	DIR *d;
+	struct dirent *de;
+	char path[PATH_MAX];
+	struct stat stb;
+
+	if (stat("/dev/md", &stb) == 0)
+		devmd_mtime = stb.st_mtim;
+	else
+		memset(&devmd_mtime, 0, sizeof(devmd_mtime));
+	devmd_read = time(NULL);
+	add_dev_dir("/dev/md");
+	d = opendir("/dev/disk");
+	if (d) {
+		while ((de = readdir(d)) != NULL) {
+			if (de->d_name[0] == '.')
+				continue;
+			snprintf(path, sizeof(path), "/dev/disk/%s", de->d_name);
+			add_dev_dir(path);
+		}
+		closedir(d);
+	}
+	devdirs_ready = 1;
+}
+
+static void check_dev_md(void)
+{
+	/* If names have come or gone in /dev/md since it was
+	 * read, read it again.  Directory times are only as fine as
+	 * the clock tick, so a change just after a read can leave the
+	 * same time: don't trust a time that was that recent.
+	 */
+	struct stat stb;
+
+	if (stat("/dev/md", &stb) != 0)
+		memset(&stb.st_mtim, 0, sizeof(stb.st_mtim));
+	if (stb.st_mtim.tv_sec == devmd_mtime.tv_sec &&
+	    stb.st_mtim.tv_nsec == devmd_mtime.tv_nsec &&
+	    devmd_mtime.tv_sec < devmd_read - 1)
+		return;
+	devmd_mtime = stb.st_mtim;
+	devmd_read = time(NULL);
+	devmap_forget("/dev/md/");
+	add_dev_dir("/dev/md");
+}
+
+static void add_dev_kname(int major, int minor)
+{
+	/* Look up the kernel's name for the device and check that
+	 * /dev/NAME is that device.
+	 */
+	char *kname = devid2kname(makedev(major, minor));
+	struct stat stb;
+	char path[PATH_MAX];
+
+	devmap_add(major, minor, NULL);
+	if (!kname)
+		return;
+	snprintf(path, sizeof(path), "/dev/%s", kname);
+	if (stat(path, &stb) == 0 &&
+	    (stb.st_mode & S_IFMT) == S_IFBLK &&
+	    stb.st_rdev == makedev(major, minor))
+		devmap_add(major, minor, path);
+}
+
 #ifndef HAVE_NFTW
 #ifdef HAVE_FTW
 int add_dev_1(const char *name, const struct stat *stb, int flag)
@@ -209,31 +361,30 @@ char *map_dev_preferred(int major, int minor, int create,
 	struct devmap *p;
 	char *regular = NULL, *preferred=NULL;
 	int did_check = 0;
+	int probed;
 
 	if (major == 0 && minor == 0)
 			return NULL;
 
  retry:
+	if (!devdirs_ready)
+		add_dev_dirs();
+	else
+		check_dev_md();
 	if (!devlist_ready) {
-		char *dev = "/dev";
-		struct stat stb;
-		while(devlist) {
-			struct devmap *d = devlist;
-			devlist = d->next;
-			free(d->name);
-			free(d);
-		}
-		if (lstat(dev, &stb)==0 &&
-		    S_ISLNK(stb.st_mode))
-			dev = "/dev/.";
-		nftw(dev, add_dev, 10, FTW_PHYS);
-		devlist_ready=1;
-		did_check = 1;
+		/* Have we looked for the kernel name yet? */
+		probed = 0;
+		for (p = *devmap_bucket(major, minor); p; p = p->next)
+			if (p->major == major && p->minor == minor &&
+			    p->name == NULL)
+				probed = 1;
+		if (!probed)
+			add_dev_kname(major, minor);
 	}
 
-	for (p=devlist; p; p=p->next)
+	for (p = *devmap_bucket(major, minor); p; p=p->next)
 		if (p->major == major &&
-		    p->minor == minor) {
+		    p->minor == minor && p->name) {
 			if (strncmp(p->name, "/dev/md/",8) == 0
 			    || (prefer && strstr(p->name, prefer))) {
 				if (preferred == NULL ||
@@ -246,7 +397,20 @@ char *map_dev_preferred(int major, int minor, int create,
 			}
 		}
 	if (!regular && !preferred && !did_check) {
-		devlist_ready = 0;
+		/* Nothing quick worked, or names are stale:
+		 * start again with a full walk of /dev
+		 */
+		char *dev = "/dev";
+		struct stat stb;
+
+		devmap_free();
+		add_dev_dirs();
+		if (lstat(dev, &stb)==0 &&
+		    S_ISLNK(stb.st_mode))
+			dev = "/dev/.";
+		nftw(dev, add_dev, 10, FTW_PHYS);
+		devlist_ready=1;
+		did_check = 1;
 		goto retry;
 	}
 	if (create && !regular && !preferred) {
@@ -411,6 +575,22 @@ int check_env(char *name)
 	return 0;
 }
 
+char *sys_root(void)
+{
+	/* Normally "", but MDADM_SYS_ROOT can name a directory
+	 * holding a synthetic sys/ and proc/mdstat so that
+	 * monitoring can be exercised at scale without real arrays.
+	 */
+	static char *root = NULL;
+
+	if (!root) {
+		root = getenv("MDADM_SYS_ROOT");
+		if (!root || strcmp(root, "/") == 0)
+			root = "";
+	}
+	return root;
+}
+
 int use_udev(void)
 {
 	static int use = -1;
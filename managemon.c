@@ -106,6 +106,7 @@
 #include	"mdmon.h"
 #include	<sys/syscall.h>
 #include	<sys/socket.h>
+#include	<sys/eventfd.h>
 #include	<signal.h>
 
 static void close_aa(struct active_array *aa)
@@ -154,6 +155,7 @@ static struct active_array *duplicate_aa(struct active_array *aa)
 	newa->next = NULL;
 	newa->replaces = NULL;
 	newa->info.next = NULL;
+	newa->watched = 0;
 
 	dp2 = &newa->info.devs;
 
@@ -172,11 +174,11 @@ static struct active_array *duplicate_aa(struct active_array *aa)
 	return newa;
 }
 
+int monitor_wakefd = -1;
+
 static void wakeup_monitor(void)
 {
-	/* tgkill(getpid(), mon_tid, SIGUSR1); */
-	int pid = getpid();
-	syscall(SYS_tgkill, pid, mon_tid, SIGUSR1);
+	eventfd_write(monitor_wakefd, 1);
 }
 
 static void remove_old(void)
@@ -214,9 +216,78 @@ static void replace_array(struct supertype *container,
 	wakeup_monitor();
 }
 
-struct metadata_update *update_queue = NULL;
+/* Updates go to the monitor through a bounded ring that any thread
+ * can add to without a lock (each producer claims a slot by moving
+ * 'head', then publishes it by setting the slot's sequence number).
+ * The monitor takes them in order and returns them on
+ * update_queue_handled for us to free, as it must not call free().
+ * 'updates_done' counts what it has processed, so once it catches up
+ * with 'head' there is nothing in flight.
+ */
+struct update_ring update_ring;
+unsigned int updates_done;
 struct metadata_update *update_queue_handled = NULL;
-struct metadata_update *update_queue_pending = NULL;
+
+int init_update_queue(void)
+{
+	int i;
+
+	for (i = 0; i < UPDATE_RING_SIZE; i++)
+		update_ring.slot[i].seq = i;
+	monitor_wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	return monitor_wakefd;
+}
+
+static int update_ring_put(struct supertype *container,
+			   struct metadata_update *mu)
+{
+	unsigned int pos = __atomic_load_n(&update_ring.head, __ATOMIC_RELAXED);
+	struct update_slot *slot;
+
+	while (1) {
+		int dif;
+
+		slot = &update_ring.slot[pos % UPDATE_RING_SIZE];
+		dif = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos;
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&update_ring.head, &pos,
+							pos + 1, 1,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0)
+			return -1; /* full */
+		else
+			pos = __atomic_load_n(&update_ring.head,
+					      __ATOMIC_RELAXED);
+	}
+	slot->container = container;
+	slot->mu = mu;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* Only the monitor takes from the ring */
+struct metadata_update *update_ring_get(struct supertype **container)
+{
+	unsigned int pos = update_ring.tail;
+	struct update_slot *slot = &update_ring.slot[pos % UPDATE_RING_SIZE];
+	struct metadata_update *mu;
+
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+		return NULL;
+	mu = slot->mu;
+	*container = slot->container;
+	__atomic_store_n(&slot->seq, pos + UPDATE_RING_SIZE, __ATOMIC_RELEASE);
+	update_ring.tail = pos + 1;
+	return mu;
+}
+
+static int update_queue_idle(void)
+{
+	return __atomic_load_n(&updates_done, __ATOMIC_ACQUIRE) ==
+		__atomic_load_n(&update_ring.head, __ATOMIC_ACQUIRE);
+}
 
 static void free_updates(struct metadata_update **update)
 {
@@ -238,24 +309,39 @@ static void free_updates(struct metadata_update **update)
 
 void check_update_queue(struct supertype *container)
 {
-	free_updates(&update_queue_handled);
+	struct metadata_update *handled;
 
-	if (update_queue == NULL &&
-	    update_queue_pending) {
-		update_queue = update_queue_pending;
-		update_queue_pending = NULL;
-		wakeup_monitor();
+	handled = __atomic_exchange_n(&update_queue_handled, NULL,
+				      __ATOMIC_ACQUIRE);
+	free_updates(&handled);
+}
+
+/* Wait for the monitor to have processed everything queued so far */
+static void wait_update_queue(struct supertype *container)
+{
+	while (!update_queue_idle()) {
+		check_update_queue(container);
+		usleep(15*1000);
 	}
+	check_update_queue(container);
 }
 
-static void queue_metadata_update(struct metadata_update *mu)
+static void queue_metadata_update(struct supertype *container,
+				  struct metadata_update *mu)
 {
-	struct metadata_update **qp;
+	while (mu) {
+		struct metadata_update *next = mu->next;
 
-	qp = &update_queue_pending;
-	while (*qp)
-		qp = & ((*qp)->next);
-	*qp = mu;
+		mu->next = NULL;
+		while (update_ring_put(container, mu) < 0) {
+			/* full, give the monitor a chance to catch up */
+			wakeup_monitor();
+			check_update_queue(NULL);
+			usleep(1000);
+		}
+		mu = next;
+	}
+	wakeup_monitor();
 }
 
 static void add_disk_to_container(struct supertype *st, struct mdinfo *sd)
@@ -305,7 +391,7 @@ static void add_disk_to_container(struct supertype *st, struct mdinfo *sd)
 	st->update_tail = &update;
 	st->ss->add_to_super(st, &dk, dfd, NULL, INVALID_SECTORS);
 	st->ss->write_init_super(st);
-	queue_metadata_update(update);
+	queue_metadata_update(st, update);
 	st->update_tail = NULL;
 }
 
@@ -334,7 +420,7 @@ static void remove_disk_from_container(struct supertype *st, struct mdinfo *sd)
 	 * but with 'remove' we don't ant to write to that device!
 	 */
 	st->ss->write_init_super(st);
-	queue_metadata_update(update);
+	queue_metadata_update(st, update);
 	st->update_tail = NULL;
 }
 
@@ -519,8 +605,7 @@ static void manage_member(struct mdstat_ent *mdstat,
 	 * might container a change (such as a spare assignment) which
 	 * could affect our decisions.
 	 */
-	if (a->check_degraded && !frozen &&
-	    update_queue == NULL && update_queue_pending == NULL) {
+	if (a->check_degraded && !frozen && update_queue_idle()) {
 		struct metadata_update *updates = NULL;
 		struct mdinfo *newdev = NULL;
 		struct active_array *newa;
@@ -556,12 +641,9 @@ static void manage_member(struct mdstat_ent *mdstat,
 			}
 			disk_init_and_add(newd, d, newa);
 		}
-		queue_metadata_update(updates);
+		queue_metadata_update(container, updates);
 		updates = NULL;
-		while (update_queue_pending || update_queue) {
-			check_update_queue(container);
-			usleep(15*1000);
-		}
+		wait_update_queue(container);
 		replace_array(container, a, newa);
 		if (sysfs_set_str(&a->info, NULL, "sync_action", "recover")
 		    == 0)
@@ -803,11 +885,9 @@ static void handle_message(struct supertype *container, struct metadata_update *
 
 	struct metadata_update *mu;
 
-	if (msg->len <= 0)
-		while (update_queue_pending || update_queue) {
-			check_update_queue(container);
-			usleep(15*1000);
-		}
+	if (msg->len <= 0 && msg->len != MSG_STATS &&
+	    msg->len != MSG_UPDATES && msg->len != MSG_FEATURES)
+		wait_update_queue(container);
 
 	if (msg->len == 0) { /* ping_monitor */
 		int cnt;
@@ -826,6 +906,25 @@ static void handle_message(struct supertype *container, struct metadata_update *
 
 		manage(mdstat, container);
 		free_mdstat(mdstat);
+	} else if (msg->len == MSG_STATS || msg->len == MSG_FEATURES) {
+		/* answered by read_sock() */
+	} else if (msg->len == MSG_UPDATES) {
+		/* queue them all, for the monitor to take in one pass */
+		struct metadata_update *batch = NULL, **tail = &batch;
+
+		while ((mu = msg->next) != NULL) {
+			msg->next = mu->next;
+			mu->next = NULL;
+			if (sigterm ||
+			    (container->ss->prepare_update &&
+			     !container->ss->prepare_update(container, mu))) {
+				free_updates(&mu);
+				continue;
+			}
+			*tail = mu;
+			tail = &mu->next;
+		}
+		queue_metadata_update(container, batch);
 	} else if (!sigterm) {
 		mu = xmalloc(sizeof(*mu));
 		mu->len = msg->len;
@@ -837,7 +936,7 @@ static void handle_message(struct supertype *container, struct metadata_update *
 		if (container->ss->prepare_update)
 			if (!container->ss->prepare_update(container, mu))
 				free_updates(&mu);
-		queue_metadata_update(mu);
+		queue_metadata_update(container, mu);
 	}
 }
 
@@ -869,6 +968,17 @@ void read_sock(struct supertype *container)
 				msg.len = strlen(Version) + 1;
 				if (send_message(fd, &msg, tmo) < 0)
 					terminate = 1;
+			} else if (msg.len == MSG_STATS) {
+				msg.buf = mon_stats_report();
+				msg.len = msg.buf ? strlen(msg.buf) + 1 : 0;
+				if (send_message(fd, &msg, tmo) < 0)
+					terminate = 1;
+				free(msg.buf);
+			} else if (msg.len == MSG_FEATURES) {
+				msg.buf = MDMON_FEATURES;
+				msg.len = strlen(MDMON_FEATURES) + 1;
+				if (send_message(fd, &msg, tmo) < 0)
+					terminate = 1;
 			} else if (ack(fd, tmo) < 0)
 				terminate = 1;
 		} else
@@ -881,44 +991,68 @@ void read_sock(struct supertype *container)
 
 int exit_now = 0;
 int manager_ready = 0;
-void do_manager(struct supertype *container)
+void do_manager(struct supertype *containers)
 {
+	struct supertype *container;
 	struct mdstat_ent *mdstat;
 	sigset_t set;
+	int *socks;
+	int cnt = 0;
 
 	sigprocmask(SIG_UNBLOCK, NULL, &set);
 	sigdelset(&set, SIGUSR1);
 	sigdelset(&set, SIGTERM);
 
+	for (container = containers; container;
+	     container = container->next_container)
+		cnt++;
+	socks = xcalloc(cnt, sizeof(*socks));
+
 	do {
+		int i = 0;
 
 		if (exit_now)
 			exit(0);
 
 		/* Can only 'manage' things if 'monitor' is not making
 		 * structural changes to metadata, so need to check
-		 * update_queue
+		 * the update queue
 		 */
-		if (update_queue == NULL) {
+		if (update_queue_idle()) {
 			mdstat = mdstat_read(1, 0);
 
-			manage(mdstat, container);
+			for (container = containers; container;
+			     container = container->next_container) {
+				if (container->retired)
+					continue;
+				manage(mdstat, container);
 
-			read_sock(container);
+				read_sock(container);
+			}
 
 			free_mdstat(mdstat);
 		}
 		remove_old();
 
-		check_update_queue(container);
+		check_update_queue(containers);
 
 		manager_ready = 1;
 
 		if (sigterm)
 			wakeup_monitor();
 
-		if (update_queue == NULL)
-			mdstat_wait_fd(container->sock, &set);
+		for (container = containers; container;
+		     container = container->next_container) {
+			/* The monitor has let go of it */
+			if (container->retired && container->sock >= 0) {
+				close(container->sock);
+				container->sock = -1;
+			}
+			socks[i++] = container->sock;
+		}
+
+		if (update_queue_idle())
+			mdstat_wait_fds(socks, cnt, &set);
 		else
 			/* If an update is happening, just wait for signal */
 			pselect(0, NULL, NULL, NULL, NULL, &set);
@@ -41,6 +41,13 @@
  * The best place for the mapfile is /run/mdadm/map.  Distros and users
  * which have not switched to /run yet can choose a different location
  * at compile time via MAP_DIR and MAP_FILE.
+ *
+ * The file is only ever replaced by rename(), so readers always see a
+ * complete version of it and need no lock.  Writers serialise on a
+ * separate short-lived lock (map.wlock) and apply their change to the
+ * current file, not to whatever they read earlier, so updates from
+ * processes that don't hold map_lock() are never lost.  map_lock() is
+ * still what callers use to serialise deciding which array to create.
  */
 #include	"mdadm.h"
 #include	<sys/file.h>
@@ -49,17 +56,20 @@
 #define MAP_READ 0
 #define MAP_NEW 1
 #define MAP_LOCK 2
-#define MAP_DIRNAME 3
+#define MAP_WLOCK 3
+#define MAP_DIRNAME 4
 
-char *mapname[4] = {
+char *mapname[5] = {
 	MAP_DIR "/" MAP_FILE,
 	MAP_DIR "/" MAP_FILE ".new",
 	MAP_DIR "/" MAP_FILE ".lock",
+	MAP_DIR "/" MAP_FILE ".wlock",
 	MAP_DIR
 };
 
-int mapmode[3] = { O_RDONLY, O_RDWR|O_CREAT, O_RDWR|O_CREAT|O_TRUNC };
-char *mapsmode[3] = { "r", "w", "w"};
+int mapmode[4] = { O_RDONLY, O_RDWR|O_CREAT, O_RDWR|O_CREAT|O_TRUNC,
+		   O_RDWR|O_CREAT };
+char *mapsmode[4] = { "r", "w", "w", "r+"};
 
 FILE *open_map(int modenum)
 {
@@ -75,7 +85,37 @@ FILE *open_map(int modenum)
 	return NULL;
 }
 
-int map_write(struct map_ent *mel)
+static int wlock_fd = -1;
+static int wlock_depth;
+
+static void map_wlock(void)
+{
+	/* Nests, as map_read() may need to RebuildMap() while an
+	 * update holds the lock.
+	 */
+	int fd;
+
+	if (wlock_depth++)
+		return;
+	(void)mkdir(mapname[MAP_DIRNAME], 0755);
+	fd = open(mapname[MAP_WLOCK], mapmode[MAP_WLOCK], 0600);
+	if (fd >= 0 && flock(fd, LOCK_EX) != 0) {
+		close(fd);
+		fd = -1;
+	}
+	wlock_fd = fd;
+}
+
+static void map_wunlock(void)
+{
+	if (--wlock_depth)
+		return;
+	if (wlock_fd >= 0)
+		close(wlock_fd);
+	wlock_fd = -1;
+}
+
+static int __map_write(struct map_ent *mel)
 {
 	FILE *f;
 	int err;
@@ -104,6 +144,16 @@ int map_write(struct map_ent *mel)
 		      mapname[0]) == 0;
 }
 
+int map_write(struct map_ent *mel)
+{
+	int rv;
+
+	map_wlock();
+	rv = __map_write(mel);
+	map_wunlock();
+	return rv;
+}
+
 static FILE *lf = NULL;
 int map_lock(struct map_ent **melp)
 {
@@ -158,6 +208,88 @@ void map_fork(void)
 	}
 }
 
+/* Lookups go through hash chains built over the list that was last
+ * searched.  The list itself stays the primary structure, as callers
+ * walk it directly.
+ */
+#define MAP_HASH 64
+
+static struct map_index {
+	struct map_ent *head;
+	struct map_ent *uuid[MAP_HASH];
+	struct map_ent *devnm[MAP_HASH];
+	struct map_ent *name[MAP_HASH];
+} map_idx;
+
+static unsigned int map_hash_str(char *s)
+{
+	unsigned int h = 5381;
+
+	while (*s)
+		h = h * 33 + (unsigned char)*s++;
+	return h % MAP_HASH;
+}
+
+static unsigned int map_hash_uuid(int uuid[4])
+{
+	return (unsigned int)(uuid[0] ^ uuid[1] ^ uuid[2] ^ uuid[3]) % MAP_HASH;
+}
+
+static char *map_md_name(struct map_ent *me)
+{
+	if (!me->path || strncmp(me->path, "/dev/md/", 8) != 0)
+		return NULL;
+	return me->path + 8;
+}
+
+static void map_index_insert(struct map_ent *me, int at_head)
+{
+	struct map_ent **mpp;
+	char *name;
+
+	mpp = &map_idx.uuid[map_hash_uuid(me->uuid)];
+	while (!at_head && *mpp)
+		mpp = &(*mpp)->hnext_uuid;
+	me->hnext_uuid = *mpp;
+	*mpp = me;
+
+	mpp = &map_idx.devnm[map_hash_str(me->devnm)];
+	while (!at_head && *mpp)
+		mpp = &(*mpp)->hnext_devnm;
+	me->hnext_devnm = *mpp;
+	*mpp = me;
+
+	me->hnext_name = NULL;
+	name = map_md_name(me);
+	if (!name)
+		return;
+	mpp = &map_idx.name[map_hash_str(name)];
+	while (!at_head && *mpp)
+		mpp = &(*mpp)->hnext_name;
+	me->hnext_name = *mpp;
+	*mpp = me;
+}
+
+static void map_index_forget(void)
+{
+	memset(&map_idx, 0, sizeof(map_idx));
+}
+
+static void map_index(struct map_ent *map)
+{
+	/* Chains keep list order, so lookups return the same entry a
+	 * linear search would.
+	 */
+	struct map_ent *me;
+
+	if (map && map_idx.head == map)
+		return;
+	map_index_forget();
+	map_idx.head = map;
+	for (me = map; me; me = me->next)
+		map_index_insert(me, 0);
+}
+
 void map_add(struct map_ent **melp,
 	     char * devnm, char *metadata, int uuid[4], char *path)
 {
@@ -169,6 +301,12 @@ void map_add(struct map_ent **melp,
 	me->path = path ? xstrdup(path) : NULL;
 	me->next = *melp;
 	me->bad = 0;
+	if (*melp && map_idx.head == *melp) {
+		/* New head of an indexed list, so first in every chain */
+		map_index_insert(me, 1);
+		map_idx.head = me;
+	} else
+		me->hnext_uuid = me->hnext_devnm = me->hnext_name = NULL;
 	*melp = me;
 }
 
@@ -204,6 +342,8 @@ void map_read(struct map_ent **melp)
 
 void map_free(struct map_ent *map)
 {
+	if (map && map == map_idx.head)
+		map_index_forget();
 	while (map) {
 		struct map_ent *mp = map;
 		map = mp->next;
@@ -212,16 +352,41 @@ void map_free(struct map_ent *map)
 	}
 }
 
+static void map_prune(struct map_ent **mapp, struct map_ent *old)
+{
+	/* Drop entries that a lookup in 'old' found to be stale */
+	for (; old; old = old->next) {
+		struct map_ent **mpp, *mp;
+
+		if (!old->bad)
+			continue;
+		for (mpp = mapp; (mp = *mpp) != NULL; )
+			if (strcmp(mp->devnm, old->devnm) == 0 &&
+			    memcmp(mp->uuid, old->uuid, 16) == 0) {
+				*mpp = mp->next;
+				free(mp->path);
+				free(mp);
+			} else
+				mpp = &mp->next;
+	}
+}
+
 int map_update(struct map_ent **mpp, char *devnm, char *metadata,
 	       int *uuid, char *path)
 {
+	/* Apply this one change to the current map file, whatever
+	 * the caller may have read before.
+	 */
 	struct map_ent *map, *mp;
 	int rv;
 
-	if (mpp && *mpp)
-		map = *mpp;
-	else
-		map_read(&map);
+	map_wlock();
+	map_read(&map);
+	if (mpp && *mpp) {
+		map_prune(&map, *mpp);
+		map_free(*mpp);
+		*mpp = NULL;
+	}
 
 	for (mp = map ; mp ; mp=mp->next)
 		if (strcmp(mp->devnm, devnm) == 0) {
@@ -234,9 +399,8 @@ int map_update(struct map_ent **mpp, char *devnm, char *metadata,
 		}
 	if (!mp)
 		map_add(&map, devnm, metadata, uuid, path);
-	if (mpp)
-		*mpp = NULL;
-	rv = map_write(map);
+	rv = __map_write(map);
+	map_wunlock();
 	map_free(map);
 	return rv;
 }
@@ -248,6 +412,7 @@ void map_delete(struct map_ent **mapp, char *devnm)
 	if (*mapp == NULL)
 		map_read(mapp);
 
+	map_index_forget();
 	for (mp = *mapp; mp; mp = *mapp) {
 		if (strcmp(mp->devnm, devnm) == 0) {
 			*mapp = mp->next;
@@ -260,12 +425,21 @@ void map_delete(struct map_ent **mapp, char *devnm)
 
 void map_remove(struct map_ent **mapp, char *devnm)
 {
+	struct map_ent *map;
+
 	if (devnm[0] == 0)
 		return;
 
-	map_delete(mapp, devnm);
-	map_write(*mapp);
+	sbcache_remove(devnm);
+	map_wlock();
+	map_read(&map);
+	map_prune(&map, *mapp);
+	map_delete(&map, devnm);
+	__map_write(map);
+	map_wunlock();
+	map_free(map);
 	map_free(*mapp);
+	*mapp = NULL;
 }
 
 struct map_ent *map_by_uuid(struct map_ent **map, int uuid[4])
@@ -274,7 +448,9 @@ struct map_ent *map_by_uuid(struct map_ent **map, int uuid[4])
 	if (!*map)
 		map_read(map);
 
-	for (mp = *map ; mp ; mp = mp->next) {
+	map_index(*map);
+	for (mp = map_idx.uuid[map_hash_uuid(uuid)] ; mp ;
+	     mp = mp->hnext_uuid) {
 		if (memcmp(uuid, mp->uuid, 16) != 0)
 			continue;
 		if (!mddev_busy(mp->devnm)) {
@@ -292,7 +468,9 @@ struct map_ent *map_by_devnm(struct map_ent **map, char *devnm)
 	if (!*map)
 		map_read(map);
 
-	for (mp = *map ; mp ; mp = mp->next) {
+	map_index(*map);
+	for (mp = map_idx.devnm[map_hash_str(devnm)] ; mp ;
+	     mp = mp->hnext_devnm) {
 		if (strcmp(mp->devnm, devnm) != 0)
 			continue;
 		if (!mddev_busy(mp->devnm)) {
@@ -310,12 +488,10 @@ struct map_ent *map_by_name(struct map_ent **map, char *name)
 	if (!*map)
 		map_read(map);
 
-	for (mp = *map ; mp ; mp = mp->next) {
-		if (!mp->path)
-			continue;
-		if (strncmp(mp->path, "/dev/md/", 8) != 0)
-			continue;
-		if (strcmp(mp->path+8, name) != 0)
+	map_index(*map);
+	for (mp = map_idx.name[map_hash_str(name)] ; mp ;
+	     mp = mp->hnext_name) {
+		if (strcmp(map_md_name(mp), name) != 0)
 			continue;
 		if (!mddev_busy(mp->devnm)) {
 			mp->bad = 1;
@@ -506,3 +682,199 @@ void RebuildMap(void)
 	map_free(map);
 	free_mdstat(mdstat);
 }
+
+/*
+ * While "mdadm -I" assembles an array one device at a time, every
+ * invocation reads the superblock of every member already present to
+ * count how many are active.  To avoid that, a summary of each member's
+ * superblock is kept in MAP_DIR/<devnm>.sbcache and reused as long as
+ * the device at that dev_t is the same one (judged by its diskseq).
+ * The file is only trusted while the array is inactive, as then nothing
+ * else updates the superblocks, and is removed when the array is
+ * started or stopped.  It is read and written under the map lock.
+ */
+#define SBCACHE_MAGIC	0x4353444d	/* "MDSC" */
+
+struct sbcache_head {
+	int	magic;
+	int	entsize;	/* sizeof(struct mdinfo), in case it changes */
+	int	uuid[4];
+};
+
+struct sbcache_rec {
+	unsigned long long devid;
+	unsigned long long gen;
+	int	maplen;
+};
+
+static void sbcache_name(char *devnm, char *path)
+{
+	sprintf(path, "%s/%s.sbcache", MAP_DIR, devnm);
+}
+
+static unsigned long long dev_gen(dev_t devid)
+{
+	/* diskseq changes whenever different media appears at a
+	 * dev_t.  Partitions don't have their own, so use the disk's.
+	 */
+	char path[PATH_MAX];
+	char buf[30];
+	int fd, n;
+
+	sprintf(path, "%s/sys/dev/block/%d:%d/diskseq",
+		sys_root(), major(devid), minor(devid));
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		sprintf(path, "%s/sys/dev/block/%d:%d/../diskseq",
+			sys_root(), major(devid), minor(devid));
+		fd = open(path, O_RDONLY);
+	}
+	if (fd < 0)
+		return 0;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return 0;
+	buf[n] = 0;
+	return strtoull(buf, NULL, 10);
+}
+
+struct sbcache_ent *sbcache_read(char *devnm, int uuid[4])
+{
+	char path[PATH_MAX];
+	struct sbcache_head head;
+	struct sbcache_rec rec;
+	struct sbcache_ent *sbc = NULL, *se;
+	FILE *f;
+
+	sbcache_name(devnm, path);
+	f = fopen(path, "r");
+	if (!f)
+		return NULL;
+	if (fread(&head, sizeof(head), 1, f) != 1 ||
+	    head.magic != SBCACHE_MAGIC ||
+	    head.entsize != sizeof(struct mdinfo) ||
+	    memcmp(head.uuid, uuid, sizeof(head.uuid)) != 0) {
+		fclose(f);
+		return NULL;
+	}
+	while (fread(&rec, sizeof(rec), 1, f) == 1) {
+		if (rec.maplen < 0 || rec.maplen > MAX_DISKS)
+			break;
+		se = xcalloc(1, sizeof(*se));
+		se->devid = rec.devid;
+		se->gen = rec.gen;
+		se->maplen = rec.maplen;
+		se->map = xcalloc(rec.maplen + 1, 1);
+		if (fread(&se->info, sizeof(se->info), 1, f) != 1 ||
+		    fread(se->map, 1, rec.maplen, f) != (size_t)rec.maplen) {
+			free(se->map);
+			free(se);
+			break;
+		}
+		se->info.devs = se->info.next = NULL;
+		se->next = sbc;
+		sbc = se;
+	}
+	fclose(f);
+	return sbc;
+}
+
+/* Find the entry for devid, if it is still for the same device.  The
+ * device's generation is left in *genp for sbcache_add().  0 means it
+ * is unknown (no diskseq before Linux 5.15), and such entries are
+ * never matched or saved.
+ */
+struct sbcache_ent *sbcache_find(struct sbcache_ent *sbc, dev_t devid,
+				 unsigned long long *genp)
+{
+	unsigned long long gen = dev_gen(devid);
+
+	*genp = gen;
+	if (!gen)
+		return NULL;
+	for (; sbc; sbc = sbc->next)
+		if (sbc->devid == devid)
+			return sbc->gen == gen ? sbc : NULL;
+	return NULL;
+}
+
+void sbcache_add(struct sbcache_ent **sbcp, dev_t devid,
+		 unsigned long long gen,
+		 struct mdinfo *info, char *map, int maplen)
+{
+	struct sbcache_ent **sep, *se;
+
+	for (sep = sbcp; (se = *sep) != NULL; sep = &se->next)
+		if (se->devid == devid) {
+			*sep = se->next;
+			free(se->map);
+			free(se);
+			break;
+		}
+	se = xcalloc(1, sizeof(*se));
+	se->devid = devid;
+	se->gen = gen;
+	se->info = *info;
+	se->info.devs = se->info.next = NULL;
+	se->maplen = maplen;
+	se->map = xmalloc(maplen + 1);
+	memcpy(se->map, map, maplen);
+	se->next = *sbcp;
+	*sbcp = se;
+}
+
+void sbcache_write(char *devnm, int uuid[4], struct sbcache_ent *sbc)
+{
+	char path[PATH_MAX], tmp[PATH_MAX + 8];
+	struct sbcache_head head;
+	struct sbcache_rec rec;
+	FILE *f;
+	int err;
+
+	sbcache_name(devnm, path);
+	sprintf(tmp, "%s.new", path);
+	(void)mkdir(MAP_DIR, 0755);
+	f = fopen(tmp, "w");
+	if (!f)
+		return;
+	memset(&head, 0, sizeof(head));
+	head.magic = SBCACHE_MAGIC;
+	head.entsize = sizeof(struct mdinfo);
+	memcpy(head.uuid, uuid, sizeof(head.uuid));
+	fwrite(&head, sizeof(head), 1, f);
+	for (; sbc; sbc = sbc->next) {
+		if (!sbc->gen)
+			continue;
+		memset(&rec, 0, sizeof(rec));
+		rec.devid = sbc->devid;
+		rec.gen = sbc->gen;
+		rec.maplen = sbc->maplen;
+		fwrite(&rec, sizeof(rec), 1, f);
+		fwrite(&sbc->info, sizeof(sbc->info), 1, f);
+		fwrite(sbc->map, 1, sbc->maplen, f);
+	}
+	fflush(f);
+	err = ferror(f);
+	fclose(f);
+	if (err || rename(tmp, path) != 0)
+		unlink(tmp);
+}
+
+void sbcache_free(struct sbcache_ent *sbc)
+{
+	while (sbc) {
+		struct sbcache_ent *se = sbc;
+		sbc = se->next;
+		free(se->map);
+		free(se);
+	}
+}
+
+void sbcache_remove(char *devnm)
+{
+	char path[PATH_MAX];
+
+	sbcache_name(devnm, path);
+	unlink(path);
+}
@@ -86,6 +86,8 @@ int main(int argc, char *argv[])
 	int increments = 20;
 	int daemonise = 0;
 	char *pidfile = NULL;
+	char *metrics_file = NULL;
+	char *metrics_sock = NULL;
 	int oneshot = 0;
 	int spare_sharing = 1;
 	struct supertype *ss = NULL;
@@ -93,6 +95,7 @@ int main(int argc, char *argv[])
 	char *shortopt = short_options;
 	int dosyslog = 0;
 	int rebuild_map = 0;
+	int incr_service = 0;
 	char *remove_path = NULL;
 	char *udev_filename = NULL;
 	char *dump_directory = NULL;
@@ -104,6 +107,9 @@ int main(int argc, char *argv[])
 
 	srandom(time(0) ^ getpid());
 
+	if (getenv("MDADM_TRACE_TIMING"))
+		trace_init(getenv("MDADM_TRACE_TIMING"));
+
 	ident.uuid_set=0;
 	ident.level = UnSet;
 	ident.raid_disks = UnSet;
@@ -165,6 +171,10 @@ int main(int argc, char *argv[])
 			/* Silently ignore old option */
 			continue;
 
+		case TraceTiming:
+			trace_init(optarg);
+			continue;
+
 		case Prefer:
 			if (c.prefer)
 				free(c.prefer);
@@ -912,6 +922,20 @@ int main(int argc, char *argv[])
 		case O(MONITOR, NoSharing):
 			spare_sharing = 0;
 			continue;
+		case O(MONITOR, MetricsFile):
+			if (metrics_file)
+				pr_err("only specify one metrics file. %s ignored.\n",
+					optarg);
+			else
+				metrics_file = optarg;
+			continue;
+		case O(MONITOR, MetricsSocket):
+			if (metrics_sock)
+				pr_err("only specify one metrics socket. %s ignored.\n",
+					optarg);
+			else
+				metrics_sock = optarg;
+			continue;
 
 			/* now the general management options.  Some are applicable
 			 * to other modes. None have arguments.
@@ -1171,6 +1195,9 @@ int main(int argc, char *argv[])
 		case O(INCREMENTAL, IncrementalPath):
 			remove_path = optarg;
 			continue;
+		case O(INCREMENTAL, IncrementalServiceOpt):
+			incr_service = 1;
+			continue;
 		case O(CREATE, WriteJournal):
 			if (s.journaldisks) {
 				pr_err("Please specify only one journal device for the array.\n");
@@ -1530,7 +1557,7 @@ int main(int argc, char *argv[])
 		rv= Monitor(devlist, mailaddr, program,
 			    &c, daemonise, oneshot,
 			    dosyslog, pidfile, increments,
-			    spare_sharing);
+			    spare_sharing, metrics_file, metrics_sock);
 		break;
 
 	case GROW:
@@ -1602,6 +1629,14 @@ int main(int argc, char *argv[])
 		if (rebuild_map) {
 			RebuildMap();
 		}
+		if (incr_service) {
+			if (devlist || c.scan || devmode == 'f') {
+				pr_err("--incremental --service does not take devices.\n");
+				rv = 1;
+			} else
+				rv = IncrementalService(&c);
+			break;
+		}
 		if (c.scan) {
 			rv = 1;
 			if (devlist) {
@@ -1633,7 +1668,12 @@ int main(int argc, char *argv[])
 			}
 			rv = IncrementalRemove(devlist->devname, remove_path,
 					       c.verbose);
-		} else
+			break;
+		}
+		rv = -1;
+		if (!ss && !configfile)
+			rv = IncrementalForward(devlist, &c);
+		if (rv < 0)
 			rv = Incremental(devlist, &c, ss);
 		break;
 	case AUTODETECT:
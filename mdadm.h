@@ -280,6 +280,7 @@ struct mdinfo {
 	#define	DS_REMOVE	1024
 	#define	DS_UNBLOCK	2048
 	int prev_state, curr_state, next_state;
+	int stale; /* state_fd has fired since it was read */
 };
 
 struct createinfo {
@@ -377,6 +378,10 @@ enum special_options {
 	ClusterName,
 	ClusterConfirm,
 	WriteJournal,
+	MetricsFile,
+	MetricsSocket,
+	IncrementalServiceOpt,
+	TraceTiming,
 };
 
 enum prefix_standard {
@@ -515,7 +520,9 @@ extern struct mdstat_ent *mdstat_read(int hold, int start);
 extern void mdstat_close(void);
 extern void free_mdstat(struct mdstat_ent *ms);
 extern void mdstat_wait(int seconds);
+extern int mdstat_wait_rfd(int fd, struct timeval *tm);
 extern void mdstat_wait_fd(int fd, const sigset_t *sigmask);
+extern void mdstat_wait_fds(int *fdlist, int cnt, const sigset_t *sigmask);
 extern int mddev_busy(char *devnm);
 extern struct mdstat_ent *mdstat_by_component(char *name);
 extern struct mdstat_ent *mdstat_by_subdev(char *subdev, char *container);
@@ -527,6 +534,8 @@ struct map_ent {
 	int	uuid[4];
 	int	bad;
 	char	*path;
+	/* hash chains, see map_index() */
+	struct map_ent *hnext_uuid, *hnext_devnm, *hnext_name;
 };
 extern int map_update(struct map_ent **mpp, char *devnm, char *metadata,
 		      int uuid[4], char *path);
@@ -544,6 +553,28 @@ extern int map_lock(struct map_ent **melp);
 extern void map_unlock(struct map_ent **melp);
 extern void map_fork(void);
 
+/* Summary of a member device's superblock, as kept in MAP_DIR
+ * by "mdadm -I" for arrays that are still being assembled.
+ */
+struct sbcache_ent {
+	struct sbcache_ent *next;
+	dev_t	devid;
+	unsigned long long gen;	/* to notice a different device at devid,
+				 * 0 if unknown */
+	struct mdinfo info;	/* from getinfo_super() */
+	int	maplen;
+	char	*map;		/* ditto */
+};
+extern struct sbcache_ent *sbcache_read(char *devnm, int uuid[4]);
+extern struct sbcache_ent *sbcache_find(struct sbcache_ent *sbc, dev_t devid,
+					unsigned long long *genp);
+extern void sbcache_add(struct sbcache_ent **sbcp, dev_t devid,
+			unsigned long long gen,
+			struct mdinfo *info, char *map, int maplen);
+extern void sbcache_write(char *devnm, int uuid[4], struct sbcache_ent *sbc);
+extern void sbcache_free(struct sbcache_ent *sbc);
+extern void sbcache_remove(char *devnm);
+
 /* various details can be requested */
 enum sysfs_read_flags {
 	GET_LEVEL	= (1 << 0),
@@ -575,6 +606,7 @@ extern void sysfs_free(struct mdinfo *sra);
 extern struct mdinfo *sysfs_read(int fd, char *devnm, unsigned long options);
 extern int sysfs_attr_match(const char *attr, const char *str);
 extern int sysfs_match_word(const char *word, char **list);
+extern void sysfs_uncache(char *devnm, char *devname);
 extern int sysfs_set_str(struct mdinfo *sra, struct mdinfo *dev,
 			 char *name, char *val);
 extern int sysfs_set_num(struct mdinfo *sra, struct mdinfo *dev,
@@ -603,6 +635,7 @@ extern int sysfs_unique_holder(char *devnm, long rdev);
 extern int sysfs_freeze_array(struct mdinfo *sra);
 extern int sysfs_wait(int fd, int *msec);
 extern int load_sys(char *path, char *buf);
+extern int load_sys_at(int dirfd, char *path, char *buf);
 extern int reshape_prepare_fdlist(char *devname,
 				  struct mdinfo *sra,
 				  int raid_disks,
@@ -1061,6 +1094,10 @@ struct supertype {
 			 */
 	int devcnt;
 	int retry_soon;
+	struct supertype *next_container; /* others in the same mdmon */
+	int retired; /* mdmon has let go of it */
+	int updated; /* updates processed, metadata not yet written */
+	unsigned int dirty_arrays;
 	int nodes;
 	char *cluster_name;
 
@@ -1071,10 +1108,62 @@ struct supertype {
 extern struct supertype *super_by_fd(int fd, char **subarray);
 enum guess_types { guess_any, guess_array, guess_partitions };
 extern struct supertype *guess_super_type(int fd, enum guess_types guess_type);
+extern ssize_t probe_read(int fd, void *buf, size_t len);
+extern ssize_t probe_pread(int fd, void *buf, size_t len,
+			   unsigned long long pos);
+extern void probe_window_drop(int fd);
 static inline struct supertype *guess_super(int fd) {
 	return guess_super_type(fd, guess_any);
 }
 extern struct supertype *dup_super(struct supertype *st);
+
+/* One device to be examined by probe_devices().  'fn' fills in
+ * everything after 'devname'.
+ */
+struct dev_probe {
+	char *devname;
+	struct supertype *st;	/* with superblock loaded, if found */
+	struct stat stb;
+	int err;		/* errno if the device could not be opened */
+	int rv;			/* result from load_super() and friends */
+	int container;
+};
+extern void probe_devices(struct dev_probe *probes, int cnt,
+			  void (*fn)(struct dev_probe *dp, void *arg),
+			  void *arg);
+extern void probe_lock(void);
+extern void probe_unlock(void);
+
+/* Writes to several devices which are issued together by
+ * batch_write_submit(), see util.c.  The batch is meant to be kept
+ * and reused so that once it has grown, writing needs no allocation.
+ */
+struct batch_write {
+	int fd;
+	void *buf;
+	size_t len;
+	unsigned long long offset;
+	void *owner;		/* for the caller, e.g. the disk written */
+	int err;		/* errno if the write failed */
+};
+struct write_batch {
+	int cnt, max;
+	struct batch_write *w;
+	unsigned long ctx;	/* aio_context_t */
+	int ctx_size;
+	void *iocbs;
+};
+extern void batch_write_add(struct write_batch *wb, int fd, void *buf,
+			    size_t len, unsigned long long offset, void *owner);
+extern int batch_write_submit(struct write_batch *wb);
+extern void batch_write_free(struct write_batch *wb);
+/* If set, called as each write completes with how long it took */
+extern void (*batch_write_done)(struct batch_write *w,
+				unsigned long long usec);
+static inline void batch_write_reset(struct write_batch *wb)
+{
+	wb->cnt = 0;
+}
 extern int get_dev_size(int fd, char *dname, unsigned long long *sizep);
 extern int must_be_container(int fd);
 extern int dev_size_from_id(dev_t id, unsigned long long *size);
@@ -1122,6 +1211,8 @@ struct pol_rule {
 		char *name;
 		char *value;
 		char *dups; /* duplicates of 'value' with a partNN appended */
+		enum { rule_exact, rule_prefix, rule_glob } match;
+		int prefix_len;	/* literal characters before any wildcard */
 	} *rule;
 };
 
@@ -1273,7 +1364,7 @@ extern int Monitor(struct mddev_dev *devlist,
 		   struct context *c,
 		   int daemonise, int oneshot,
 		   int dosyslog, char *pidfile, int increments,
-		   int share);
+		   int share, char *metrics_file, char *metrics_sock);
 
 extern int Kill(char *dev, struct supertype *st, int force, int verbose, int noexcl);
 extern int Kill_subarray(char *dev, char *subarray, int verbose);
@@ -1287,6 +1378,8 @@ extern int Incremental(struct mddev_dev *devlist, struct context *c,
 extern void RebuildMap(void);
 extern int IncrementalScan(struct context *c, char *devnm);
 extern int IncrementalRemove(char *devname, char *path, int verbose);
+extern int IncrementalForward(struct mddev_dev *devlist, struct context *c);
+extern int IncrementalService(struct context *c);
 extern int CreateBitmap(char *filename, int force, char uuid[16],
 			unsigned long chunksize, unsigned long daemon_sleep,
 			unsigned long write_behind,
@@ -1433,8 +1526,10 @@ extern struct superswitch *version_to_superswitch(char *vers);
 extern int mdmon_running(char *devnm);
 extern int mdmon_pid(char *devnm);
 extern int check_env(char *name);
+extern char *sys_root(void);
 extern __u32 random32(void);
 extern int start_mdmon(char *devnm);
+extern void set_mdmon_stdio(int out, int err);
 
 extern int child_monitor(int afd, struct mdinfo *sra, struct reshape *reshape,
 			 struct supertype *st, unsigned long stripes,
@@ -1548,6 +1643,19 @@ void *xrealloc(void *ptr, size_t len);
 void *xcalloc(size_t num, size_t size);
 char *xstrdup(const char *str);
 
+/* Timing trace, see trace.c */
+extern int trace_enabled;
+extern void trace_init(char *file);
+extern unsigned long long trace_now(void);
+extern void __trace_end(unsigned long long start, const char *phase,
+			const char *detail);
+#define trace_start() (trace_enabled ? trace_now() : 0)
+#define trace_end(start, phase, detail)				\
+	do {							\
+		if (trace_enabled)				\
+			__trace_end(start, phase, detail);	\
+	} while (0)
+
 #define	LEVEL_MULTIPATH		(-4)
 #define	LEVEL_LINEAR		(-1)
 #define	LEVEL_FAULTY		(-5)
@@ -206,6 +206,43 @@ static void try_kill_monitor(pid_t pid, char *devname, int sock)
 	 */
 }
 
+/* An mdmon started with --one-process monitors several containers, and
+ * a take-over kills it, so it can only be taken over for all of them at
+ * once.  Return a container that the mdmon for 'devnm' monitors but
+ * which isn't in 'devnms', or NULL.
+ */
+static char *shared_container(char *devnm, char **devnms, int cnt)
+{
+	static char other[32];
+	int pid = mdmon_pid(devnm);
+	DIR *dir;
+	struct dirent *de;
+	char *rv = NULL;
+
+	if (pid <= 0)
+		return NULL;
+	dir = opendir(MDMON_DIR);
+	if (!dir)
+		return NULL;
+	while (!rv && (de = readdir(dir)) != NULL) {
+		char *ext = strrchr(de->d_name, '.');
+		int i;
+
+		if (!ext || strcmp(ext, ".pid") != 0 ||
+		    ext - de->d_name >= (int)sizeof(other))
+			continue;
+		snprintf(other, sizeof(other), "%.*s",
+			 (int)(ext - de->d_name), de->d_name);
+		for (i = 0; i < cnt; i++)
+			if (strcmp(other, devnms[i]) == 0)
+				break;
+		if (i == cnt && mdmon_pid(other) == pid)
+			rv = other;
+	}
+	closedir(dir);
+	return rv;
+}
+
 void remove_pidfile(char *devname)
 {
 	char buf[100];
@@ -277,11 +314,34 @@ void usage(void)
 "  --all         -a   : All devices\n"
 "  --foreground  -F   : Run in foreground (do not fork)\n"
 "  --takeover    -t   : Takeover container\n"
+"  --stats       -s   : Report latency statistics of the running mdmon\n"
+"  --one-process -o   : Monitor all the containers given from one process\n"
 );
 	exit(2);
 }
 
-static int mdmon(char *devnm, int must_fork, int takeover);
+static int mdmon(char **devnms, int cnt, int must_fork, int takeover);
+
+static char *name_to_devnm(char *container_name)
+{
+	char *devnm = NULL;
+
+	if (strncmp(container_name, "md", 2) == 0) {
+		int id = devnm2devid(container_name);
+		if (id)
+			devnm = container_name;
+	} else {
+		struct stat st;
+
+		if (stat(container_name, &st) == 0)
+			devnm = xstrdup(stat2devnm(&st));
+	}
+
+	if (!devnm)
+		pr_err("%s is not a valid md device name\n",
+			container_name);
+	return devnm;
+}
 
 int main(int argc, char *argv[])
 {
@@ -292,12 +352,16 @@ int main(int argc, char *argv[])
 	int all = 0;
 	int takeover = 0;
 	int dofork = 1;
+	int stats = 0;
+	int one_process = 0;
 	static struct option options[] = {
 		{"all", 0, NULL, 'a'},
 		{"takeover", 0, NULL, 't'},
 		{"help", 0, NULL, 'h'},
 		{"offroot", 0, NULL, OffRootOpt},
 		{"foreground", 0, NULL, 'F'},
+		{"stats", 0, NULL, 's'},
+		{"one-process", 0, NULL, 'o'},
 		{NULL, 0, NULL, 0}
 	};
 
@@ -310,7 +374,7 @@ int main(int argc, char *argv[])
 		argv[0][0] = '@';
 	}
 
-	while ((opt = getopt_long(argc, argv, "thaF", options, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, "thaFso", options, NULL)) != -1) {
 		switch (opt) {
 		case 'a':
 			container_name = argv[optind-1];
@@ -322,6 +386,12 @@ int main(int argc, char *argv[])
 		case 'F':
 			dofork = 0;
 			break;
+		case 's':
+			stats = 1;
+			break;
+		case 'o':
+			one_process = 1;
+			break;
 		case OffRootOpt:
 			argv[0][0] = '@';
 			break;
@@ -340,7 +410,7 @@ int main(int argc, char *argv[])
 	if (container_name == NULL)
 		usage();
 
-	if (argc - optind > 1)
+	if (argc - optind > 1 && (!one_process || all || stats))
 		usage();
 
 	if (strcmp(container_name, "/proc/mdstat") == 0)
@@ -349,13 +419,24 @@ int main(int argc, char *argv[])
 	if (all) {
 		struct mdstat_ent *mdstat, *e;
 		int container_len = strlen(container_name);
+		char **devnms = NULL;
+		int cnt = 0;
 
-		/* launch an mdmon instance for each container found */
+		/* launch an mdmon instance for each container found,
+		 * or one for all of them
+		 */
 		mdstat = mdstat_read(0, 0);
 		for (e = mdstat; e; e = e->next) {
 			if (e->metadata_version &&
 			    strncmp(e->metadata_version, "external:", 9) == 0 &&
 			    !is_subarray(&e->metadata_version[9])) {
+				devnm = e->devnm;
+				if (one_process) {
+					devnms = xrealloc(devnms, (cnt + 1) *
+							  sizeof(*devnms));
+					devnms[cnt++] = xstrdup(devnm);
+					continue;
+				}
 				/* update cmdline so this mdmon instance can be
 				 * distinguished from others in a call to ps(1)
 				 */
@@ -363,54 +444,184 @@ int main(int argc, char *argv[])
 					memset(container_name, 0, container_len);
 					sprintf(container_name, "%s", e->devnm);
 				}
-				status |= mdmon(e->devnm, 1, takeover);
+				status |= mdmon(&devnm, 1, 1, takeover);
 			}
 		}
 		free_mdstat(mdstat);
+		if (cnt)
+			status |= mdmon(devnms, cnt, 1, takeover);
 
 		return status;
-	} else if (strncmp(container_name, "md", 2) == 0) {
-		int id = devnm2devid(container_name);
-		if (id)
-			devnm = container_name;
-	} else {
-		struct stat st;
-
-		if (stat(container_name, &st) == 0)
-			devnm = xstrdup(stat2devnm(&st));
+	} else if (one_process) {
+		char **devnms = xcalloc(argc - optind, sizeof(*devnms));
+		int i;
+
+		for (i = 0; i < argc - optind; i++) {
+			devnms[i] = name_to_devnm(argv[optind + i]);
+			if (!devnms[i])
+				exit(1);
+		}
+		return mdmon(devnms, i, dofork && do_fork(), takeover);
 	}
 
-	if (!devnm) {
-		pr_err("%s is not a valid md device name\n",
-			container_name);
+	devnm = name_to_devnm(container_name);
+	if (!devnm)
 		exit(1);
+	if (stats) {
+		char *report = mdmon_stats(devnm);
+
+		if (!report) {
+			pr_err("cannot get statistics from mdmon for %s\n",
+			       container_name);
+			exit(1);
+		}
+		fputs(report, stdout);
+		free(report);
+		return 0;
 	}
-	return mdmon(devnm, dofork && do_fork(), takeover);
+	return mdmon(&devnm, 1, dofork && do_fork(), takeover);
 }
 
-static int mdmon(char *devnm, int must_fork, int takeover)
+/* Load the container and take it over from any mdmon that has it.
+ * That mdmon's pid and a connection to it are left in *victim and
+ * *victim_sock for try_kill_monitor().
+ */
+static struct supertype *start_container(char *devnm, int mdfd, int takeover,
+					 pid_t *victim, int *victim_sock)
 {
-	int mdfd;
 	struct mdinfo *mdi, *di;
 	struct supertype *container;
+
+	container = xcalloc(1, sizeof(*container));
+	strcpy(container->devnm, devnm);
+	container->arrays = NULL;
+	container->sock = -1;
+	container->dirty_arrays = ~0; /* start at some non-zero value */
+
+	mdi = sysfs_read(mdfd, container->devnm, GET_VERSION|GET_LEVEL|GET_DEVS);
+
+	if (!mdi) {
+		pr_err("failed to load sysfs info for %s\n", container->devnm);
+		goto fail;
+	}
+	if (mdi->array.level != UnSet) {
+		pr_err("%s is not a container - cannot monitor\n", devnm);
+		goto fail;
+	}
+	if (mdi->array.major_version != -1 ||
+	    mdi->array.minor_version != -2) {
+		pr_err("%s does not use external metadata - cannot monitor\n",
+			devnm);
+		goto fail;
+	}
+
+	container->ss = version_to_superswitch(mdi->text_version);
+	if (container->ss == NULL) {
+		pr_err("%s uses unsupported metadata: %s\n",
+			devnm, mdi->text_version);
+		goto fail;
+	}
+
+	container->devs = NULL;
+	for (di = mdi->devs; di; di = di->next) {
+		struct mdinfo *cd = xmalloc(sizeof(*cd));
+		*cd = *di;
+		cd->next = container->devs;
+		container->devs = cd;
+	}
+	sysfs_free(mdi);
+	mdi = NULL;
+
+	*victim = mdmon_pid(container->devnm);
+	if (*victim >= 0)
+		*victim_sock = connect_monitor(container->devnm);
+
+	if (!takeover && *victim > 0 && *victim_sock >= 0) {
+		if (fping_monitor(*victim_sock) == 0) {
+			pr_err("%s already managed\n", container->devnm);
+			goto fail;
+		}
+		close(*victim_sock);
+		*victim_sock = -1;
+	}
+	if (container->ss->load_container(container, mdfd, devnm)) {
+		pr_err("Cannot load metadata for %s\n", devnm);
+		goto fail;
+	}
+	close(mdfd);
+	mdfd = -1;
+
+	/* Ok, this is close enough.  We can say goodbye to our parent now.
+	 */
+	if (*victim > 0)
+		remove_pidfile(devnm);
+	if (make_pidfile(devnm) < 0)
+		goto fail;
+	container->sock = make_control_sock(devnm);
+	return container;
+
+fail:
+	sysfs_free(mdi);
+	if (*victim_sock >= 0)
+		close(*victim_sock);
+	*victim = -1;
+	*victim_sock = -1;
+	if (mdfd >= 0)
+		close(mdfd);
+	return NULL;
+}
+
+static int mdmon(char **devnms, int cnt, int must_fork, int takeover)
+{
+	int *mdfd;
+	struct supertype *containers = NULL, **tail = &containers;
 	sigset_t set;
 	struct sigaction act;
 	int pfd[2];
 	int status;
 	int ignore;
-	pid_t victim = -1;
-	int victim_sock = -1;
+	pid_t *victim;
+	int *victim_sock;
+	int i, j;
+
+	mdfd = xcalloc(cnt, sizeof(*mdfd));
+	victim = xcalloc(cnt, sizeof(*victim));
+	victim_sock = xcalloc(cnt, sizeof(*victim_sock));
+	/* A container we cannot open is dropped from the list, and
+	 * the others are still monitored.
+	 */
+	for (i = j = 0; i < cnt; i++) {
+		int fd;
 
-	dprintf("starting mdmon for %s\n", devnm);
+		dprintf("starting mdmon for %s\n", devnms[i]);
 
-	mdfd = open_dev(devnm);
-	if (mdfd < 0) {
-		pr_err("%s: %s\n", devnm, strerror(errno));
-		return 1;
+		fd = open_dev(devnms[i]);
+		if (fd < 0) {
+			pr_err("%s: %s\n", devnms[i], strerror(errno));
+			continue;
+		}
+		if (md_get_version(fd) < 0) {
+			pr_err("%s: Not an md device\n", devnms[i]);
+			close(fd);
+			continue;
+		}
+		devnms[j] = devnms[i];
+		mdfd[j] = fd;
+		victim[j] = -1;
+		victim_sock[j] = -1;
+		j++;
 	}
-	if (md_get_version(mdfd) < 0) {
-		pr_err("%s: Not an md device\n", devnm);
+	cnt = j;
+	if (!cnt)
 		return 1;
+	for (i = 0; takeover && i < cnt; i++) {
+		char *other = shared_container(devnms[i], devnms, cnt);
+
+		if (other) {
+			pr_err("mdmon for %s also monitors %s, take them over together with --one-process\n",
+			       devnms[i], other);
+			return 1;
+		}
 	}
 
 	/* Fork, and have the child tell us when they are ready */
@@ -438,45 +649,8 @@ static int mdmon(char *devnm, int must_fork, int takeover)
 	} else
 		pfd[0] = pfd[1] = -1;
 
-	container = xcalloc(1, sizeof(*container));
-	strcpy(container->devnm, devnm);
-	container->arrays = NULL;
-	container->sock = -1;
-
-	mdi = sysfs_read(mdfd, container->devnm, GET_VERSION|GET_LEVEL|GET_DEVS);
-
-	if (!mdi) {
-		pr_err("failed to load sysfs info for %s\n", container->devnm);
-		exit(3);
-	}
-	if (mdi->array.level != UnSet) {
-		pr_err("%s is not a container - cannot monitor\n", devnm);
-		exit(3);
-	}
-	if (mdi->array.major_version != -1 ||
-	    mdi->array.minor_version != -2) {
-		pr_err("%s does not use external metadata - cannot monitor\n",
-			devnm);
-		exit(3);
-	}
-
-	container->ss = version_to_superswitch(mdi->text_version);
-	if (container->ss == NULL) {
-		pr_err("%s uses unsupported metadata: %s\n",
-			devnm, mdi->text_version);
-		exit(3);
-	}
-
-	container->devs = NULL;
-	for (di = mdi->devs; di; di = di->next) {
-		struct mdinfo *cd = xmalloc(sizeof(*cd));
-		*cd = *di;
-		cd->next = container->devs;
-		container->devs = cd;
-	}
-	sysfs_free(mdi);
-
-	/* SIGUSR is sent between parent and child.  So both block it
+	/* SIGUSR is sent by the monitor to the manager (the manager
+	 * wakes the monitor through monitor_wakefd).  Both block it
 	 * and enable it only with pselect.
 	 */
 	sigemptyset(&set);
@@ -491,33 +665,22 @@ static int mdmon(char *devnm, int must_fork, int takeover)
 	act.sa_handler = SIG_IGN;
 	sigaction(SIGPIPE, &act, NULL);
 
-	victim = mdmon_pid(container->devnm);
-	if (victim >= 0)
-		victim_sock = connect_monitor(container->devnm);
-
 	ignore = chdir("/");
-	if (!takeover && victim > 0 && victim_sock >= 0) {
-		if (fping_monitor(victim_sock) == 0) {
-			pr_err("%s already managed\n", container->devnm);
-			exit(3);
-		}
-		close(victim_sock);
-		victim_sock = -1;
-	}
-	if (container->ss->load_container(container, mdfd, devnm)) {
-		pr_err("Cannot load metadata for %s\n", devnm);
-		exit(3);
-	}
-	close(mdfd);
-
-	/* Ok, this is close enough.  We can say goodbye to our parent now.
+	/* With --one-process, a container that cannot be monitored
+	 * is left for the others.
 	 */
-	if (victim > 0)
-		remove_pidfile(devnm);
-	if (make_pidfile(devnm) < 0) {
-		exit(3);
+	for (i = 0; i < cnt; i++) {
+		struct supertype *container;
+
+		container = start_container(devnms[i], mdfd[i], takeover,
+					    &victim[i], &victim_sock[i]);
+		if (!container)
+			continue;
+		*tail = container;
+		tail = &container->next_container;
 	}
-	container->sock = make_control_sock(devnm);
+	if (!containers)
+		exit(3);
 
 	status = 0;
 	if (pfd[1] >= 0) {
@@ -529,16 +692,22 @@ static int mdmon(char *devnm, int must_fork, int takeover)
 
 	mlockall(MCL_CURRENT | MCL_FUTURE);
 
-	if (clone_monitor(container) < 0) {
+	if (init_update_queue() < 0) {
+		pr_err("cannot create eventfd: %s\n", strerror(errno));
+		exit(2);
+	}
+	if (clone_monitor(containers) < 0) {
 		pr_err("failed to start monitor process: %s\n",
 			strerror(errno));
 		exit(2);
 	}
 
-	if (victim > 0) {
-		try_kill_monitor(victim, container->devnm, victim_sock);
-		if (victim_sock >= 0)
-			close(victim_sock);
+	for (i = 0; i < cnt; i++) {
+		if (victim[i] > 0) {
+			try_kill_monitor(victim[i], devnms[i], victim_sock[i]);
+			if (victim_sock[i] >= 0)
+				close(victim_sock[i]);
+		}
 	}
 
 	setsid();
@@ -557,7 +726,7 @@ static int mdmon(char *devnm, int must_fork, int takeover)
 	if (ignore)
 		ignore++;
 
-	do_manager(container);
+	do_manager(containers);
 
 	exit(0);
 }
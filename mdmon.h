@@ -49,6 +49,12 @@ struct active_array {
 
 	int check_degraded; /* flag set by mon, read by manage */
 	int check_reshape; /* flag set by mon, read by manage */
+
+	int watched; /* fds are in the monitor's epoll set */
+	int fired; /* one of them has fired since read_and_act */
+	int stale; /* which attributes read_and_act must read again */
+	int act; /* read_and_act result waiting for the metadata write */
+	unsigned long long sync_completed; /* as last read */
 };
 
 /*
@@ -62,7 +68,22 @@ struct active_array {
  * superswitch.  All common code sees them as opaque
  * blobs.
  */
-extern struct metadata_update *update_queue, *update_queue_handled;
+#define UPDATE_RING_SIZE 64
+struct update_ring {
+	unsigned int head;	/* next slot a producer will claim */
+	unsigned int tail;	/* next slot the monitor will take */
+	struct update_slot {
+		unsigned int seq;
+		struct supertype *container;
+		struct metadata_update *mu;
+	} slot[UPDATE_RING_SIZE];
+};
+extern struct update_ring update_ring;
+extern unsigned int updates_done;
+extern struct metadata_update *update_queue_handled;
+extern int monitor_wakefd;
+int init_update_queue(void);
+struct metadata_update *update_ring_get(struct supertype **container);
 
 #define MD_MAJOR 9
 
@@ -72,8 +93,8 @@ extern struct active_array *pending_discard;
 extern struct md_generic_cmd *active_cmd;
 
 void remove_pidfile(char *devname);
-void do_monitor(struct supertype *container);
-void do_manager(struct supertype *container);
+void do_monitor(struct supertype *containers);
+void do_manager(struct supertype *containers);
 extern int sigterm;
 
 int read_dev_state(int fd);
@@ -85,6 +106,38 @@ extern int exit_now, manager_ready;
 extern int mon_tid, mgr_tid;
 extern int monitor_loop_cnt;
 
+/* Latency histograms kept by the monitor.  Bucket i counts events
+ * that took less than 2^i microseconds, the last one everything
+ * longer.  They are read by the manager to answer 'mdmon --stats'.
+ */
+#define LAT_BUCKETS 24
+struct lat_hist {
+	unsigned long count;
+	unsigned long long total, max; /* microseconds */
+	unsigned long bucket[LAT_BUCKETS];
+};
+
+#define STATS_UPDATE_TYPES 16
+#define STATS_DISKS 64
+struct mon_stats {
+	unsigned long wakeups;
+	unsigned long disk_writes;
+	struct lat_hist write_pending; /* wakeup until 'active' is written */
+	struct lat_hist sync_metadata; /* writing metadata after an event */
+	int nupdates;
+	struct {
+		int type; /* first word of the update */
+		struct lat_hist hist; /* processing and writing it */
+	} update[STATS_UPDATE_TYPES];
+	int ndisks;
+	struct {
+		dev_t devid;
+		struct lat_hist hist;
+	} disk[STATS_DISKS];
+};
+extern struct mon_stats mon_stats;
+extern char *mon_stats_report(void);
+
 /* helper routine to determine resync completion since MaxSector is a
  * moving target
  */
@@ -139,8 +139,12 @@ struct mdstat_ent *mdstat_read(int hold, int start)
 			f = fdopen(fd, "r");
 		else
 			return NULL;
-	} else
-		f = fopen("/proc/mdstat", "r");
+	} else {
+		char path[PATH_MAX];
+
+		snprintf(path, sizeof(path), "%s/proc/mdstat", sys_root());
+		f = fopen(path, "r");
+	}
 	if (f == NULL)
 		return NULL;
 	else
@@ -296,31 +300,61 @@ void mdstat_close(void)
 
 void mdstat_wait(int seconds)
 {
-	fd_set fds;
 	struct timeval tm;
+
+	tm.tv_sec = seconds;
+	tm.tv_usec = 0;
+	mdstat_wait_rfd(-1, &tm);
+}
+
+int mdstat_wait_rfd(int fd, struct timeval *tm)
+{
+	/* Wait for /proc/mdstat to change, for 'tm' to expire
+	 * or for 'fd' (if >= 0) to become readable.
+	 * 'tm' is updated to hold the time remaining.
+	 * Returns 1 if 'fd' is readable, else 0.
+	 */
+	fd_set fds, rfds;
 	int maxfd = 0;
 	FD_ZERO(&fds);
+	FD_ZERO(&rfds);
 	if (mdstat_fd >= 0) {
 		FD_SET(mdstat_fd, &fds);
 		maxfd = mdstat_fd;
 	}
-	tm.tv_sec = seconds;
-	tm.tv_usec = 0;
-	select(maxfd + 1, NULL, NULL, &fds, &tm);
+	if (fd >= 0) {
+		FD_SET(fd, &rfds);
+		if (fd > maxfd)
+			maxfd = fd;
+	}
+	if (select(maxfd + 1, &rfds, NULL, &fds, tm) <= 0)
+		return 0;
+	return fd >= 0 && FD_ISSET(fd, &rfds);
 }
 
 void mdstat_wait_fd(int fd, const sigset_t *sigmask)
+{
+	mdstat_wait_fds(&fd, 1, sigmask);
+}
+
+/* as mdstat_wait_fd, for any of several fds */
+void mdstat_wait_fds(int *fdlist, int cnt, const sigset_t *sigmask)
 {
 	fd_set fds, rfds;
 	int maxfd = 0;
+	int i;
 
 	FD_ZERO(&fds);
 	FD_ZERO(&rfds);
 	if (mdstat_fd >= 0)
 		FD_SET(mdstat_fd, &fds);
 
-	if (fd >= 0) {
+	for (i = 0; i < cnt; i++) {
+		int fd = fdlist[i];
 		struct stat stb;
+
+		if (fd < 0)
+			continue;
 		fstat(fd, &stb);
 		if ((stb.st_mode & S_IFMT) == S_IFREG)
 			/* Must be a /proc or /sys fd, so expect
@@ -21,7 +21,8 @@
 #include "mdadm.h"
 #include "mdmon.h"
 #include <sys/syscall.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <signal.h>
 
 static char *array_states[] = {
@@ -36,22 +37,126 @@ static int write_attr(char *attr, int fd)
 	return write(fd, attr, strlen(attr));
 }
 
-static void add_fd(fd_set *fds, int *maxfd, int fd)
+/*
+ * The monitor waits on the sysfs files of all arrays with one epoll
+ * set, so there is no limit on the number of fds and a wakeup costs
+ * nothing per fd that didn't fire.  Each array's fds are added once,
+ * when the monitor first finds it on the list.  A replacement from the
+ * manager shares the fds of the array it replaces, so they are just
+ * pointed at the new one.
+ *
+ * So that read_and_act() only has to read what changed, the event
+ * data says which file fired: for the array's own attributes it is the
+ * array with the attribute's WATCH_* tag in the low bits (allocations
+ * are at least 8 byte aligned), for a member's state it is the mdinfo.
+ * The manager wakes us through monitor_wakefd, which has no owner.
+ */
+#define WATCH_WAKE	0UL
+#define WATCH_MEMBER	0
+#define WATCH_STATE	1
+#define WATCH_ACTION	2
+#define WATCH_SYNC	3
+#define WATCH_MASK	3UL
+
+#define STALE(tag)	(1 << (tag))
+#define STALE_ALL	(~0)
+
+static int epfd = -1;
+
+static void watch_fd(int fd, void *owner, int tag)
+{
+	struct epoll_event ev;
+
+	if (fd < 0)
+		return;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLPRI;
+	ev.data.u64 = (unsigned long)owner | tag;
+	if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) < 0 && errno == ENOENT &&
+	    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		dprintf("cannot watch fd %d: %s\n", fd, strerror(errno));
+}
+
+static void unwatch_fd(int fd)
+{
+	if (fd >= 0)
+		epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static void watch_array(struct active_array *a)
+{
+	struct mdinfo *mdi;
+
+	watch_fd(a->info.state_fd, a, WATCH_STATE);
+	watch_fd(a->action_fd, a, WATCH_ACTION);
+	watch_fd(a->sync_completed_fd, a, WATCH_SYNC);
+	for (mdi = a->info.devs ; mdi ; mdi = mdi->next)
+		watch_fd(mdi->state_fd, mdi, WATCH_MEMBER);
+	a->watched = 1;
+	/* nothing read for this one yet */
+	a->stale = STALE_ALL;
+}
+
+static void unwatch_array(struct active_array *a)
+{
+	struct mdinfo *mdi;
+
+	unwatch_fd(a->info.state_fd);
+	unwatch_fd(a->action_fd);
+	unwatch_fd(a->sync_completed_fd);
+	for (mdi = a->info.devs ; mdi ; mdi = mdi->next)
+		unwatch_fd(mdi->state_fd);
+	a->watched = 0;
+}
+
+/* A sysfs file that has been deleted always polls as changed, so
+ * stop watching it once that happens.
+ */
+static void unwatch_deleted(int fd)
 {
 	struct stat st;
+
 	if (fd < 0)
 		return;
 	if (fstat(fd, &st) == -1) {
 		dprintf("Invalid fd %d\n", fd);
-		return;
-	}
-	if (st.st_nlink == 0) {
+		unwatch_fd(fd);
+	} else if (st.st_nlink == 0) {
 		dprintf("fd %d was deleted\n", fd);
-		return;
+		unwatch_fd(fd);
 	}
-	if (fd > *maxfd)
-		*maxfd = fd;
-	FD_SET(fd, fds);
+}
+
+/* Note what an event says has changed, and return the array to act on */
+static struct active_array *event_fired(struct supertype *containers,
+					unsigned long data)
+{
+	struct supertype *c;
+	struct active_array *a;
+	struct mdinfo *mdi;
+	int tag = data & WATCH_MASK;
+
+	if (tag == WATCH_MEMBER) {
+		struct mdinfo *m = (struct mdinfo *)data;
+
+		for (c = containers; c; c = c->next_container)
+			for (a = c->arrays; a; a = a->next)
+				for (mdi = a->info.devs; mdi; mdi = mdi->next)
+					if (mdi == m)
+						goto found;
+		return NULL;
+	found:
+		mdi->stale = 1;
+		unwatch_deleted(mdi->state_fd);
+	} else {
+		a = (struct active_array *)(data & ~WATCH_MASK);
+		a->stale |= STALE(tag);
+		unwatch_deleted(tag == WATCH_STATE ? a->info.state_fd :
+				tag == WATCH_ACTION ? a->action_fd :
+				a->sync_completed_fd);
+	}
+	a->fired = 1;
+	return a;
 }
 
 static int read_attr(char *buf, int len, int fd)
@@ -165,6 +270,126 @@ static void signal_manager(void)
 	syscall(SYS_tgkill, pid, mgr_tid, SIGUSR1);
 }
 
+/* Latency statistics.  Only the monitor changes these, the manager
+ * reads them without locking to report them, which at worst gives a
+ * slightly inconsistent snapshot.
+ */
+struct mon_stats mon_stats;
+static unsigned long long mon_wake; /* when the monitor last woke */
+
+static void lat_add(struct lat_hist *h, unsigned long long usec)
+{
+	int b = 0;
+
+	while (b < LAT_BUCKETS - 1 && usec >= (1ULL << b))
+		b++;
+	h->count++;
+	h->total += usec;
+	if (usec > h->max)
+		h->max = usec;
+	h->bucket[b]++;
+}
+
+static unsigned long long usec_since(unsigned long long start)
+{
+	return (trace_now() - start) / 1000;
+}
+
+/* called by batch_write_submit() for each metadata write */
+static void mon_disk_write(struct batch_write *w, unsigned long long usec)
+{
+	struct stat stb;
+	int i;
+
+	mon_stats.disk_writes++;
+	if (fstat(w->fd, &stb) != 0)
+		return;
+	for (i = 0; i < mon_stats.ndisks; i++)
+		if (mon_stats.disk[i].devid == stb.st_rdev)
+			break;
+	if (i == mon_stats.ndisks) {
+		if (i == STATS_DISKS)
+			return;
+		mon_stats.disk[i].devid = stb.st_rdev;
+		mon_stats.ndisks++;
+	}
+	lat_add(&mon_stats.disk[i].hist, usec);
+}
+
+/* Updates are opaque here, but all metadata handlers start them with
+ * a word saying what sort of update it is.
+ */
+static struct lat_hist *update_hist(struct metadata_update *mu)
+{
+	int type, i;
+
+	if (mu->len < (int)sizeof(type) || !mu->buf)
+		return NULL;
+	memcpy(&type, mu->buf, sizeof(type));
+	for (i = 0; i < mon_stats.nupdates; i++)
+		if (mon_stats.update[i].type == type)
+			return &mon_stats.update[i].hist;
+	if (i == STATS_UPDATE_TYPES)
+		return NULL;
+	mon_stats.update[i].type = type;
+	mon_stats.nupdates++;
+	return &mon_stats.update[i].hist;
+}
+
+static void print_hist(FILE *f, char *name, struct lat_hist *h)
+{
+	int i;
+
+	fprintf(f, "%s: %lu", name, h->count);
+	if (h->count)
+		fprintf(f, ", mean %lluus, max %lluus",
+			h->total / h->count, h->max);
+	fprintf(f, "\n");
+	for (i = 0; i < LAT_BUCKETS - 1; i++)
+		if (h->bucket[i])
+			fprintf(f, "   < %10lluus %lu\n", 1ULL << i,
+				h->bucket[i]);
+	if (h->bucket[i])
+		fprintf(f, "  >= %10lluus %lu\n", 1ULL << (i - 1),
+			h->bucket[i]);
+}
+
+/* The statistics as text, for the manager to send to 'mdmon --stats' */
+char *mon_stats_report(void)
+{
+	char *buf = NULL;
+	size_t len = 0;
+	char name[80];
+	FILE *f;
+	int i;
+
+	f = open_memstream(&buf, &len);
+	if (!f)
+		return NULL;
+	fprintf(f, "monitor loops: %d, wakeups: %lu, metadata writes: %lu\n",
+		monitor_loop_cnt, mon_stats.wakeups, mon_stats.disk_writes);
+	print_hist(f, "write-pending to active", &mon_stats.write_pending);
+	print_hist(f, "metadata sync", &mon_stats.sync_metadata);
+	for (i = 0; i < mon_stats.nupdates; i++) {
+		snprintf(name, sizeof(name), "update type %#x",
+			 mon_stats.update[i].type);
+		print_hist(f, name, &mon_stats.update[i].hist);
+	}
+	for (i = 0; i < mon_stats.ndisks; i++) {
+		dev_t devid = mon_stats.disk[i].devid;
+		char *kname = devid2kname(devid);
+
+		if (kname)
+			snprintf(name, sizeof(name), "write to %s", kname);
+		else
+			snprintf(name, sizeof(name), "write to %d:%d",
+				 major(devid), minor(devid));
+		print_hist(f, name, &mon_stats.disk[i].hist);
+	}
+	fclose(f);
+	return buf;
+}
+
 /* Monitor a set of active md arrays - all of which share the
  * same metadata - and respond to events that require
  * metadata update.
@@ -214,7 +439,8 @@ static void signal_manager(void)
  * then decide what to do.
  *
  * The core action is to write new metadata to all devices in the array.
- * This is done at most once on any wakeup.
+ * This is done at most once on any wakeup, for all the arrays and
+ * metadata updates that need it together.
  * After that we might:
  *   - update the array_state
  *   - set the role of some devices.
@@ -224,6 +450,16 @@ static void signal_manager(void)
 
 #define ARRAY_DIRTY 1
 #define ARRAY_BUSY 2
+/* What read_and_act() leaves for apply_changes() */
+#define ARRAY_ACT 4
+#define ARRAY_DEACTIVATE 8
+#define ARRAY_CHECK_DEGRADED 16
+#define ARRAY_CHECK_RESHAPE 32
+
+/* Read the state of the array and record in the metadata what it
+ * means.  Nothing is written to the kernel until the metadata has
+ * been written, see apply_changes().
+ */
 static int read_and_act(struct active_array *a)
 {
 	unsigned long long sync_completed;
@@ -231,32 +467,47 @@ static int read_and_act(struct active_array *a)
 	int check_reshape = 0;
 	int deactivate = 0;
 	struct mdinfo *mdi;
-	int ret = 0;
+	int ret = ARRAY_ACT;
 	int count = 0;
 	struct timeval tv;
 
 	a->next_state = bad_word;
 	a->next_action = bad_action;
 
-	a->curr_state = read_state(a->info.state_fd);
-	a->curr_action = read_action(a->action_fd);
-	if (a->curr_state != clear)
+	/* Only read again what has fired, or been written, since we
+	 * last looked.  Sync progress shows up in sync_completed, so
+	 * that is when resync_start and recovery_start can move.
+	 */
+	if (a->stale & STALE(WATCH_STATE))
+		a->curr_state = read_state(a->info.state_fd);
+	if (a->stale & STALE(WATCH_ACTION))
+		a->curr_action = read_action(a->action_fd);
+	if (a->curr_state != clear &&
+	    (a->stale & (STALE(WATCH_STATE) | STALE(WATCH_ACTION) |
+			 STALE(WATCH_SYNC))))
 		/*
 		 * In "clear" state, resync_start may wrongly be set to "0"
 		 * when the kernel called md_clean but didn't remove the
 		 * sysfs attributes yet
 		 */
 		read_resync_start(a->resync_start_fd, &a->info.resync_start);
-	sync_completed = read_sync_completed(a->sync_completed_fd);
+	if (a->stale & (STALE(WATCH_ACTION) | STALE(WATCH_SYNC)))
+		a->sync_completed = read_sync_completed(a->sync_completed_fd);
+	sync_completed = a->sync_completed;
 	for (mdi = a->info.devs; mdi ; mdi = mdi->next) {
 		mdi->next_state = 0;
-		mdi->curr_state = 0;
-		if (mdi->state_fd >= 0) {
+		if (mdi->state_fd < 0) {
+			mdi->curr_state = 0;
+			continue;
+		}
+		if (a->stale & (STALE(WATCH_ACTION) | STALE(WATCH_SYNC)))
 			read_resync_start(mdi->recovery_fd,
 					  &mdi->recovery_start);
+		if (mdi->stale || a->stale == STALE_ALL)
 			mdi->curr_state = read_dev_state(mdi->state_fd);
-		}
+		mdi->stale = 0;
 	}
+	a->stale = 0;
 
 	gettimeofday(&tv, NULL);
 	dprintf("(%d): %ld.%06ld state:%s prev:%s action:%s prev: %s start:%llu\n",
@@ -420,7 +671,22 @@ static int read_and_act(struct active_array *a)
 	if (sync_completed > a->last_checkpoint)
 		a->last_checkpoint = sync_completed;
 
-	a->container->ss->sync_metadata(a->container);
+	if (deactivate)
+		ret |= ARRAY_DEACTIVATE;
+	if (check_degraded)
+		ret |= ARRAY_CHECK_DEGRADED;
+	if (check_reshape)
+		ret |= ARRAY_CHECK_RESHAPE;
+	return ret;
+}
+
+/* The metadata now records what read_and_act() decided, so tell
+ * the kernel.
+ */
+static int apply_changes(struct active_array *a, int ret)
+{
+	struct mdinfo *mdi;
+
 	dprintf("(%d): state:%s action:%s next(", a->info.container_member,
 		array_states[a->curr_state], sync_actions[a->curr_action]);
 
@@ -428,12 +694,18 @@ static int read_and_act(struct active_array *a)
 	if (a->next_state != bad_word) {
 		dprintf_cont(" state:%s", array_states[a->next_state]);
 		write_attr(array_states[a->next_state], a->info.state_fd);
+		a->stale |= STALE(WATCH_STATE);
+		if (a->curr_state == write_pending)
+			lat_add(&mon_stats.write_pending, usec_since(mon_wake));
 	}
 	if (a->next_action != bad_action) {
 		write_attr(sync_actions[a->next_action], a->action_fd);
+		a->stale |= STALE(WATCH_ACTION);
 		dprintf_cont(" action:%s", sync_actions[a->next_action]);
 	}
 	for (mdi = a->info.devs; mdi ; mdi = mdi->next) {
+		if (mdi->next_state)
+			mdi->stale = 1;
 		if (mdi->next_state & DS_UNBLOCK) {
 			dprintf_cont(" %d:-blocked", mdi->disk.raid_disk);
 			write_attr("-blocked", mdi->state_fd);
@@ -472,16 +744,16 @@ static int read_and_act(struct active_array *a)
 		mdi->next_state = 0;
 	}
 
-	if (check_degraded || check_reshape) {
+	if (ret & (ARRAY_CHECK_DEGRADED | ARRAY_CHECK_RESHAPE)) {
 		/* manager will do the actual check */
-		if (check_degraded)
+		if (ret & ARRAY_CHECK_DEGRADED)
 			a->check_degraded = 1;
-		if (check_reshape)
+		if (ret & ARRAY_CHECK_RESHAPE)
 			a->check_reshape = 1;
 		signal_manager();
 	}
 
-	if (deactivate)
+	if (ret & ARRAY_DEACTIVATE)
 		a->container = NULL;
 
 	return ret;
@@ -499,66 +771,42 @@ find_device(struct active_array *a, int major, int minor)
 	return NULL;
 }
 
+/* The kernel fails the device as "faulty" is written, so the arrays
+ * that lose it are marked to be looked at before the metadata is
+ * written, rather than costing a write each on the next wakeup.
+ */
 static void reconcile_failed(struct active_array *aa, struct mdinfo *failed)
 {
 	struct active_array *a;
 	struct mdinfo *victim;
 
 	for (a = aa; a; a = a->next) {
-		if (!a->container || a->to_remove)
+		if (!a->container || a->to_remove || (a->act & ARRAY_DEACTIVATE))
 			continue;
 		victim = find_device(a, failed->disk.major, failed->disk.minor);
 		if (!victim)
 			continue;
 
-		if (!(victim->curr_state & DS_FAULTY))
-			write_attr("faulty", victim->state_fd);
-	}
-}
-
-#ifdef DEBUG
-static void dprint_wake_reasons(fd_set *fds)
-{
-	int i;
-	char proc_path[256];
-	char link[256];
-	char *basename;
-	int rv;
-
-	fprintf(stderr, "monitor: wake ( ");
-	for (i = 0; i < FD_SETSIZE; i++) {
-		if (FD_ISSET(i, fds)) {
-			sprintf(proc_path, "/proc/%d/fd/%d",
-				(int) getpid(), i);
-
-			rv = readlink(proc_path, link, sizeof(link) - 1);
-			if (rv < 0) {
-				fprintf(stderr, "%d:unknown ", i);
-				continue;
-			}
-			link[rv] = '\0';
-			basename = strrchr(link, '/');
-			fprintf(stderr, "%d:%s ",
-				i, basename ? ++basename : link);
+		if (!(victim->curr_state & DS_FAULTY) &&
+		    write_attr("faulty", victim->state_fd) > 0) {
+			victim->stale = 1;
+			a->fired = 1;
 		}
 	}
-	fprintf(stderr, ")\n");
 }
-#endif
+
 
 int monitor_loop_cnt;
 
-static int wait_and_act(struct supertype *container, int nowait)
+#define MAX_EVENTS 16
+
+/* Take arrays the manager has finished with, or that have stopped, off
+ * the container's list, and start watching any new ones.
+ */
+static void prune_arrays(struct supertype *container)
 {
-	fd_set rfds;
-	int maxfd = 0;
 	struct active_array **aap = &container->arrays;
 	struct active_array *a, **ap;
-	int rv;
-	struct mdinfo *mdi;
-	static unsigned int dirty_arrays = ~0; /* start at some non-zero value */
-
-	FD_ZERO(&rfds);
 
 	for (ap = aap ; *ap ;) {
 		a = *ap;
@@ -566,6 +814,8 @@ static int wait_and_act(struct supertype *container, int nowait)
 		 * ask the manager to discard it.
 		 */
 		if (!a->container || a->to_remove) {
+			if (a->watched)
+				unwatch_array(a);
 			if (discard_this) {
 				ap = &(*ap)->next;
 				continue;
@@ -577,89 +827,65 @@ static int wait_and_act(struct supertype *container, int nowait)
 			continue;
 		}
 
-		add_fd(&rfds, &maxfd, a->info.state_fd);
-		add_fd(&rfds, &maxfd, a->action_fd);
-		add_fd(&rfds, &maxfd, a->sync_completed_fd);
-		for (mdi = a->info.devs ; mdi ; mdi = mdi->next)
-			add_fd(&rfds, &maxfd, mdi->state_fd);
+		if (!a->watched)
+			watch_array(a);
 
 		ap = &(*ap)->next;
 	}
+}
 
-	if (manager_ready && (*aap == NULL || (sigterm && !dirty_arrays))) {
-		/* No interesting arrays, or we have been told to
-		 * terminate and everything is clean.  Lets see about
-		 * exiting.  Note that blocking at this point is not a
-		 * problem as there are no active arrays, there is
-		 * nothing that we need to be ready to do.
-		 */
-		int fd;
-		if (sigterm)
-			fd = open_dev_excl(container->devnm);
-		else
-			fd = open_dev_flags(container->devnm, O_RDONLY|O_EXCL);
-		if (fd >= 0 || errno != EBUSY) {
-			/* OK, we are safe to leave */
-			if (sigterm && !dirty_arrays)
-				dprintf("caught sigterm, all clean... exiting\n");
-			else
-				dprintf("no arrays to monitor... exiting\n");
-			if (!sigterm)
-				/* On SIGTERM, someone (the take-over mdmon) will
-				 * clean up
-				 */
-				remove_pidfile(container->devnm);
-			exit_now = 1;
-			signal_manager();
-			close(fd);
-			exit(0);
-		}
-	}
-
-	if (!nowait) {
-		sigset_t set;
-		struct timespec ts;
-		ts.tv_sec = 24*3600;
-		ts.tv_nsec = 0;
-		if (*aap == NULL || container->retry_soon) {
-			/* just waiting to get O_EXCL access */
-			ts.tv_sec = 0;
-			ts.tv_nsec = 20000000ULL;
-		}
-		sigprocmask(SIG_UNBLOCK, NULL, &set);
-		sigdelset(&set, SIGUSR1);
-		monitor_loop_cnt |= 1;
-		rv = pselect(maxfd+1, NULL, NULL, &rfds, &ts, &set);
-		monitor_loop_cnt += 1;
-		if (rv == -1) {
-			if (errno == EINTR) {
-				rv = 0;
-				dprintf("monitor: caught signal\n");
-			} else
-				dprintf("monitor: error %d in pselect\n",
-					errno);
-		}
-		#ifdef DEBUG
-		else
-			dprint_wake_reasons(&rfds);
-		#endif
-		container->retry_soon = 0;
-	}
+/* Return 1 if we can let go of the container */
+static int container_done(struct supertype *container)
+{
+	/* No interesting arrays, or we have been told to
+	 * terminate and everything is clean.  Lets see about
+	 * exiting.  Note that blocking at this point is not a
+	 * problem as there are no active arrays, there is
+	 * nothing that we need to be ready to do.
+	 */
+	int fd;
 
-	if (update_queue) {
-		struct metadata_update *this;
+	if (!manager_ready ||
+	    (container->arrays && !(sigterm && !container->dirty_arrays)))
+		return 0;
+	if (sigterm)
+		fd = open_dev_excl(container->devnm);
+	else
+		fd = open_dev_flags(container->devnm, O_RDONLY|O_EXCL);
+	if (fd < 0 && errno == EBUSY)
+		return 0;
 
-		for (this = update_queue; this ; this = this->next)
-			container->ss->process_update(container, this);
+	/* OK, we are safe to leave */
+	if (sigterm && !container->dirty_arrays)
+		dprintf("%s: caught sigterm, all clean... exiting\n",
+			container->devnm);
+	else
+		dprintf("%s: no arrays to monitor... exiting\n",
+			container->devnm);
+	if (!sigterm)
+		/* On SIGTERM, someone (the take-over mdmon) will
+		 * clean up
+		 */
+		remove_pidfile(container->devnm);
+	if (fd >= 0)
+		close(fd);
+	return 1;
+}
 
-		update_queue_handled = update_queue;
-		update_queue = NULL;
-		signal_manager();
-		container->ss->sync_metadata(container);
-	}
+/* Look at the arrays in the container that need it, write the
+ * metadata and tell the kernel.
+ */
+static int act_on_container(struct supertype *container, int all)
+{
+	struct active_array **aap = &container->arrays;
+	struct active_array *a;
+	struct mdinfo *mdi;
+	int rv = 0;
 
-	rv = 0;
-	dirty_arrays = 0;
+	/* Group commit: see what every array needs, including those
+	 * that a failure spreads to, write the metadata once for all
+	 * of it and the updates, and only then tell the kernel.
+	 */
 	for (a = *aap; a ; a = a->next) {
 
 		if (a->replaces && !discard_this) {
@@ -674,39 +900,206 @@ static int wait_and_act(struct supertype *container, int nowait)
 			/* FIXME check if device->state_fd need to be cleared?*/
 			signal_manager();
 		}
-		if (a->container && !a->to_remove) {
-			int ret = read_and_act(a);
+		a->act = 0;
+		if (a->container && !a->to_remove && (all || a->fired)) {
+			if (all)
+				a->stale = STALE_ALL;
+			a->act = read_and_act(a);
+			a->fired = 0;
 			rv |= 1;
-			dirty_arrays += !!(ret & ARRAY_DIRTY);
-			/* when terminating stop manipulating the array after it
-			 * is clean, but make sure read_and_act() is given a
-			 * chance to handle 'active_idle'
-			 */
-			if (sigterm && !(ret & ARRAY_DIRTY))
-				a->container = NULL; /* stop touching this array */
-			if (ret & ARRAY_BUSY)
-				container->retry_soon = 1;
 		}
 	}
 
 	/* propagate failures across container members */
 	for (a = *aap; a ; a = a->next) {
-		if (!a->container || a->to_remove)
+		if (!a->container || a->to_remove || (a->act & ARRAY_DEACTIVATE))
 			continue;
 		for (mdi = a->info.devs ; mdi ; mdi = mdi->next)
 			if (mdi->curr_state & DS_FAULTY)
 				reconcile_failed(*aap, mdi);
 	}
+	for (a = *aap; a ; a = a->next)
+		if (a->fired && a->container && !a->to_remove) {
+			a->act |= read_and_act(a);
+			a->fired = 0;
+			rv |= 1;
+		}
+
+	if (rv || container->updated) {
+		unsigned long long start = trace_now();
+		unsigned long writes = mon_stats.disk_writes;
+
+		container->ss->sync_metadata(container);
+		if (mon_stats.disk_writes != writes)
+			lat_add(&mon_stats.sync_metadata, usec_since(start));
+		container->updated = 0;
+	}
+
+	if (all)
+		container->dirty_arrays = 0;
+	for (a = *aap; a ; a = a->next) {
+		int ret;
+
+		if (!a->act)
+			continue;
+		ret = apply_changes(a, a->act);
+		a->act = 0;
+		if (all)
+			container->dirty_arrays += !!(ret & ARRAY_DIRTY);
+		/* when terminating stop manipulating the array after it
+		 * is clean, but make sure read_and_act() is given a
+		 * chance to handle 'active_idle'
+		 */
+		if (sigterm && !(ret & ARRAY_DIRTY))
+			a->container = NULL; /* stop touching this array */
+		if (ret & ARRAY_BUSY)
+			container->retry_soon = 1;
+	}
 
 	return rv;
 }
 
-void do_monitor(struct supertype *container)
+/* One pass over all the containers this mdmon looks after */
+static int wait_and_act(struct supertype *containers, int nowait)
 {
+	struct epoll_event events[MAX_EVENTS];
+	struct supertype *container;
+	struct active_array *a;
+	int rv;
+	int all = 1; /* act on every array, not just those that fired */
+	int live = 0;
+	int retry = 0;
+	int updated = 0;
+	int i;
+	struct metadata_update *this;
+	struct lat_hist *hists[STATS_UPDATE_TYPES];
+	int nhists = 0;
+
+	for (container = containers; container;
+	     container = container->next_container) {
+		if (container->retired)
+			continue;
+		prune_arrays(container);
+		if (container_done(container)) {
+			container->retired = 1;
+			signal_manager();
+			continue;
+		}
+		live++;
+		if (container->arrays == NULL || container->retry_soon)
+			retry = 1;
+	}
+	if (!live) {
+		exit_now = 1;
+		signal_manager();
+		exit(0);
+	}
+
+	if (!nowait) {
+		sigset_t set;
+		int tmo = 24*3600*1000;
+		if (retry) {
+			/* just waiting to get O_EXCL access */
+			tmo = 20;
+		}
+		sigprocmask(SIG_UNBLOCK, NULL, &set);
+		sigdelset(&set, SIGUSR1);
+		monitor_loop_cnt |= 1;
+		rv = epoll_pwait(epfd, events, MAX_EVENTS, tmo, &set);
+		monitor_loop_cnt += 1;
+		if (rv == -1) {
+			if (errno == EINTR) {
+				rv = 0;
+				dprintf("monitor: caught signal\n");
+			} else
+				dprintf("monitor: error %d in epoll_pwait\n",
+					errno);
+		}
+		/* Only fds firing, with no word from the manager,
+		 * retry or shutdown pending, just needs those arrays
+		 * looked at.
+		 */
+		if (rv > 0 && !retry && !sigterm)
+			all = 0;
+		for (i = 0; i < rv; i++) {
+			if (events[i].data.u64 == WATCH_WAKE) {
+				eventfd_t cnt;
+
+				eventfd_read(monitor_wakefd, &cnt);
+				all = 1;
+				continue;
+			}
+			a = event_fired(containers, events[i].data.u64);
+			if (a)
+				dprintf("monitor: wake %s\n",
+					a->info.sys_name);
+		}
+		for (container = containers; container;
+		     container = container->next_container)
+			container->retry_soon = 0;
+		mon_stats.wakeups++;
+	}
+	mon_wake = trace_now();
+
+	while ((this = update_ring_get(&container)) != NULL) {
+		struct lat_hist *h = update_hist(this);
+
+		container->ss->process_update(container, this);
+		container->updated = 1;
+		for (i = 0; i < nhists; i++)
+			if (hists[i] == h)
+				break;
+		if (h && i == nhists)
+			hists[nhists++] = h;
+
+		/* hand it back to the manager to be freed */
+		this->next = __atomic_load_n(&update_queue_handled,
+					     __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&update_queue_handled,
+						    &this->next, this, 1,
+						    __ATOMIC_RELEASE,
+						    __ATOMIC_RELAXED))
+			;
+		__atomic_add_fetch(&updates_done, 1, __ATOMIC_RELEASE);
+		updated = 1;
+	}
+	if (updated) {
+		signal_manager();
+		all = 1;
+	}
+
+	rv = 0;
+	for (container = containers; container;
+	     container = container->next_container)
+		if (!container->retired)
+			rv |= act_on_container(container, all);
+	for (i = 0; i < nhists; i++)
+		lat_add(hists[i], usec_since(mon_wake));
+
+	return rv;
+}
+
+void do_monitor(struct supertype *containers)
+{
+	struct epoll_event ev;
 	int rv;
 	int first = 1;
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		pr_err("cannot create epoll set: %s\n", strerror(errno));
+		exit(1);
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = WATCH_WAKE;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, monitor_wakefd, &ev) < 0) {
+		pr_err("cannot watch for the manager: %s\n", strerror(errno));
+		exit(1);
+	}
+	batch_write_done = mon_disk_write;
 	do {
-		rv = wait_and_act(container, first);
+		rv = wait_and_act(containers, first);
 		first = 0;
 	} while (rv >= 0);
 }
@@ -92,19 +92,92 @@ int send_message(int fd, struct metadata_update *msg, int tmo)
 	return rv;
 }
 
+/* A batch is sent as one message of length MSG_UPDATES, followed by
+ * the number of updates and then the length and content of each.
+ * It is acknowledged once, for all of them.
+ */
+int send_batch(int fd, struct metadata_update *updates, int tmo)
+{
+	struct metadata_update *mu;
+	__s32 len = MSG_UPDATES;
+	__s32 cnt = 0;
+	int rv;
+
+	for (mu = updates; mu; mu = mu->next)
+		cnt++;
+	rv = send_buf(fd, &start_magic, 4, tmo);
+	rv = rv ?: send_buf(fd, &len, 4, tmo);
+	rv = rv ?: send_buf(fd, &cnt, 4, tmo);
+	for (mu = updates; mu && !rv; mu = mu->next) {
+		len = mu->len;
+		rv = send_buf(fd, &len, 4, tmo);
+		rv = rv ?: send_buf(fd, mu->buf, len, tmo);
+	}
+	rv = rv ?: send_buf(fd, &end_magic, 4, tmo);
+
+	return rv;
+}
+
+void free_batch(struct metadata_update **updates)
+{
+	while (*updates) {
+		struct metadata_update *mu = *updates;
+
+		*updates = mu->next;
+		free(mu->buf);
+		free(mu);
+	}
+}
+
+static int receive_batch(int fd, struct metadata_update **updates, int tmo)
+{
+	struct metadata_update **tail = updates;
+	__s32 cnt, len;
+	int total = 0;
+
+	*updates = NULL;
+	if (recv_buf(fd, &cnt, 4, tmo) < 0 || cnt < 0 || cnt > MSG_UPDATES_MAX)
+		return -1;
+	while (cnt--) {
+		struct metadata_update *mu;
+
+		if (recv_buf(fd, &len, 4, tmo) < 0 ||
+		    len <= 0 || len > MSG_MAX_LEN - total)
+			goto fail;
+		total += len;
+		mu = xcalloc(1, sizeof(*mu));
+		mu->len = len;
+		mu->buf = xmalloc(len);
+		*tail = mu;
+		tail = &mu->next;
+		if (recv_buf(fd, mu->buf, len, tmo) < 0)
+			goto fail;
+	}
+	return 0;
+fail:
+	free_batch(updates);
+	return -1;
+}
+
 int receive_message(int fd, struct metadata_update *msg, int tmo)
 {
 	__u32 magic;
 	__s32 len;
 	int rv;
 
+	msg->next = NULL;
 	rv = recv_buf(fd, &magic, 4, tmo);
 	if (rv < 0 || magic != start_magic)
 		return -1;
 	rv = recv_buf(fd, &len, 4, tmo);
 	if (rv < 0 || len > MSG_MAX_LEN)
 		return -1;
-	if (len > 0) {
+	if (len == MSG_UPDATES) {
+		/* the updates are on msg->next */
+		msg->buf = NULL;
+		if (receive_batch(fd, &msg->next, tmo) < 0)
+			return -1;
+	} else if (len > 0) {
 		msg->buf = xmalloc(len);
 		rv = recv_buf(fd, msg->buf, len, tmo);
 		if (rv < 0) {
@@ -116,6 +189,7 @@ int receive_message(int fd, struct metadata_update *msg, int tmo)
 	rv = recv_buf(fd, &magic, 4, tmo);
 	if (rv < 0 || magic != end_magic) {
 		free(msg->buf);
+		free_batch(&msg->next);
 		return -1;
 	}
 	msg->len = len;
@@ -215,28 +289,128 @@ int ping_monitor(char *devname)
 	return err;
 }
 
-static char *ping_monitor_version(char *devname)
+static char *fping_monitor_version(int sfd)
 {
-	int sfd = connect_monitor(devname);
 	struct metadata_update msg;
 	int err = 0;
 
-	if (sfd < 0)
-		return NULL;
-
 	if (ack(sfd, 20) != 0)
 		err = -1;
 
 	if (!err && receive_message(sfd, &msg, 20) != 0)
 		err = -1;
 
-	close(sfd);
-
 	if (err || !msg.len || !msg.buf)
 		return NULL;
 	return msg.buf;
 }
 
+static char *ping_monitor_version(char *devname)
+{
+	int sfd = connect_monitor(devname);
+	char *version;
+
+	if (sfd < 0)
+		return NULL;
+	version = fping_monitor_version(sfd);
+	close(sfd);
+	return version;
+}
+
+/* The version of the mdmon running for this container, or -1.  It is
+ * asked once, and remembered for as long as the same mdmon runs.  If
+ * 'sfd' is a connection to it, that is used to ask.
+ */
+int mdmon_version(char *container, int sfd)
+{
+	static char known_devnm[32];
+	static int known_pid, known_version;
+	int pid = mdmon_pid(container);
+	char *version;
+
+	if (pid <= 0)
+		return -1;
+	if (pid == known_pid && strcmp(container, known_devnm) == 0)
+		return known_version;
+
+	if (sfd >= 0)
+		version = fping_monitor_version(sfd);
+	else
+		version = ping_monitor_version(container);
+	if (!version)
+		return -1;
+	known_version = mdadm_version(version);
+	free(version);
+	known_pid = pid;
+	snprintf(known_devnm, sizeof(known_devnm), "%s", container);
+	return known_version;
+}
+
+/* Ask mdmon on 'sfd' what it understands, as a list of words.  An
+ * mdmon that doesn't know about MSG_FEATURES takes it for a metadata
+ * update, which it rejects as too short, and answers with an empty ack,
+ * so an empty string means no features.  NULL means no answer at all.
+ */
+static char *fping_monitor_features(int sfd)
+{
+	struct metadata_update msg = { .len = MSG_FEATURES };
+
+	if (send_message(sfd, &msg, 20) != 0 ||
+	    receive_message(sfd, &msg, 20) != 0)
+		return NULL;
+	if (msg.len > 0 && msg.buf[msg.len - 1] == '\0')
+		return msg.buf;
+	if (msg.len > 0)
+		free(msg.buf);
+	return xstrdup("");
+}
+
+static int has_feature(char *features, char *feature)
+{
+	int l = strlen(feature);
+	char *w;
+
+	for (w = features; *w; w += strcspn(w, " ")) {
+		w += strspn(w, " ");
+		if (strncmp(w, feature, l) == 0 && (w[l] == ' ' || !w[l]))
+			return 1;
+	}
+	return 0;
+}
+
+/* Whether the mdmon running for this container understands 'feature',
+ * one of the words in MDMON_FEATURES.  It is asked once, and the answer
+ * remembered for as long as the same mdmon runs.  If 'sfd' is a
+ * connection to it, that is used to ask.
+ */
+int mdmon_feature(char *container, int sfd, char *feature)
+{
+	static char known_devnm[32];
+	static char *known_features;
+	static int known_pid;
+	int pid = mdmon_pid(container);
+	char *features;
+
+	if (pid <= 0)
+		return 0;
+	if (pid != known_pid || strcmp(container, known_devnm) != 0) {
+		int fd = sfd >= 0 ? sfd : connect_monitor(container);
+
+		if (fd < 0)
+			return 0;
+		features = fping_monitor_features(fd);
+		if (fd != sfd)
+			close(fd);
+		if (!features)
+			return 0;
+		free(known_features);
+		known_features = features;
+		known_pid = pid;
+		snprintf(known_devnm, sizeof(known_devnm), "%s", container);
+	}
+	return has_feature(known_features, feature);
+}
+
 int unblock_subarray(struct mdinfo *sra, const int unfreeze)
 {
 	char buf[64];
@@ -275,8 +449,6 @@ int block_subarray(struct mdinfo *sra)
  */
 int check_mdmon_version(char *container)
 {
-	char *version = NULL;
-
 	if (!mdmon_running(container)) {
 		/* if mdmon is not active we assume that any instance that is
 		 * later started will match the current mdadm version, if this
@@ -286,11 +458,8 @@ int check_mdmon_version(char *container)
 		 */
 		/* pass */;
 	} else {
-		int ver;
+		int ver = mdmon_version(container, -1);
 
-		version = ping_monitor_version(container);
-		ver = version ? mdadm_version(version) : -1;
-		free(version);
 		if (ver < 3002000) {
 			pr_err("mdmon instance for %s cannot be disabled\n",
 			       container);
@@ -470,6 +639,282 @@ int ping_manager(char *devname)
   */
 void flush_mdmon(char *container)
 {
-	ping_manager(container);
-	ping_monitor(container);
+	int sfd = connect_monitor(container);
+	struct metadata_update msg = { .len = -1 };
+
+	if (sfd < 0)
+		return;
+	/* both on the one connection */
+	if (send_message(sfd, &msg, 20) == 0 && wait_reply(sfd, 20) == 0)
+		fping_monitor(sfd);
+	close(sfd);
+}
+
+/* fetch the latency statistics of the mdmon for this container as
+ * text, or NULL if it isn't running or is too old to know about them
+ */
+char *mdmon_stats(char *container)
+{
+	struct metadata_update msg = { .len = MSG_STATS };
+	int sfd;
+
+	sfd = connect_monitor(container);
+	if (sfd < 0)
+		return NULL;
+	/* An mdmon that doesn't know MSG_STATS takes it for a metadata
+	 * update, rejects it as too short and answers with an empty ack,
+	 * as does one with nothing to report.  Only text is a report.
+	 */
+	if (send_message(sfd, &msg, 20) != 0 ||
+	    receive_message(sfd, &msg, 20) != 0)
+		msg.len = 0;
+	close(sfd);
+	if (msg.len <= 0)
+		return NULL;
+	if (msg.buf[msg.len - 1] != '\0') {
+		free(msg.buf);
+		return NULL;
+	}
+	return msg.buf;
+}
+
+#ifdef MAIN
+/* Exercise the framing of messages to mdmon without a running mdmon:
+ * "make test_msg", run from tests/21mdmon-protocol.
+ */
+#include <sys/wait.h>
+
+char const Name[] = "test_msg";
+
+static int failed;
+
+#define check(cond, what) do {						\
+	if (!(cond)) {							\
+		fprintf(stderr, "test_msg: FAILED: %s\n", what);	\
+		failed = 1;						\
+	}								\
+} while (0)
+
+static struct metadata_update *make_updates(int cnt, int len)
+{
+	struct metadata_update *updates = NULL, **tail = &updates;
+	int i;
+
+	for (i = 0; i < cnt; i++) {
+		struct metadata_update *mu = xcalloc(1, sizeof(*mu));
+
+		mu->len = len + i;
+		mu->buf = xmalloc(mu->len);
+		memset(mu->buf, i, mu->len);
+		*tail = mu;
+		tail = &mu->next;
+	}
+	return updates;
+}
+
+/* run 'fn' on one end of a socket pair in a child, return the other */
+static int spawn(void (*fn)(int fd, void *arg), void *arg, pid_t *pid)
+{
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		perror("socketpair");
+		exit(2);
+	}
+	*pid = fork();
+	if (*pid == 0) {
+		close(sv[0]);
+		fn(sv[1], arg);
+		_exit(0);
+	}
+	close(sv[1]);
+	return sv[0];
+}
+
+static void finish(int fd, pid_t pid)
+{
+	close(fd);
+	waitpid(pid, NULL, 0);
+}
+
+static void send_updates(int fd, void *arg)
+{
+	send_batch(fd, arg, 0);
+}
+
+struct raw_batch {
+	__s32 cnt, len;
+};
+
+static void send_raw(int fd, void *arg)
+{
+	/* a batch which is complete, but may break the limits */
+	struct raw_batch *rb = arg;
+	__s32 len = MSG_UPDATES;
+	char *buf = xcalloc(1, rb->len > 0 ? rb->len : 1);
+	int i;
+
+	if (send_buf(fd, &start_magic, 4, 0) || send_buf(fd, &len, 4, 0) ||
+	    send_buf(fd, &rb->cnt, 4, 0))
+		goto out;
+	for (i = 0; i < rb->cnt; i++)
+		if (send_buf(fd, &rb->len, 4, 0) ||
+		    (rb->len > 0 && send_buf(fd, buf, rb->len, 0)))
+			goto out;
+	send_buf(fd, &end_magic, 4, 0);
+out:
+	free(buf);
+}
+
+/* How mdmon before MSG_FEATURES and MSG_UPDATES handled a connection:
+ * anything it can parse gets an ack (pings get the version), anything
+ * else and it hangs up.
+ */
+static void old_mdmon(int fd, void *arg)
+{
+	while (1) {
+		struct metadata_update msg = { .len = 0 };
+		__u32 magic;
+		__s32 len;
+		char *buf = NULL;
+
+		if (recv_buf(fd, &magic, 4, 3) < 0 || magic != start_magic ||
+		    recv_buf(fd, &len, 4, 3) < 0 || len > MSG_MAX_LEN)
+			break;
+		if (len > 0) {
+			buf = xmalloc(len);
+			if (recv_buf(fd, buf, len, 3) < 0)
+				break;
+		}
+		free(buf);
+		if (recv_buf(fd, &magic, 4, 3) < 0 || magic != end_magic)
+			break;
+		if (len == 0) {
+			msg.buf = "3.3.4";
+			msg.len = 6;
+		}
+		if (send_message(fd, &msg, 3) < 0)
+			break;
+	}
+}
+
+/* The answers given by mdmon's read_sock() now */
+static void new_mdmon(int fd, void *arg)
+{
+	struct metadata_update msg;
+
+	while (receive_message(fd, &msg, 3) == 0) {
+		if (msg.len > 0)
+			free(msg.buf);
+		free_batch(&msg.next);
+		if (msg.len == MSG_FEATURES) {
+			msg.buf = MDMON_FEATURES;
+			msg.len = strlen(MDMON_FEATURES) + 1;
+			if (send_message(fd, &msg, 3) < 0)
+				break;
+		} else if (ack(fd, 3) < 0)
+			break;
+	}
+}
+
+static void test_batch(int cnt, int len)
+{
+	struct metadata_update *sent = make_updates(cnt, len);
+	struct metadata_update msg, *mu, *mu2;
+	char what[80];
+	pid_t pid;
+	int fd = spawn(send_updates, sent, &pid);
+	int n = 0;
+
+	snprintf(what, sizeof(what), "batch of %d updates", cnt);
+	check(receive_message(fd, &msg, 3) == 0, what);
+	check(msg.len == MSG_UPDATES, what);
+	for (mu = msg.next, mu2 = sent; mu && mu2;
+	     mu = mu->next, mu2 = mu2->next, n++)
+		check(mu->len == mu2->len &&
+		      memcmp(mu->buf, mu2->buf, mu->len) == 0, what);
+	check(n == cnt && !mu && !mu2, what);
+	free_batch(&msg.next);
+	free_batch(&sent);
+	finish(fd, pid);
+}
+
+static void test_raw(struct raw_batch *rb, int rv, char *what)
+{
+	struct metadata_update msg;
+	pid_t pid;
+	int fd = spawn(send_raw, rb, &pid);
+	int err = receive_message(fd, &msg, 3);
+
+	check(err == rv, what);
+	if (err == 0)
+		free_batch(&msg.next);
+	finish(fd, pid);
+}
+
+int main(int argc, char *argv[])
+{
+	struct metadata_update *updates, stats;
+	struct raw_batch most = { MSG_UPDATES_MAX, 4 };
+	struct raw_batch too_many = { MSG_UPDATES_MAX + 1, 4 };
+	struct raw_batch negative = { -1, 4 };
+	struct raw_batch empty = { 1, 0 };
+	struct raw_batch longest = { 1, MSG_MAX_LEN };
+	struct raw_batch too_long = { 2, MSG_MAX_LEN / 2 + 1 };
+	char *features;
+	pid_t pid;
+	int fd;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	test_batch(1, 4);
+	test_batch(3, 100);
+	test_batch(MSG_UPDATES_MAX, 4);
+	test_raw(&most, 0, "MSG_UPDATES_MAX updates");
+	test_raw(&too_many, -1, "more than MSG_UPDATES_MAX updates");
+	test_raw(&negative, -1, "negative update count");
+	test_raw(&empty, -1, "zero length update");
+	test_raw(&longest, 0, "batch of MSG_MAX_LEN");
+	test_raw(&too_long, -1, "batch longer than MSG_MAX_LEN");
+
+	check(has_feature("updates", "updates"), "single feature");
+	check(has_feature("stats  updates", "updates"), "later feature");
+	check(!has_feature("updatesx", "updates"), "feature prefix");
+	check(!has_feature("", "updates"), "no features");
+
+	/* the current mdmon offers batches, and takes them */
+	fd = spawn(new_mdmon, NULL, &pid);
+	features = fping_monitor_features(fd);
+	check(features && has_feature(features, "updates"),
+	      "mdmon lists updates");
+	free(features);
+	updates = make_updates(3, 8);
+	check(send_batch(fd, updates, 3) == 0 && wait_reply(fd, 3) == 0,
+	      "mdmon acks a batch");
+	free_batch(&updates);
+	finish(fd, pid);
+
+	/* an old mdmon acks the question, lists nothing, and carries on */
+	fd = spawn(old_mdmon, NULL, &pid);
+	features = fping_monitor_features(fd);
+	check(features && !has_feature(features, "updates"),
+	      "old mdmon lists no features");
+	free(features);
+	stats.len = MSG_STATS;
+	check(send_message(fd, &stats, 3) == 0 &&
+	      receive_message(fd, &stats, 3) == 0 && stats.len == 0,
+	      "old mdmon answers MSG_STATS with an empty ack");
+	updates = make_updates(1, 8);
+	check(send_message(fd, updates, 3) == 0 && wait_reply(fd, 3) == 0,
+	      "old mdmon acks a single update after the question");
+	/* and were a batch sent anyway, the failure must be seen */
+	check(send_batch(fd, updates, 3) != 0 || wait_reply(fd, 3) != 0,
+	      "old mdmon rejects a batch");
+	free_batch(&updates);
+	finish(fd, pid);
+
+	if (!failed)
+		printf("test_msg: all tests passed\n");
+	return failed;
 }
+#endif /* MAIN */
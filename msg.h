@@ -22,6 +22,8 @@ struct metadata_update;
 
 extern int receive_message(int fd, struct metadata_update *msg, int tmo);
 extern int send_message(int fd, struct metadata_update *msg, int tmo);
+extern int send_batch(int fd, struct metadata_update *updates, int tmo);
+extern void free_batch(struct metadata_update **updates);
 extern int ack(int fd, int tmo);
 extern int wait_reply(int fd, int tmo);
 extern int connect_monitor(char *devname);
@@ -33,5 +35,26 @@ extern void unblock_monitor(char *container, const int unfreeze);
 extern int fping_monitor(int sock);
 extern int ping_manager(char *devname);
 extern void flush_mdmon(char *container);
+extern char *mdmon_stats(char *container);
+extern int mdmon_version(char *container, int sfd);
+extern int mdmon_feature(char *container, int sfd, char *feature);
 
 #define MSG_MAX_LEN (4*1024*1024)
+
+/* A message of this length asks mdmon for its latency statistics,
+ * like 0 is ping_monitor and -1 is ping_manager.
+ */
+#define MSG_STATS (-2)
+
+/* A message of this length carries up to MSG_UPDATES_MAX metadata
+ * updates, see send_batch().  Only sent to an mdmon which lists
+ * "updates" in its answer to MSG_FEATURES.
+ */
+#define MSG_UPDATES (-3)
+#define MSG_UPDATES_MAX 256
+
+/* A message of this length asks mdmon which of the above it
+ * understands, see mdmon_feature().
+ */
+#define MSG_FEATURES (-4)
+#define MDMON_FEATURES "updates"
@@ -189,36 +189,113 @@ struct dev_policy *pol_find(struct dev_policy *pol, char *name)
 	return pol;
 }
 
-static char *disk_path(struct mdinfo *disk)
+/*
+ * Reverse map of /dev/disk/by-path, from device number to link name.
+ * It is built with one pass over the directory and only rebuilt when
+ * the directory changes, rather than searched for every disk.
+ */
+#define BY_PATH_HASH 256
+static struct by_path_ent {
+	struct by_path_ent *next;
+	dev_t devid;
+	char *name;
+} *by_path_hash[BY_PATH_HASH];
+static struct timespec by_path_mtime;
+static int by_path_loaded;
+
+static void by_path_free(void)
+{
+	int i;
+
+	for (i = 0; i < BY_PATH_HASH; i++)
+		while (by_path_hash[i]) {
+			struct by_path_ent *e = by_path_hash[i];
+
+			by_path_hash[i] = e->next;
+			free(e->name);
+			free(e);
+		}
+	by_path_loaded = 0;
+}
+
+static struct by_path_ent **by_path_bucket(dev_t devid)
+{
+	return &by_path_hash[(major(devid) * 37 + minor(devid)) % BY_PATH_HASH];
+}
+
+static void by_path_load(void)
 {
 	struct stat stb;
 	int prefix_len;
 	DIR *by_path;
 	char symlink[PATH_MAX] = "/dev/disk/by-path/";
-	char nm[PATH_MAX];
 	struct dirent *ent;
-	int rv;
 
+	by_path_free();
 	by_path = opendir(symlink);
-	if (by_path) {
-		prefix_len = strlen(symlink);
-		while ((ent = readdir(by_path)) != NULL) {
-			if (ent->d_type != DT_LNK)
-				continue;
-			strncpy(symlink + prefix_len,
-					ent->d_name,
-					sizeof(symlink) - prefix_len);
-			if (stat(symlink, &stb) < 0)
-				continue;
-			if ((stb.st_mode & S_IFMT) != S_IFBLK)
-				continue;
-			if (stb.st_rdev != makedev(disk->disk.major, disk->disk.minor))
-				continue;
-			closedir(by_path);
-			return xstrdup(ent->d_name);
-		}
-		closedir(by_path);
+	if (!by_path)
+		return;
+	prefix_len = strlen(symlink);
+	while ((ent = readdir(by_path)) != NULL) {
+		struct by_path_ent **b, *e;
+
+		if (ent->d_type != DT_LNK)
+			continue;
+		strncpy(symlink + prefix_len,
+				ent->d_name,
+				sizeof(symlink) - prefix_len);
+		if (stat(symlink, &stb) < 0)
+			continue;
+		if ((stb.st_mode & S_IFMT) != S_IFBLK)
+			continue;
+		/* The first link found is the one to report */
+		b = by_path_bucket(stb.st_rdev);
+		for (e = *b; e; e = e->next)
+			if (e->devid == stb.st_rdev)
+				break;
+		if (e)
+			continue;
+		e = xmalloc(sizeof(*e));
+		e->devid = stb.st_rdev;
+		e->name = xstrdup(ent->d_name);
+		e->next = *b;
+		*b = e;
 	}
+	closedir(by_path);
+	by_path_loaded = 1;
+}
+
+static char *by_path_lookup(dev_t devid)
+{
+	struct stat stb;
+	struct by_path_ent *e;
+
+	if (stat("/dev/disk/by-path", &stb) != 0) {
+		by_path_free();
+		return NULL;
+	}
+	if (!by_path_loaded ||
+	    stb.st_mtim.tv_sec != by_path_mtime.tv_sec ||
+	    stb.st_mtim.tv_nsec != by_path_mtime.tv_nsec) {
+		by_path_load();
+		by_path_mtime = stb.st_mtim;
+	}
+	for (e = *by_path_bucket(devid); e; e = e->next)
+		if (e->devid == devid)
+			return e->name;
+	return NULL;
+}
+
+static char *disk_path(struct mdinfo *disk)
+{
+	char symlink[PATH_MAX];
+	char nm[PATH_MAX];
+	char *name;
+	int rv;
+
+	name = by_path_lookup(makedev(disk->disk.major, disk->disk.minor));
+	if (name)
+		return xstrdup(name);
 	/* A NULL path isn't really acceptable - use the devname.. */
 	sprintf(symlink, "/sys/dev/block/%d:%d", disk->disk.major, disk->disk.minor);
 	rv = readlink(symlink, nm, sizeof(nm)-1);
@@ -246,6 +323,35 @@ static char *disk_type(struct mdinfo *disk)
 		return type_disk;
 }
 
+static void rule_compile(struct rule *r)
+{
+	/* Most path patterns are a literal name, or a literal prefix
+	 * followed by '*', which don't need fnmatch().
+	 */
+	char *wild = strpbrk(r->value, "*?[\\");
+
+	if (!wild)
+		r->match = rule_exact;
+	else if (wild[0] == '*' && wild[1] == 0)
+		r->match = rule_prefix;
+	else
+		r->match = rule_glob;
+	r->prefix_len = wild ? wild - r->value : (int)strlen(r->value);
+}
+
+static int rule_path_match(struct rule *r, char *path)
+{
+	switch (r->match) {
+	case rule_exact:
+		return strcmp(r->value, path) == 0;
+	case rule_prefix:
+		return strncmp(r->value, path, r->prefix_len) == 0;
+	default:
+		return strncmp(r->value, path, r->prefix_len) == 0 &&
+			fnmatch(r->value, path, 0) == 0;
+	}
+}
+
 static int pol_match(struct rule *rule, char *path, char *type)
 {
 	/* check if this rule matches on path and type */
@@ -256,7 +362,7 @@ static int pol_match(struct rule *rule, char *path, char *type)
 		if (rule->name == rule_path) {
 			if (pathok == 0)
 				pathok = -1;
-			if (path && fnmatch(rule->value, path, 0) == 0)
+			if (path && rule_path_match(rule, path))
 				pathok = 1;
 		}
 		if (rule->name == rule_type) {
@@ -346,6 +452,59 @@ static struct pol_rule *config_rules = NULL;
 static struct pol_rule **config_rules_end = NULL;
 static int config_rules_has_path = 0;
 
+/*
+ * The same disk is usually asked about several times, so the result
+ * for each path and type is remembered until the rules change.
+ */
+#define POL_MEMO_HASH 64
+static struct pol_memo {
+	struct pol_memo *next;
+	char *path;
+	char *type;
+	struct dev_policy *pol;
+} *pol_memo[POL_MEMO_HASH];
+
+static struct dev_policy *pol_dup(struct dev_policy *pol)
+{
+	struct dev_policy *rv = NULL, **pp = &rv;
+
+	for (; pol; pol = pol->next) {
+		*pp = xmalloc(sizeof(**pp));
+		**pp = *pol;
+		pp = &(*pp)->next;
+	}
+	*pp = NULL;
+	return rv;
+}
+
+static struct pol_memo **pol_memo_bucket(char *path, char *type)
+{
+	unsigned int h = 5381;
+	char *c;
+
+	for (c = path ?: ""; *c; c++)
+		h = h * 33 + (unsigned char)*c;
+	for (c = type; *c; c++)
+		h = h * 33 + (unsigned char)*c;
+	return &pol_memo[h % POL_MEMO_HASH];
+}
+
+static void pol_memo_free(void)
+{
+	int i;
+
+	for (i = 0; i < POL_MEMO_HASH; i++)
+		while (pol_memo[i]) {
+			struct pol_memo *m = pol_memo[i];
+
+			pol_memo[i] = m->next;
+			free(m->path);
+			free(m->type);
+			dev_policy_free(m->pol);
+			free(m);
+		}
+}
+
 /*
  * most policy comes from a set policy rules that are
  * read from the config file.
@@ -356,8 +515,16 @@ struct dev_policy *path_policy(char *path, char *type)
 {
 	struct pol_rule *rules;
 	struct dev_policy *pol = NULL;
+	struct pol_memo **b, *m;
 	int i;
 
+	b = pol_memo_bucket(path, type);
+	for (m = *b; m; m = m->next)
+		if (strcmp(m->type, type) == 0 &&
+		    (m->path == path ||
+		     (m->path && path && strcmp(m->path, path) == 0)))
+			return pol_dup(m->pol);
+
 	rules = config_rules;
 
 	while (rules) {
@@ -388,6 +555,13 @@ struct dev_policy *path_policy(char *path, char *type)
 
 	pol_sort(&pol);
 	pol_dedup(pol);
+
+	m = xmalloc(sizeof(*m));
+	m->path = path ? xstrdup(path) : NULL;
+	m->type = xstrdup(type);
+	m->pol = pol_dup(pol);
+	m->next = *b;
+	*b = m;
 	return pol;
 }
 
@@ -454,6 +628,7 @@ static int try_rule(char *w, char *name, struct rule **rp)
 	r->name = name;
 	r->value = xstrdup(w+len+1);
 	r->dups = NULL;
+	rule_compile(r);
 	*rp = r;
 	return 1;
 }
@@ -482,6 +657,7 @@ void policyline(char *line, char *type)
 	}
 	pr->next = config_rules;
 	config_rules = pr;
+	pol_memo_free();
 }
 
 void policy_add(char *type, ...)
@@ -504,11 +680,13 @@ void policy_add(char *type, ...)
 		r->name = name;
 		r->value = xstrdup(val);
 		r->dups = NULL;
+		rule_compile(r);
 		pr->rule = r;
 	}
 	pr->next = config_rules;
 	config_rules = pr;
 	va_end(ap);
+	pol_memo_free();
 }
 
 void policy_free(void)
@@ -531,6 +709,7 @@ void policy_free(void)
 	}
 	config_rules_end = NULL;
 	config_rules_has_path = 0;
+	pol_memo_free();
 }
 
 void dev_policy_free(struct dev_policy *p)
@@ -909,3 +1088,71 @@ abort:
 	}
 	return 1;
 }
+
+#ifdef MAIN
+/* Check that compiled path rules match exactly what fnmatch() on the
+ * pattern did before: "make test_policy", run from tests/22policy-rules.
+ */
+char const Name[] = "test_policy";
+
+int main(int argc, char *argv[])
+{
+	static char *patterns[] = {
+		"pci-0000:00:1f.2-ata-1",
+		"pci-0000:00:1f.2-ata-1.0",
+		"pci-0000:00:1f.2-ata-*",
+		"pci-0000:00:1f.2-*",
+		"pci-*-ata-1",
+		"pci-*",
+		"*",
+		"*-part1",
+		"pci-0000:00:1f.2-ata-?",
+		"pci-0000:00:1f.2-ata-[12]",
+		"pci-0000:00:1f.2-ata-[!12]",
+		"pci-0000:00:1f.2-ata-1*part*",
+		"pci-0000:00:1f.2-ata-\\*",
+		"usb-*:1.0-scsi-0:0:0:0",
+		"",
+		NULL
+	};
+	static char *paths[] = {
+		"pci-0000:00:1f.2-ata-1",
+		"pci-0000:00:1f.2-ata-1.0",
+		"pci-0000:00:1f.2-ata-2",
+		"pci-0000:00:1f.2-ata-3",
+		"pci-0000:00:1f.2-ata-10",
+		"pci-0000:00:1f.2-ata-1-part1",
+		"pci-0000:00:1f.2-ata-",
+		"pci-0000:00:1f.2-ata-*",
+		"pci-0000:00:1f.3-ata-1",
+		"pci-0000:00:1f.2-sas-0x5000c50012345678-lun-0",
+		"usb-0000:00:14.0-usb-0:2:1.0-scsi-0:0:0:0",
+		"platform-ahci-ata-1",
+		"a/b",
+		"",
+		NULL
+	};
+	int failed = 0;
+	int p, q;
+
+	for (p = 0; patterns[p]; p++) {
+		struct rule r = { .value = patterns[p] };
+
+		rule_compile(&r);
+		for (q = 0; paths[q]; q++) {
+			int want = fnmatch(patterns[p], paths[q], 0) == 0;
+
+			if (rule_path_match(&r, paths[q]) != want) {
+				fprintf(stderr, "test_policy: FAILED: \"%s\" %s \"%s\"\n",
+					patterns[p],
+					want ? "should match" : "should not match",
+					paths[q]);
+				failed = 1;
+			}
+		}
+	}
+	if (!failed)
+		printf("test_policy: all tests passed\n");
+	return failed;
+}
+#endif /* MAIN */
@@ -450,6 +450,7 @@ struct ddf_super {
 	struct phys_disk	*phys;
 	struct virtual_disk	*virt;
 	char			*conf;
+	struct write_batch	wb;
 	int			pdsize, vdsize;
 	unsigned int		max_part, mppe, conf_rec_len;
 	int			currentdev;
@@ -488,6 +489,9 @@ struct ddf_super {
 				int pdnum;	/* index in ->phys */
 				struct spare_assign *spare;
 				void *mdupdate; /* hold metadata update */
+				char *wbuf; /* headers and config records
+					     * being written */
+				int wstate; /* DDF_W_* while writing */
 
 				/* These fields used by auto-layout */
 				int raiddisk; /* slot to fill in autolayout */
@@ -821,7 +825,7 @@ static int load_ddf_header(int fd, unsigned long long lba,
 	if (lseek64(fd, lba<<9, 0) < 0)
 		return 0;
 
-	if (read(fd, hdr, 512) != 512)
+	if (probe_read(fd, hdr, 512) != 512)
 		return 0;
 
 	if (!be32_eq(hdr->magic, DDF_HEADER_MAGIC)) {
@@ -877,7 +881,7 @@ static void *load_section(int fd, struct ddf_super *super, void *buf,
 			free(buf);
 		return NULL;
 	}
-	if ((unsigned long long)read(fd, buf, len<<9) != (len<<9)) {
+	if ((unsigned long long)probe_read(fd, buf, len<<9) != (len<<9)) {
 		if (dofree)
 			free(buf);
 		return NULL;
@@ -897,7 +901,7 @@ static int load_ddf_headers(int fd, struct ddf_super *super, char *devname)
 			       devname, strerror(errno));
 		return 1;
 	}
-	if (read(fd, &super->anchor, 512) != 512) {
+	if (probe_read(fd, &super->anchor, 512) != 512) {
 		if (devname)
 			pr_err("Cannot read anchor block on %s: %s\n",
 			       devname, strerror(errno));
@@ -1080,6 +1084,7 @@ static int load_ddf_local(int fd, struct ddf_super *super,
 	dl->secondary_lba = super->active->secondary_lba;
 	dl->workspace_lba = super->active->workspace_lba;
 	dl->spare = NULL;
+	dl->wbuf = NULL;
 	for (i = 0 ; i < super->max_part ; i++)
 		dl->vlist[i] = NULL;
 	super->dlist = dl;
@@ -1253,6 +1258,7 @@ static void free_super_ddf(struct supertype *st)
 	free(ddf->phys);
 	free(ddf->virt);
 	free(ddf->conf);
+	batch_write_free(&ddf->wb);
 	while (ddf->conflist) {
 		struct vcl *v = ddf->conflist;
 		ddf->conflist = v->next;
@@ -1273,6 +1279,7 @@ static void free_super_ddf(struct supertype *st)
 			close(d->fd);
 		if (d->spare)
 			free(d->spare);
+		free(d->wbuf);
 		free(d);
 	}
 	while (ddf->add_list) {
@@ -1282,6 +1289,7 @@ static void free_super_ddf(struct supertype *st)
 			close(d->fd);
 		if (d->spare)
 			free(d->spare);
+		free(d->wbuf);
 		free(d);
 	}
 	free(ddf);
@@ -2895,6 +2903,7 @@ static int add_to_super_ddf(struct supertype *st,
 	dd->devname = devname;
 	dd->fd = fd;
 	dd->spare = NULL;
+	dd->wbuf = NULL;
 
 	dd->disk.magic = DDF_PHYS_DATA_MAGIC;
 	now = time(0);
@@ -3023,64 +3032,88 @@ static int remove_from_super_ddf(struct supertype *st, mdu_disk_info_t *dk)
  * container.
  */
 
-static int __write_ddf_structure(struct dl *d, struct ddf_super *ddf, __u8 type)
+/* Each disk gets its own copy of the anchor, the primary and secondary
+ * headers and the config records in ->wbuf, as they differ between
+ * disks and all disks are written at once.  The headers are at
+ * 512 * type, the config records follow them.
+ */
+#define DDF_WBUF_CONF	(3 * 512)
+
+/* ->wstate while writing */
+#define DDF_W_OK	1	/* nothing has failed yet */
+#define DDF_W_OPEN	2	/* the header has been written marked open */
+
+static struct ddf_header *ddf_wbuf_header(struct dl *d, __u8 type)
 {
-	unsigned long long sector;
-	struct ddf_header *header;
-	int fd, i, n_config, conf_size, buf_size;
-	int ret = 0;
-	char *conf;
+	return (struct ddf_header *)(d->wbuf + 512 * type);
+}
 
-	fd = d->fd;
+static unsigned long long ddf_header_sector(struct dl *d, __u8 type)
+{
+	struct ddf_header *header = ddf_wbuf_header(d, type);
 
-	switch (type) {
-	case DDF_HEADER_PRIMARY:
-		header = &ddf->primary;
-		sector = be64_to_cpu(header->primary_lba);
-		break;
-	case DDF_HEADER_SECONDARY:
-		header = &ddf->secondary;
-		sector = be64_to_cpu(header->secondary_lba);
-		break;
-	default:
+	if (type == DDF_HEADER_PRIMARY)
+		return be64_to_cpu(header->primary_lba);
+	return be64_to_cpu(header->secondary_lba);
+}
+
+static int _prepare_super_for_disk(struct ddf_super *ddf, struct dl *d)
+{
+	struct ddf_header *anchor, *primary, *secondary;
+	int conf_size = ddf->conf_rec_len * 512;
+	unsigned long long size;
+	unsigned int i;
+	char *conf;
+
+	if (!d->wbuf &&
+	    posix_memalign((void **)&d->wbuf, 512,
+			   DDF_WBUF_CONF + conf_size * (ddf->max_part + 1)) != 0) {
+		d->wbuf = NULL;
 		return 0;
 	}
-	if (sector == ~(__u64)0)
-		return 0;
-
-	header->type = type;
-	header->openflag = 1;
-	header->crc = calc_crc(header, 512);
+	anchor = ddf_wbuf_header(d, DDF_HEADER_ANCHOR);
+	primary = ddf_wbuf_header(d, DDF_HEADER_PRIMARY);
+	secondary = ddf_wbuf_header(d, DDF_HEADER_SECONDARY);
+	conf = d->wbuf + DDF_WBUF_CONF;
 
-	lseek64(fd, sector<<9, 0);
-	if (write(fd, header, 512) < 0)
-		goto out;
+	/* We need to fill in the primary, (secondary) and workspace
+	 * lba's in the headers, set their checksums,
+	 * Also checksum phys, virt....
+	 *
+	 * Then write everything out, finally the anchor is written.
+	 */
+	get_dev_size(d->fd, NULL, &size);
+	size /= 512;
+	memcpy(anchor, ddf->active, 512);
+	if (be64_to_cpu(d->workspace_lba) != 0ULL)
+		anchor->workspace_lba = d->workspace_lba;
+	else
+		anchor->workspace_lba =
+			cpu_to_be64(size - 32*1024*2);
+	if (be64_to_cpu(d->primary_lba) != 0ULL)
+		anchor->primary_lba = d->primary_lba;
+	else
+		anchor->primary_lba =
+			cpu_to_be64(size - 16*1024*2);
+	if (be64_to_cpu(d->secondary_lba) != 0ULL)
+		anchor->secondary_lba = d->secondary_lba;
+	else
+		anchor->secondary_lba =
+			cpu_to_be64(size - 32*1024*2);
+	anchor->timestamp = cpu_to_be32(time(0) - DECADE);
+	memcpy(primary, anchor, 512);
+	memcpy(secondary, anchor, 512);
 
-	ddf->controller.crc = calc_crc(&ddf->controller, 512);
-	if (write(fd, &ddf->controller, 512) < 0)
-		goto out;
+	anchor->type = DDF_HEADER_ANCHOR;
+	anchor->openflag = 0xFF; /* 'open' means nothing */
+	anchor->seq = cpu_to_be32(0xFFFFFFFF); /* no sequencing in anchor */
+	anchor->crc = calc_crc(anchor, 512);
 
-	ddf->phys->crc = calc_crc(ddf->phys, ddf->pdsize);
-	if (write(fd, ddf->phys, ddf->pdsize) < 0)
-		goto out;
-	ddf->virt->crc = calc_crc(ddf->virt, ddf->vdsize);
-	if (write(fd, ddf->virt, ddf->vdsize) < 0)
-		goto out;
-
-	/* Now write lots of config records. */
-	n_config = ddf->max_part;
-	conf_size = ddf->conf_rec_len * 512;
-	conf = ddf->conf;
-	buf_size = conf_size * (n_config + 1);
-	if (!conf) {
-		if (posix_memalign((void**)&conf, 512, buf_size) != 0)
-			goto out;
-		ddf->conf = conf;
-	}
-	for (i = 0 ; i <= n_config ; i++) {
+	/* Now lots of config records. */
+	for (i = 0 ; i <= ddf->max_part ; i++) {
 		struct vcl *c;
 		struct vd_config *vdc = NULL;
-		if (i == n_config) {
+		if (i == ddf->max_part) {
 			c = (struct vcl *)d->spare;
 			if (c)
 				vdc = &c->conf;
@@ -3104,76 +3137,138 @@ static int __write_ddf_structure(struct dl *d, struct ddf_super *ddf, __u8 type)
 		} else
 			memset(conf + i*conf_size, 0xff, conf_size);
 	}
-	if (write(fd, conf, buf_size) != buf_size)
-		goto out;
-
 	d->disk.crc = calc_crc(&d->disk, 512);
-	if (write(fd, &d->disk, 512) < 0)
-		goto out;
-
-	ret = 1;
-out:
-	header->openflag = 0;
-	header->crc = calc_crc(header, 512);
+	return 1;
+}
 
-	lseek64(fd, sector<<9, 0);
-	if (write(fd, header, 512) < 0)
-		ret = 0;
+/* Write the batch and note which disks it failed on */
+static void ddf_write_batch(struct write_batch *wb)
+{
+	int i;
 
-	return ret;
+	if (batch_write_submit(wb) == 0)
+		return;
+	for (i = 0; i < wb->cnt; i++)
+		if (wb->w[i].err)
+			((struct dl *)wb->w[i].owner)->wstate &= ~DDF_W_OK;
 }
 
-static int _write_super_to_disk(struct ddf_super *ddf, struct dl *d)
+/*
+ * Write the metadata to all disks from 'first' on, or just to 'first'
+ * if 'all' is not set, and return the number of disks written.
+ * The disks are written together, a step at a time, in the same order
+ * that each disk used to be written on its own: the primary header
+ * marked open, the sections it covers, the header marked closed, then
+ * the same for the secondary and finally the anchor.  So there is
+ * always a consistent copy on each disk.
+ */
+static int _write_super_to_disks(struct ddf_super *ddf, struct dl *first,
+				 int all)
 {
+	struct write_batch *wb = &ddf->wb;
+	int conf_size = ddf->conf_rec_len * 512;
+	struct dl *d, *last = NULL;
 	unsigned long long size;
-	int fd = d->fd;
-	if (fd < 0)
+	int written = 0;
+	__u8 type;
+
+	for (d = first; d; d = all ? d->next : NULL) {
+		d->wstate = 0;
+		if (d->fd < 0 || !_prepare_super_for_disk(ddf, d))
+			continue;
+		d->wstate = DDF_W_OK;
+		last = d;
+	}
+	if (!last)
 		return 0;
 
-	/* We need to fill in the primary, (secondary) and workspace
-	 * lba's in the headers, set their checksums,
-	 * Also checksum phys, virt....
-	 *
-	 * Then write everything out, finally the anchor is written.
-	 */
-	get_dev_size(fd, NULL, &size);
-	size /= 512;
-	memcpy(&ddf->anchor, ddf->active, 512);
-	if (be64_to_cpu(d->workspace_lba) != 0ULL)
-		ddf->anchor.workspace_lba = d->workspace_lba;
-	else
-		ddf->anchor.workspace_lba =
-			cpu_to_be64(size - 32*1024*2);
-	if (be64_to_cpu(d->primary_lba) != 0ULL)
-		ddf->anchor.primary_lba = d->primary_lba;
-	else
-		ddf->anchor.primary_lba =
-			cpu_to_be64(size - 16*1024*2);
-	if (be64_to_cpu(d->secondary_lba) != 0ULL)
-		ddf->anchor.secondary_lba = d->secondary_lba;
-	else
-		ddf->anchor.secondary_lba =
-			cpu_to_be64(size - 32*1024*2);
-	ddf->anchor.timestamp = cpu_to_be32(time(0) - DECADE);
-	memcpy(&ddf->primary, &ddf->anchor, 512);
-	memcpy(&ddf->secondary, &ddf->anchor, 512);
+	ddf->controller.crc = calc_crc(&ddf->controller, 512);
+	ddf->phys->crc = calc_crc(ddf->phys, ddf->pdsize);
+	ddf->virt->crc = calc_crc(ddf->virt, ddf->vdsize);
 
-	ddf->anchor.type = DDF_HEADER_ANCHOR;
-	ddf->anchor.openflag = 0xFF; /* 'open' means nothing */
-	ddf->anchor.seq = cpu_to_be32(0xFFFFFFFF); /* no sequencing in anchor */
-	ddf->anchor.crc = calc_crc(&ddf->anchor, 512);
+	for (type = DDF_HEADER_PRIMARY; type <= DDF_HEADER_SECONDARY; type++) {
+		batch_write_reset(wb);
+		for (d = first; d; d = all ? d->next : NULL) {
+			struct ddf_header *header = ddf_wbuf_header(d, type);
 
-	if (!__write_ddf_structure(d, ddf, DDF_HEADER_PRIMARY))
-		return 0;
+			if (!(d->wstate & DDF_W_OK))
+				continue;
+			if (ddf_header_sector(d, type) == ~(__u64)0) {
+				d->wstate = 0;
+				continue;
+			}
+			header->type = type;
+			header->openflag = 1;
+			header->crc = calc_crc(header, 512);
+			d->wstate |= DDF_W_OPEN;
+			batch_write_add(wb, d->fd, header, 512,
+					ddf_header_sector(d, type) << 9, d);
+		}
+		ddf_write_batch(wb);
 
-	if (!__write_ddf_structure(d, ddf, DDF_HEADER_SECONDARY))
-		return 0;
+		batch_write_reset(wb);
+		for (d = first; d; d = all ? d->next : NULL) {
+			unsigned long long offset;
 
-	lseek64(fd, (size-1)*512, SEEK_SET);
-	if (write(fd, &ddf->anchor, 512) < 0)
-		return 0;
+			if (!(d->wstate & DDF_W_OK))
+				continue;
+			offset = (ddf_header_sector(d, type) + 1) << 9;
+			batch_write_add(wb, d->fd, &ddf->controller, 512,
+					offset, d);
+			offset += 512;
+			batch_write_add(wb, d->fd, ddf->phys, ddf->pdsize,
+					offset, d);
+			offset += ddf->pdsize;
+			batch_write_add(wb, d->fd, ddf->virt, ddf->vdsize,
+					offset, d);
+			offset += ddf->vdsize;
+			batch_write_add(wb, d->fd, d->wbuf + DDF_WBUF_CONF,
+					conf_size * (ddf->max_part + 1),
+					offset, d);
+			offset += conf_size * (ddf->max_part + 1);
+			batch_write_add(wb, d->fd, &d->disk, 512, offset, d);
+		}
+		ddf_write_batch(wb);
 
-	return 1;
+		/* The header is closed again even if writing failed */
+		batch_write_reset(wb);
+		for (d = first; d; d = all ? d->next : NULL) {
+			struct ddf_header *header = ddf_wbuf_header(d, type);
+
+			if (!(d->wstate & DDF_W_OPEN))
+				continue;
+			header->openflag = 0;
+			header->crc = calc_crc(header, 512);
+			d->wstate &= ~DDF_W_OPEN;
+			batch_write_add(wb, d->fd, header, 512,
+					ddf_header_sector(d, type) << 9, d);
+		}
+		ddf_write_batch(wb);
+	}
+
+	batch_write_reset(wb);
+	for (d = first; d; d = all ? d->next : NULL) {
+		if (!(d->wstate & DDF_W_OK))
+			continue;
+		get_dev_size(d->fd, NULL, &size);
+		size /= 512;
+		batch_write_add(wb, d->fd,
+				ddf_wbuf_header(d, DDF_HEADER_ANCHOR), 512,
+				(size-1)*512, d);
+	}
+	ddf_write_batch(wb);
+
+	for (d = first; d; d = all ? d->next : NULL)
+		if (d->wstate & DDF_W_OK)
+			written++;
+
+	/* Leave the headers as they were written to the last disk */
+	memcpy(&ddf->anchor, ddf_wbuf_header(last, DDF_HEADER_ANCHOR), 512);
+	memcpy(&ddf->primary, ddf_wbuf_header(last, DDF_HEADER_PRIMARY), 512);
+	memcpy(&ddf->secondary, ddf_wbuf_header(last, DDF_HEADER_SECONDARY),
+	       512);
+
+	return written;
 }
 
 #ifndef MDASSEMBLE
@@ -3189,10 +3284,9 @@ static int __write_init_super_ddf(struct supertype *st)
 	/* try to write updated metadata,
 	 * if we catch a failure move on to the next disk
 	 */
-	for (d = ddf->dlist; d; d=d->next) {
+	for (d = ddf->dlist; d; d=d->next)
 		attempts++;
-		successes += _write_super_to_disk(ddf, d);
-	}
+	successes = _write_super_to_disks(ddf, ddf->dlist, 1);
 
 	return attempts != successes;
 }
@@ -3923,7 +4017,7 @@ static int store_super_ddf(struct supertype *st, int fd)
 		}
 		ofd = dl->fd;
 		dl->fd = fd;
-		ret = (_write_super_to_disk(ddf, dl) != 1);
+		ret = (_write_super_to_disks(ddf, dl, 0) != 1);
 		dl->fd = ofd;
 		return ret;
 	}
@@ -4039,6 +4133,7 @@ static int compare_super_ddf(struct supertype *st, struct supertype *tst)
 		}
 		memcpy(dl1, dl2, sizeof(*dl1));
 		dl1->mdupdate = NULL;
+		dl1->wbuf = NULL;
 		dl1->next = first->dlist;
 		dl1->fd = -1;
 		for (pd = 0; pd < max_pds; pd++)
@@ -82,7 +82,7 @@ static int load_gpt(struct supertype *st, int fd, char *devname)
 	}
 
 	lseek(fd, 0, 0);
-	if (read(fd, super, sizeof(*super)) != sizeof(*super)) {
+	if (probe_read(fd, super, sizeof(*super)) != sizeof(*super)) {
 	no_read:
 		if (devname)
 			pr_err("Cannot read partition table on %s\n",
@@ -102,7 +102,7 @@ static int load_gpt(struct supertype *st, int fd, char *devname)
 	}
 	/* Seem to have GPT, load the header */
 	gpt_head = (struct GPT*)(super+1);
-	if (read(fd, gpt_head, sizeof(*gpt_head)) != sizeof(*gpt_head))
+	if (probe_read(fd, gpt_head, sizeof(*gpt_head)) != sizeof(*gpt_head))
 		goto no_read;
 	if (gpt_head->magic != GPT_SIGNATURE_MAGIC)
 		goto not_found;
@@ -111,7 +111,7 @@ static int load_gpt(struct supertype *st, int fd, char *devname)
 
 	to_read = __le32_to_cpu(gpt_head->part_cnt) * sizeof(struct GPT_part_entry);
 	to_read =  ((to_read+511)/512) * 512;
-	if (read(fd, gpt_head+1, to_read) != to_read)
+	if (probe_read(fd, gpt_head+1, to_read) != to_read)
 		goto no_read;
 
 	st->sb = super;
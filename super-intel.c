@@ -378,6 +378,7 @@ struct intel_super {
 		struct extent *e; /* for determining freespace @ create */
 		int raiddisk; /* slot to fill in autolayout */
 		enum action action;
+		int write_err; /* errno from writing metadata */
 	} *disks, *current_disk;
 	struct dl *disk_mgmt_list; /* list of disks to add/remove while mdmon
 				      active */
@@ -385,6 +386,7 @@ struct intel_super {
 	struct bbm_log *bbm_log;
 	struct intel_hba *hba; /* device path of the raid controller for this metadata */
 	const struct imsm_orom *orom; /* platform firmware support */
+	struct write_batch wb; /* for writing the mpb to all disks at once */
 	struct intel_super *next; /* (temp) list for disambiguating family_num */
 };
 
@@ -3617,7 +3619,7 @@ static int load_imsm_mpb(int fd, struct intel_super *super, char *devname)
 			pr_err("Failed to allocate imsm anchor buffer on %s\n", devname);
 		return 1;
 	}
-	if (read(fd, anchor, 512) != 512) {
+	if (probe_read(fd, anchor, 512) != 512) {
 		if (devname)
 			pr_err("Cannot read anchor block on %s: %s\n",
 			       devname, strerror(errno));
@@ -3679,7 +3681,7 @@ static int load_imsm_mpb(int fd, struct intel_super *super, char *devname)
 		return 1;
 	}
 
-	if ((unsigned)read(fd, super->buf + 512, super->len - 512) != super->len - 512) {
+	if ((unsigned)probe_read(fd, super->buf + 512, super->len - 512) != super->len - 512) {
 		if (devname)
 			pr_err("Cannot read extended mpb on %s: %s\n",
 			       devname, strerror(errno));
@@ -3814,6 +3816,7 @@ static void __free_imsm(struct intel_super *super, int free_disks)
 static void free_imsm(struct intel_super *super)
 {
 	__free_imsm(super, 1);
+	batch_write_free(&super->wb);
 	free(super);
 }
 
@@ -3840,7 +3843,8 @@ static struct intel_super *alloc_super(void)
 /*
  * find and allocate hba and OROM/EFI based on valid fd of RAID component device
  */
-static int find_intel_hba_capability(int fd, struct intel_super *super, char *devname)
+static int __find_intel_hba_capability(int fd, struct intel_super *super,
+				       char *devname)
 {
 	struct sys_dev *hba_name;
 	int rv = 0;
@@ -3887,6 +3891,19 @@ static int find_intel_hba_capability(int fd, struct intel_super *super, char *de
 	return 0;
 }
 
+static int find_intel_hba_capability(int fd, struct intel_super *super, char *devname)
+{
+	/* The platform and option-rom tables are cached process-wide,
+	 * and devices may be probed from several threads at once.
+	 */
+	int rv;
+
+	probe_lock();
+	rv = __find_intel_hba_capability(fd, super, devname);
+	probe_unlock();
+	return rv;
+}
+
 /* find_missing - helper routine for load_super_imsm_all that identifies
  * disks that have disappeared from the system.  This routine relies on
  * the mpb being uptodate, which it is at load time.
@@ -4488,11 +4505,16 @@ static int load_super_imsm(struct supertype *st, int fd, char *devname)
 
 	/* retry the load if we might have raced against mdmon */
 	if (rv == 3) {
-		struct mdstat_ent *mdstat = mdstat_by_component(fd2devnm(fd));
+		struct mdstat_ent *mdstat;
+
+		probe_lock();
+		mdstat = mdstat_by_component(fd2devnm(fd));
+		probe_unlock();
 
 		if (mdstat && mdmon_running(mdstat->devnm) && getpid() != mdmon_pid(mdstat->devnm)) {
 			for (retry = 0; retry < 3; retry++) {
 				usleep(3000);
+				probe_window_drop(fd);
 				rv = load_and_parse_mpb(fd, super, devname, 0);
 				if (rv != 3)
 					break;
@@ -5152,6 +5174,79 @@ static int write_super_imsm_spares(struct intel_super *super, int doclose)
 	return 0;
 }
 
+/* Write the mpb, and the migration record if asked, to every disk
+ * that is part of a raid device.  The disks are written together but
+ * in the same order as store_imsm_mpb(), so the anchor only goes to a
+ * disk once the rest of the mpb is there.  ->write_err is set for the
+ * disks that could not be written.
+ */
+static void write_mpb_all(struct intel_super *super, int migr_rec)
+{
+	struct imsm_super *mpb = super->anchor;
+	struct write_batch *wb = &super->wb;
+	unsigned long long sectors = 0;
+	unsigned long long dsize;
+	struct dl *d;
+	int i;
+
+	if (__le32_to_cpu(mpb->mpb_size) > 512)
+		/* -1 to account for anchor */
+		sectors = mpb_sectors(mpb) - 1;
+
+	for (d = super->disks; d; d = d->next)
+		d->write_err = 0;
+
+	if (migr_rec) {
+		batch_write_reset(wb);
+		for (d = super->disks; d; d = d->next) {
+			if (d->index < 0 || is_failed(&d->disk))
+				continue;
+			if (get_dev_size(d->fd, NULL, &dsize))
+				batch_write_add(wb, d->fd, super->migr_rec_buf,
+						MIGR_REC_BUF_SIZE, dsize - 512, d);
+		}
+		if (batch_write_submit(wb))
+			perror("Write migr_rec failed");
+	}
+
+	if (sectors) {
+		/* the extended mpb goes in the sectors preceeding the anchor */
+		batch_write_reset(wb);
+		for (d = super->disks; d; d = d->next) {
+			if (d->index < 0 || is_failed(&d->disk))
+				continue;
+			if (!get_dev_size(d->fd, NULL, &dsize)) {
+				d->write_err = EIO;
+				continue;
+			}
+			batch_write_add(wb, d->fd, super->buf + 512,
+					512 * sectors,
+					dsize - (512 * (2 + sectors)), d);
+		}
+		batch_write_submit(wb);
+		for (i = 0; i < wb->cnt; i++)
+			if (wb->w[i].err)
+				((struct dl *)wb->w[i].owner)->write_err =
+					wb->w[i].err;
+	}
+
+	/* first block is stored on second to last sector of the disk */
+	batch_write_reset(wb);
+	for (d = super->disks; d; d = d->next) {
+		if (d->index < 0 || is_failed(&d->disk) || d->write_err)
+			continue;
+		if (!get_dev_size(d->fd, NULL, &dsize)) {
+			d->write_err = EIO;
+			continue;
+		}
+		batch_write_add(wb, d->fd, mpb, 512, dsize - (512 * 2), d);
+	}
+	batch_write_submit(wb);
+	for (i = 0; i < wb->cnt; i++)
+		if (wb->w[i].err)
+			((struct dl *)wb->w[i].owner)->write_err = wb->w[i].err;
+}
+
 static int write_super_imsm(struct supertype *st, int doclose)
 {
 	struct intel_super *super = st->sb;
@@ -5216,26 +5311,16 @@ static int write_super_imsm(struct supertype *st, int doclose)
 		memset(super->migr_rec_buf, 0, MIGR_REC_BUF_SIZE);
 
 	/* write the mpb for disks that compose raid devices */
+	write_mpb_all(super, clear_migration_record);
 	for (d = super->disks; d ; d = d->next) {
 		if (d->index < 0 || is_failed(&d->disk))
 			continue;
 
-		if (clear_migration_record) {
-			unsigned long long dsize;
-
-			get_dev_size(d->fd, NULL, &dsize);
-			if (lseek64(d->fd, dsize - 512, SEEK_SET) >= 0) {
-				if (write(d->fd, super->migr_rec_buf,
-					MIGR_REC_BUF_SIZE) != MIGR_REC_BUF_SIZE)
-					perror("Write migr_rec failed");
-			}
-		}
-
-		if (store_imsm_mpb(d->fd, mpb))
+		if (d->write_err)
 			fprintf(stderr,
 				"failed for device %d:%d (fd: %d)%s\n",
 				d->major, d->minor,
-				d->fd, strerror(errno));
+				d->fd, strerror(d->write_err));
 
 		if (doclose) {
 			close(d->fd);
@@ -86,7 +86,7 @@ static int load_super_mbr(struct supertype *st, int fd, char *devname)
 	}
 
 	lseek(fd, 0, 0);
-	if (read(fd, super, sizeof(*super)) != sizeof(*super)) {
+	if (probe_read(fd, super, sizeof(*super)) != sizeof(*super)) {
 		if (devname)
 			pr_err("Cannot read partition table on %s\n",
 				devname);
@@ -1001,7 +1001,7 @@ static int load_super0(struct supertype *st, int fd, char *devname)
 		return 1;
 	}
 
-	if (read(fd, super, sizeof(*super)) != MD_SB_BYTES) {
+	if (probe_read(fd, super, sizeof(*super)) != MD_SB_BYTES) {
 		if (devname)
 			pr_err("Cannot read superblock on %s\n",
 				devname);
@@ -1043,7 +1043,7 @@ static int load_super0(struct supertype *st, int fd, char *devname)
 	 * valid.  If it doesn't clear the bit.  An --assemble --force
 	 * should get that written out.
 	 */
-	if (read(fd, super+1, ROUND_UP(sizeof(struct bitmap_super_s),4096))
+	if (probe_read(fd, super+1, ROUND_UP(sizeof(struct bitmap_super_s),4096))
 	    != ROUND_UP(sizeof(struct bitmap_super_s),4096))
 		goto no_bitmap;
 
@@ -200,22 +200,40 @@ static unsigned int calc_sb_1_csum(struct mdp_superblock_1 * sb)
 
 /*
  * Information related to file descriptor used for aligned reads/writes.
- * Cache the block size.
+ * Cache the block size.  The position is kept here rather than in the
+ * fd, which is only used with pread/pwrite, and each context has its
+ * own bounce buffer, so several can work on devices at once.
  */
 struct align_fd {
 	int fd;
 	int blk_sz;
+	unsigned long long offset; /* bytes, of the next aread/awrite */
+	char *buf; /* 4096 aligned, within 'space' */
+	char space[4096+4096];
 };
 
-static void init_afd(struct align_fd *afd, int fd)
+static void init_afd(struct align_fd *afd, int fd, unsigned long long offset)
 {
 	afd->fd = fd;
+	afd->offset = offset;
+	afd->buf = ROUND_UP_PTR((char *)afd->space, 4096);
 
 	if (ioctl(afd->fd, BLKSSZGET, &afd->blk_sz) != 0)
 		afd->blk_sz = 512;
 }
 
-static char abuf[4096+4096];
+/* Where the transfer can be done straight from the caller's buffer,
+ * return that, else the bounce buffer, or NULL if it is too small.
+ */
+static char *afd_iobuf(struct align_fd *afd, void *buf, int len, int iosize)
+{
+	if (len == iosize && ((unsigned long)buf & 4095) == 0)
+		return buf;
+	if (iosize > 4096)
+		return NULL;
+	return afd->buf;
+}
+
 static int aread(struct align_fd *afd, void *buf, int len)
 {
 	/* aligned read.
@@ -229,22 +247,24 @@ static int aread(struct align_fd *afd, void *buf, int len)
 
 	bsize = afd->blk_sz;
 
-	if (!bsize || bsize > 4096 || len > 4096) {
+	if (!bsize || bsize > 4096) {
 		if (!bsize)
 			fprintf(stderr, "WARNING - aread() called with invalid block size\n");
 		return -1;
 	}
-	b = ROUND_UP_PTR((char *)abuf, 4096);
+	iosize = ROUND_UP(len, bsize);
+	b = afd_iobuf(afd, buf, len, iosize);
+	if (!b)
+		return -1;
 
-	for (iosize = 0; iosize < len; iosize += bsize)
-		;
-	n = read(afd->fd, b, iosize);
+	n = probe_pread(afd->fd, b, iosize, afd->offset);
 	if (n <= 0)
 		return n;
-	lseek(afd->fd, len - n, 1);
+	afd->offset += len;
 	if (n > len)
 		n = len;
-	memcpy(buf, b, n);
+	if (b != buf)
+		memcpy(buf, b, n);
 	return n;
 }
 
@@ -261,31 +281,41 @@ static int awrite(struct align_fd *afd, void *buf, int len)
 	int n;
 
 	bsize = afd->blk_sz;
-	if (!bsize || bsize > 4096 || len > 4096) {
+	if (!bsize || bsize > 4096) {
 		if (!bsize)
 			fprintf(stderr, "WARNING - awrite() called with invalid block size\n");
 		return -1;
 	}
-	b = ROUND_UP_PTR((char *)abuf, 4096);
-
-	for (iosize = 0; iosize < len ; iosize += bsize)
-		;
+	iosize = ROUND_UP(len, bsize);
+	b = afd_iobuf(afd, buf, len, iosize);
+	if (!b)
+		return -1;
 
 	if (len != iosize) {
-		n = read(afd->fd, b, iosize);
+		n = pread64(afd->fd, b, iosize, afd->offset);
 		if (n <= 0)
 			return n;
-		lseek(afd->fd, -n, 1);
 	}
 
-	memcpy(b, buf, len);
-	n = write(afd->fd, b, iosize);
+	if (b != buf)
+		memcpy(b, buf, len);
+	n = pwrite64(afd->fd, b, iosize, afd->offset);
 	if (n <= 0)
 		return n;
-	lseek(afd->fd, len - n, 1);
+	afd->offset += len;
 	return len;
 }
 
+/* Byte offset of the bitmap superblock */
+static unsigned long long bitmap_offset1(struct mdp_superblock_1 *sb)
+{
+	unsigned long long offset;
+
+	offset = __le64_to_cpu(sb->super_offset);
+	offset += (int32_t) __le32_to_cpu(sb->bitmap_offset);
+	return offset << 9;
+}
+
 #ifndef MDASSEMBLE
 static void examine_super1(struct supertype *st, char *homehost)
 {
@@ -696,15 +726,10 @@ static int copy_metadata1(struct supertype *st, int from, int to)
 		int written = 0;
 		struct align_fd afrom, ato;
 
-		init_afd(&afrom, from);
-		init_afd(&ato, to);
-
 		bitmap_offset += (int32_t)__le32_to_cpu(super.bitmap_offset);
 
-		if (lseek64(from, bitmap_offset<<9, 0) < 0)
-			goto err;
-		if (lseek64(to, bitmap_offset<<9, 0) < 0)
-			goto err;
+		init_afd(&afrom, from, bitmap_offset << 9);
+		init_afd(&ato, to, bitmap_offset << 9);
 
 		for (written = 0; written < bytes ; ) {
 			int n = bytes - written;
@@ -737,15 +762,10 @@ static int copy_metadata1(struct supertype *st, int from, int to)
 		int written = 0;
 		struct align_fd afrom, ato;
 
-		init_afd(&afrom, from);
-		init_afd(&ato, to);
-
 		bb_offset += (int32_t)__le32_to_cpu(super.bblog_offset);
 
-		if (lseek64(from, bb_offset<<9, 0) < 0)
-			goto err;
-		if (lseek64(to, bb_offset<<9, 0) < 0)
-			goto err;
+		init_afd(&afrom, from, bb_offset << 9);
+		init_afd(&ato, to, bb_offset << 9);
 
 		for (written = 0; written < bytes ; ) {
 			int n = bytes - written;
@@ -1548,8 +1568,6 @@ static int store_super1(struct supertype *st, int fd)
 	if (dsize < 24)
 		return 2;
 
-	init_afd(&afd, fd);
-
 	/*
 	 * Calculate the position of the superblock.
 	 * It is always aligned to a 4K boundary and
@@ -1581,8 +1599,7 @@ static int store_super1(struct supertype *st, int fd)
 		abort();
 	}
 
-	if (lseek64(fd, sb_offset << 9, 0)< 0LL)
-		return 3;
+	init_afd(&afd, fd, sb_offset << 9);
 
 	sbsize = ROUND_UP(sizeof(*sb) + 2 * __le32_to_cpu(sb->max_dev), 512);
 
@@ -1593,7 +1610,7 @@ static int store_super1(struct supertype *st, int fd)
 		struct bitmap_super_s *bm = (struct bitmap_super_s*)
 			(((char*)sb)+MAX_SB_SIZE);
 		if (__le32_to_cpu(bm->magic) == BITMAP_MAGIC) {
-			locate_bitmap1(st, fd);
+			afd.offset = bitmap_offset1(sb);
 			if (awrite(&afd, bm, sizeof(*bm)) != sizeof(*bm))
 				return 5;
 		}
@@ -1637,7 +1654,7 @@ static int write_empty_r5l_meta_block(struct supertype *st, int fd)
 	struct align_fd afd;
 	__u32 crc;
 
-	init_afd(&afd, fd);
+	init_afd(&afd, fd, sb->data_offset * 512);
 
 	if (posix_memalign((void**)&mb, 4096, META_BLOCK_SIZE) != 0) {
 		pr_err("Could not allocate memory for the meta block.\n");
@@ -1656,11 +1673,6 @@ static int write_empty_r5l_meta_block(struct supertype *st, int fd)
 	crc = crc32(crc, (void *)mb, META_BLOCK_SIZE);
 	mb->checksum = __cpu_to_le32(crc);
 
-	if (lseek64(fd, (sb->data_offset) * 512, 0) < 0LL) {
-		pr_err("cannot seek to offset of the meta block\n");
-		goto fail_to_write;
-	}
-
 	if (awrite(&afd, mb, META_BLOCK_SIZE) != META_BLOCK_SIZE) {
 		pr_err("failed to store write the meta block \n");
 		goto fail_to_write;
@@ -1676,181 +1688,240 @@ fail_to_write:
 }
 
 #ifndef MDASSEMBLE
-static int write_init_super1(struct supertype *st)
+/* Write a fresh superblock, and the bitmap and journal header if there
+ * are to be any, to one member.  'st' is a private copy, as the
+ * superblock is filled in with the details of this device.
+ */
+static int write_init_dev1(struct supertype *st, struct devinfo *di)
 {
 	struct mdp_superblock_1 *sb = st->sb;
 	struct supertype *refst;
 	int rfd;
-	int rv = 0;
+	int rv;
 	unsigned long long bm_space;
-	struct devinfo *di;
 	unsigned long long dsize, array_size;
 	unsigned long long sb_offset;
 	unsigned long long data_offset;
 
-	for (di = st->info; di; di = di->next) {
-		if (di->disk.state & (1 << MD_DISK_JOURNAL))
-			sb->feature_map |= MD_FEATURE_JOURNAL;
-	}
+	while (Kill(di->devname, NULL, 0, -1, 1) == 0)
+		;
 
-	for (di = st->info; di; di = di->next) {
-		if (di->disk.state & (1 << MD_DISK_FAULTY))
-			continue;
-		if (di->fd < 0)
-			continue;
+	sb->dev_number = __cpu_to_le32(di->disk.number);
+	if (di->disk.state & (1<<MD_DISK_WRITEMOSTLY))
+		sb->devflags |= WriteMostly1;
+	else
+		sb->devflags &= ~WriteMostly1;
+
+	if ((rfd = open("/dev/urandom", O_RDONLY)) < 0 ||
+	    read(rfd, sb->device_uuid, 16) != 16) {
+		__u32 r[4] = {random(), random(), random(), random()};
+		memcpy(sb->device_uuid, r, 16);
+	}
+	if (rfd >= 0)
+		close(rfd);
 
-		while (Kill(di->devname, NULL, 0, -1, 1) == 0)
-			;
+	sb->events = 0;
 
-		sb->dev_number = __cpu_to_le32(di->disk.number);
-		if (di->disk.state & (1<<MD_DISK_WRITEMOSTLY))
-			sb->devflags |= WriteMostly1;
-		else
-			sb->devflags &= ~WriteMostly1;
+	refst = dup_super(st);
+	if (load_super1(refst, di->fd, NULL)==0) {
+		struct mdp_superblock_1 *refsb = refst->sb;
 
-		if ((rfd = open("/dev/urandom", O_RDONLY)) < 0 ||
-		    read(rfd, sb->device_uuid, 16) != 16) {
-			__u32 r[4] = {random(), random(), random(), random()};
-			memcpy(sb->device_uuid, r, 16);
+		memcpy(sb->device_uuid, refsb->device_uuid, 16);
+		if (memcmp(sb->set_uuid, refsb->set_uuid, 16)==0) {
+			/* same array, so preserve events and
+			 * dev_number */
+			sb->events = refsb->events;
+			/* bugs in 2.6.17 and earlier mean the
+			 * dev_number chosen in Manage must be preserved
+			 */
+			if (get_linux_version() >= 2006018)
+				sb->dev_number = refsb->dev_number;
 		}
-		if (rfd >= 0)
-			close(rfd);
+		free_super1(refst);
+	}
+	free(refst);
 
-		sb->events = 0;
+	if (!get_dev_size(di->fd, NULL, &dsize))
+		return 1;
+	dsize >>= 9;
 
-		refst = dup_super(st);
-		if (load_super1(refst, di->fd, NULL)==0) {
-			struct mdp_superblock_1 *refsb = refst->sb;
+	if (dsize < 24) {
+		close(di->fd);
+		di->fd = -1;
+		return 2;
+	}
 
-			memcpy(sb->device_uuid, refsb->device_uuid, 16);
-			if (memcmp(sb->set_uuid, refsb->set_uuid, 16)==0) {
-				/* same array, so preserve events and
-				 * dev_number */
-				sb->events = refsb->events;
-				/* bugs in 2.6.17 and earlier mean the
-				 * dev_number chosen in Manage must be preserved
-				 */
-				if (get_linux_version() >= 2006018)
-					sb->dev_number = refsb->dev_number;
-			}
-			free_super1(refst);
-		}
-		free(refst);
+	/*
+	 * Calculate the position of the superblock.
+	 * It is always aligned to a 4K boundary and
+	 * depending on minor_version, it can be:
+	 * 0: At least 8K, but less than 12K, from end of device
+	 * 1: At start of device
+	 * 2: 4K from start of device.
+	 * data_offset has already been set.
+	 */
+	array_size = __le64_to_cpu(sb->size);
+	/* work out how much space we left for a bitmap,
+	 * Add 8 sectors for bad block log */
+	bm_space = choose_bm_space(array_size) + 8;
 
-		if (!get_dev_size(di->fd, NULL, &dsize)) {
-			rv = 1;
-			goto error_out;
+	data_offset = di->data_offset;
+	if (data_offset == INVALID_SECTORS)
+		data_offset = st->data_offset;
+	switch(st->minor_version) {
+	case 0:
+		if (data_offset == INVALID_SECTORS)
+			data_offset = 0;
+		sb_offset = dsize;
+		sb_offset -= 8*2;
+		sb_offset &= ~(4*2-1);
+		sb->data_offset = __cpu_to_le64(data_offset);
+		sb->super_offset = __cpu_to_le64(sb_offset);
+		if (sb_offset < array_size + bm_space)
+			bm_space = sb_offset - array_size;
+		sb->data_size = __cpu_to_le64(sb_offset - bm_space);
+		if (bm_space >= 8) {
+			sb->bblog_size = __cpu_to_le16(8);
+			sb->bblog_offset = __cpu_to_le32((unsigned)-8);
 		}
-		dsize >>= 9;
-
-		if (dsize < 24) {
-			close(di->fd);
-			rv = 2;
-			goto error_out;
+		break;
+	case 1:
+		sb->super_offset = __cpu_to_le64(0);
+		if (data_offset == INVALID_SECTORS)
+			data_offset = 16;
+
+		sb->data_offset = __cpu_to_le64(data_offset);
+		sb->data_size = __cpu_to_le64(dsize - data_offset);
+		if (data_offset >= 8 + 32*2 + 8) {
+			sb->bblog_size = __cpu_to_le16(8);
+			sb->bblog_offset = __cpu_to_le32(8 + 32*2);
+		} else if (data_offset >= 16) {
+			sb->bblog_size = __cpu_to_le16(8);
+			sb->bblog_offset = __cpu_to_le32(data_offset-8);
 		}
+		break;
+	case 2:
+		sb_offset = 4*2;
+		sb->super_offset = __cpu_to_le64(sb_offset);
+		if (data_offset == INVALID_SECTORS)
+			data_offset = 24;
+
+		sb->data_offset = __cpu_to_le64(data_offset);
+		sb->data_size = __cpu_to_le64(dsize - data_offset);
+		if (data_offset >= 16 + 32*2 + 8) {
+			sb->bblog_size = __cpu_to_le16(8);
+			sb->bblog_offset = __cpu_to_le32(8 + 32*2);
+		} else if (data_offset >= 16+16) {
+			sb->bblog_size = __cpu_to_le16(8);
+			/* '8' sectors for the bblog, and another '8'
+			 * because we want offset from superblock, not
+			 * start of device.
+			 */
+			sb->bblog_offset = __cpu_to_le32(data_offset-8-8);
+		}
+		break;
+	default:
+		pr_err("Failed to write invalid metadata format 1.%i to %s\n",
+		       st->minor_version, di->devname);
+		return -EINVAL;
+	}
+	/* Disable badblock log on clusters, or when explicitly requested */
+	if (st->nodes > 0 || conf_get_create_info()->bblist == 0) {
+		sb->bblog_size = 0;
+		sb->bblog_offset = 0;
+	}
 
-		/*
-		 * Calculate the position of the superblock.
-		 * It is always aligned to a 4K boundary and
-		 * depending on minor_version, it can be:
-		 * 0: At least 8K, but less than 12K, from end of device
-		 * 1: At start of device
-		 * 2: 4K from start of device.
-		 * data_offset has already been set.
-		 */
-		array_size = __le64_to_cpu(sb->size);
-		/* work out how much space we left for a bitmap,
-		 * Add 8 sectors for bad block log */
-		bm_space = choose_bm_space(array_size) + 8;
+	sb->sb_csum = calc_sb_1_csum(sb);
+	rv = store_super1(st, di->fd);
 
-		data_offset = di->data_offset;
-		if (data_offset == INVALID_SECTORS)
-			data_offset = st->data_offset;
-		switch(st->minor_version) {
-		case 0:
-			if (data_offset == INVALID_SECTORS)
-				data_offset = 0;
-			sb_offset = dsize;
-			sb_offset -= 8*2;
-			sb_offset &= ~(4*2-1);
-			sb->data_offset = __cpu_to_le64(data_offset);
-			sb->super_offset = __cpu_to_le64(sb_offset);
-			if (sb_offset < array_size + bm_space)
-				bm_space = sb_offset - array_size;
-			sb->data_size = __cpu_to_le64(sb_offset - bm_space);
-			if (bm_space >= 8) {
-				sb->bblog_size = __cpu_to_le16(8);
-				sb->bblog_offset = __cpu_to_le32((unsigned)-8);
-			}
-			break;
-		case 1:
-			sb->super_offset = __cpu_to_le64(0);
-			if (data_offset == INVALID_SECTORS)
-				data_offset = 16;
+	if (rv == 0 && (di->disk.state & (1 << MD_DISK_JOURNAL))) {
+		rv = write_empty_r5l_meta_block(st, di->fd);
+		if (rv)
+			return rv;
+	}
 
-			sb->data_offset = __cpu_to_le64(data_offset);
-			sb->data_size = __cpu_to_le64(dsize - data_offset);
-			if (data_offset >= 8 + 32*2 + 8) {
-				sb->bblog_size = __cpu_to_le16(8);
-				sb->bblog_offset = __cpu_to_le32(8 + 32*2);
-			} else if (data_offset >= 16) {
-				sb->bblog_size = __cpu_to_le16(8);
-				sb->bblog_offset = __cpu_to_le32(data_offset-8);
-			}
-			break;
-		case 2:
-			sb_offset = 4*2;
-			sb->super_offset = __cpu_to_le64(sb_offset);
-			if (data_offset == INVALID_SECTORS)
-				data_offset = 24;
-
-			sb->data_offset = __cpu_to_le64(data_offset);
-			sb->data_size = __cpu_to_le64(dsize - data_offset);
-			if (data_offset >= 16 + 32*2 + 8) {
-				sb->bblog_size = __cpu_to_le16(8);
-				sb->bblog_offset = __cpu_to_le32(8 + 32*2);
-			} else if (data_offset >= 16+16) {
-				sb->bblog_size = __cpu_to_le16(8);
-				/* '8' sectors for the bblog, and another '8'
-				 * because we want offset from superblock, not
-				 * start of device.
-				 */
-				sb->bblog_offset = __cpu_to_le32(data_offset-8-8);
-			}
-			break;
-		default:
-			pr_err("Failed to write invalid metadata format 1.%i to %s\n",
-			       st->minor_version, di->devname);
-			rv = -EINVAL;
-			goto out;
-		}
-		/* Disable badblock log on clusters, or when explicitly requested */
-		if (st->nodes > 0 || conf_get_create_info()->bblist == 0) {
-			sb->bblog_size = 0;
-			sb->bblog_offset = 0;
-		}
+	if (rv == 0 && (__le32_to_cpu(sb->feature_map) & 1))
+		rv = st->ss->write_bitmap(st, di->fd, NoUpdate);
+	close(di->fd);
+	di->fd = -1;
+	return rv;
+}
 
-		sb->sb_csum = calc_sb_1_csum(sb);
-		rv = store_super1(st, di->fd);
+struct init_super1_args {
+	struct supertype *st;
+	struct devinfo **dis;
+	struct dev_probe *probes;
+};
 
-		if (rv == 0 && (di->disk.state & (1 << MD_DISK_JOURNAL))) {
-			rv = write_empty_r5l_meta_block(st, di->fd);
-			if (rv)
-				goto error_out;
-		}
+static void init_super1_probe(struct dev_probe *dp, void *arg)
+{
+	struct init_super1_args *ia = arg;
+	struct devinfo *di = ia->dis[dp - ia->probes];
+	struct supertype *st = dup_super(ia->st);
 
-		if (rv == 0 && (__le32_to_cpu(sb->feature_map) & 1))
-			rv = st->ss->write_bitmap(st, di->fd, NoUpdate);
-		close(di->fd);
-		di->fd = -1;
-		if (rv)
-			goto error_out;
+	st->nodes = ia->st->nodes;
+	st->cluster_name = ia->st->cluster_name;
+	if (posix_memalign(&st->sb, 4096, SUPER1_SIZE) != 0) {
+		pr_err("could not allocate superblock\n");
+		dp->rv = 1;
+	} else {
+		memcpy(st->sb, ia->st->sb, SUPER1_SIZE);
+		dp->rv = write_init_dev1(st, di);
+		free(st->sb);
 	}
-error_out:
-	if (rv)
-		pr_err("Failed to write metadata to %s\n",
-		       di->devname);
-out:
+	free(st);
+}
+
+static int write_init_super1(struct supertype *st)
+{
+	/* Each member is written by write_init_dev1(), and as that
+	 * is mostly waiting for small synchronous writes, they are all
+	 * done at once with probe_devices().
+	 */
+	struct mdp_superblock_1 *sb = st->sb;
+	struct init_super1_args ia;
+	struct devinfo *di;
+	int cnt = 0;
+	int i;
+	int rv = 0;
+
+	for (di = st->info; di; di = di->next) {
+		if (di->disk.state & (1 << MD_DISK_JOURNAL))
+			sb->feature_map |= MD_FEATURE_JOURNAL;
+		cnt++;
+	}
+
+	/* read mdadm.conf before the threads need it */
+	conf_get_create_info();
+
+	ia.st = st;
+	ia.dis = xcalloc(cnt ? cnt : 1, sizeof(*ia.dis));
+	ia.probes = xcalloc(cnt ? cnt : 1, sizeof(*ia.probes));
+	cnt = 0;
+	for (di = st->info; di; di = di->next) {
+		if (di->disk.state & (1 << MD_DISK_FAULTY))
+			continue;
+		if (di->fd < 0)
+			continue;
+		ia.dis[cnt] = di;
+		ia.probes[cnt].devname = di->devname;
+		cnt++;
+	}
+	probe_devices(ia.probes, cnt, init_super1_probe, &ia);
+
+	for (i = 0; i < cnt; i++) {
+		struct dev_probe *dp = &ia.probes[i];
+
+		if (!dp->rv)
+			continue;
+		if (dp->rv != -EINVAL)
+			pr_err("Failed to write metadata to %s\n",
+			       dp->devname);
+		if (!rv)
+			rv = dp->rv;
+	}
+	free(ia.dis);
+	free(ia.probes);
 	return rv;
 }
 #endif
@@ -1906,8 +1977,6 @@ static int load_super1(struct supertype *st, int fd, char *devname)
 
 	free_super1(st);
 
-	init_afd(&afd, fd);
-
 	if (st->ss == NULL || st->minor_version == -1) {
 		int bestvers = -1;
 		struct supertype tst;
@@ -1977,12 +2046,7 @@ static int load_super1(struct supertype *st, int fd, char *devname)
 		return -EINVAL;
 	}
 
-	if (lseek64(fd, sb_offset << 9, 0)< 0LL) {
-		if (devname)
-			pr_err("Cannot seek to superblock on %s: %s\n",
-				devname, strerror(errno));
-		return 1;
-	}
+	init_afd(&afd, fd, sb_offset << 9);
 
 	if (posix_memalign((void**)&super, 4096, SUPER1_SIZE) != 0) {
 		pr_err("could not allocate superblock\n");
@@ -2035,7 +2099,7 @@ static int load_super1(struct supertype *st, int fd, char *devname)
 	 * valid.  If it doesn't clear the bit.  An --assemble --force
 	 * should get that written out.
 	 */
-	locate_bitmap1(st, fd);
+	afd.offset = bitmap_offset1(super);
 	if (aread(&afd, bsb, 512) != 512)
 		goto no_bitmap;
 
@@ -2320,20 +2384,20 @@ static void locate_bitmap1(struct supertype *st, int fd)
 	}
 	sb = st->sb;
 
-	offset = __le64_to_cpu(sb->super_offset);
-	offset += (int32_t) __le32_to_cpu(sb->bitmap_offset);
+	offset = bitmap_offset1(sb);
 	if (mustfree)
 		free(sb);
-	lseek64(fd, offset<<9, 0);
+	lseek64(fd, offset, 0);
 }
 
+#define BITMAP_CHUNK (1024*1024)
 static int write_bitmap1(struct supertype *st, int fd, enum bitmap_update update)
 {
 	struct mdp_superblock_1 *sb = st->sb;
 	bitmap_super_t *bms = (bitmap_super_t*)(((char*)sb)+MAX_SB_SIZE);
 	int rv = 0;
 	void *buf;
-	int towrite, n;
+	int towrite, n, bufsize;
 	struct align_fd afd;
 	unsigned int i = 0;
 	unsigned long long total_bm_space, bm_space_per_node;
@@ -2373,44 +2437,43 @@ static int write_bitmap1(struct supertype *st, int fd, enum bitmap_update update
 		break;
 	}
 
-	init_afd(&afd, fd);
-
-	locate_bitmap1(st, fd);
-
-	if (posix_memalign(&buf, 4096, 4096))
+	/* Write the bitmap in chunks of up to BITMAP_CHUNK, straight from
+	 * the aligned buffer, and sync once at the end.
+	 */
+	towrite = calc_bitmap_size(bms, 4096);
+	bufsize = towrite < BITMAP_CHUNK ? towrite : BITMAP_CHUNK;
+	if (posix_memalign(&buf, 4096, bufsize))
 		return -ENOMEM;
 
+	init_afd(&afd, fd, bitmap_offset1(sb));
+
 	do {
 		/* Only the bitmap[0] should resync
 		 * whole device on initial assembly
 		 */
-		if (i)
-			memset(buf, 0x00, 4096);
-		else
-			memset(buf, 0xff, 4096);
+		int fill = i ? 0x00 : 0xff;
+
+		memset(buf, fill, bufsize);
 		memcpy(buf, (char *)bms, sizeof(bitmap_super_t));
 
 		towrite = calc_bitmap_size(bms, 4096);
 		while (towrite > 0) {
 			n = towrite;
-			if (n > 4096)
-				n = 4096;
+			if (n > bufsize)
+				n = bufsize;
 			n = awrite(&afd, buf, n);
 			if (n > 0)
 				towrite -= n;
 			else
 				break;
-			if (i)
-				memset(buf, 0x00, 4096);
-			else
-				memset(buf, 0xff, 4096);
+			memset(buf, fill, sizeof(bitmap_super_t));
 		}
-		fsync(fd);
 		if (towrite) {
 			rv = -2;
 			break;
 		}
 	} while (++i < __le32_to_cpu(bms->nodes));
+	fsync(fd);
 
 	free(buf);
 	return rv;
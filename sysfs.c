@@ -29,7 +29,16 @@
 
 int load_sys(char *path, char *buf)
 {
-	int fd = open(path, O_RDONLY);
+	return load_sys_at(AT_FDCWD, path, buf);
+}
+
+int load_sys_at(int dirfd, char *path, char *buf)
+{
+	/* Read a sysfs attribute of at most 1023 bytes into 'buf',
+	 * stripping any trailing newline.  'path' is relative to
+	 * 'dirfd' unless it is absolute.
+	 */
+	int fd = openat(dirfd, path, O_RDONLY|O_CLOEXEC);
 	int n;
 	if (fd < 0)
 		return -1;
@@ -59,10 +68,10 @@ void sysfs_free(struct mdinfo *sra)
 
 int sysfs_open(char *devnm, char *devname, char *attr)
 {
-	char fname[50];
+	char fname[PATH_MAX];
 	int fd;
 
-	sprintf(fname, "/sys/block/%s/md/", devnm);
+	sprintf(fname, "%s/sys/block/%s/md/", sys_root(), devnm);
 	if (devname) {
 		strcat(fname, devname);
 		strcat(fname, "/");
@@ -96,14 +105,18 @@ void sysfs_init(struct mdinfo *mdi, int fd, char *devnm)
 
 struct mdinfo *sysfs_read(int fd, char *devnm, unsigned long options)
 {
+	/* All attributes are read relative to an fd on the array's
+	 * md/ directory, and those of each member relative to an fd
+	 * on its dev-XXX directory, so the path is only walked once
+	 * per directory rather than once per attribute.
+	 */
 	char fname[PATH_MAX];
 	char buf[PATH_MAX];
-	char *base;
-	char *dbase;
 	struct mdinfo *sra;
 	struct mdinfo *dev, **devp;
 	DIR *dir = NULL;
 	struct dirent *de;
+	int mdfd, dfd = -1;
 
 	sra = xcalloc(1, sizeof(*sra));
 	sysfs_init(sra, fd, devnm);
@@ -112,13 +125,14 @@ struct mdinfo *sysfs_read(int fd, char *devnm, unsigned long options)
 		return NULL;
 	}
 
-	sprintf(fname, "/sys/block/%s/md/", sra->sys_name);
-	base = fname + strlen(fname);
+	sprintf(fname, "%s/sys/block/%s/md", sys_root(), sra->sys_name);
+	mdfd = open(fname, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if (mdfd < 0)
+		goto abort;
 
 	sra->devs = NULL;
 	if (options & GET_VERSION) {
-		strcpy(base, "metadata_version");
-		if (load_sys(fname, buf))
+		if (load_sys_at(mdfd, "metadata_version", buf))
 			goto abort;
 		if (strncmp(buf, "none", 4) == 0) {
 			sra->array.major_version =
@@ -136,54 +150,46 @@ struct mdinfo *sysfs_read(int fd, char *devnm, unsigned long options)
 		}
 	}
 	if (options & GET_LEVEL) {
-		strcpy(base, "level");
-		if (load_sys(fname, buf))
+		if (load_sys_at(mdfd, "level", buf))
 			goto abort;
 		sra->array.level = map_name(pers, buf);
 	}
 	if (options & GET_LAYOUT) {
-		strcpy(base, "layout");
-		if (load_sys(fname, buf))
+		if (load_sys_at(mdfd, "layout", buf))
 			goto abort;
 		sra->array.layout = strtoul(buf, NULL, 0);
 	}
 	if (options & GET_DISKS) {
-		strcpy(base, "raid_disks");
-		if (load_sys(fname, buf))
+		if (load_sys_at(mdfd, "raid_disks", buf))
 			goto abort;
 		sra->array.raid_disks = strtoul(buf, NULL, 0);
 	}
 	if (options & GET_DEGRADED) {
-		strcpy(base, "degraded");
-		if (load_sys(fname, buf))
+		if (load_sys_at(mdfd, "degraded", buf))
 			goto abort;
 		sra->array.failed_disks = strtoul(buf, NULL, 0);
 	}
 	if (options & GET_COMPONENT) {
-		strcpy(base, "component_size");
-		if (load_sys(fname, buf))
+		if (load_sys_at(mdfd, "component_size", buf))
 			goto abort;
 		sra->component_size = strtoull(buf, NULL, 0);
 		/* sysfs reports "K", but we want sectors */
 		sra->component_size *= 2;
 	}
 	if (options & GET_CHUNK) {
-		strcpy(base, "chunk_size");
-		if (load_sys(fname, buf))
+		if (load_sys_at(mdfd, "chunk_size", buf))
 			goto abort;
 		sra->array.chunk_size = strtoul(buf, NULL, 0);
 	}
 	if (options & GET_CACHE) {
-		strcpy(base, "stripe_cache_size");
-		if (load_sys(fname, buf))
+		if (load_sys_at(mdfd, "stripe_cache_size", buf))
 			/* Probably level doesn't support it */
 			sra->cache_size = 0;
 		else
 			sra->cache_size = strtoul(buf, NULL, 0);
 	}
 	if (options & GET_MISMATCH) {
-		strcpy(base, "mismatch_cnt");
-		if (load_sys(fname, buf))
+		if (load_sys_at(mdfd, "mismatch_cnt", buf))
 			goto abort;
 		sra->mismatch_cnt = strtoul(buf, NULL, 0);
 	}
@@ -194,8 +200,7 @@ struct mdinfo *sysfs_read(int fd, char *devnm, unsigned long options)
 		unsigned long msec;
 		size_t len;
 
-		strcpy(base, "safe_mode_delay");
-		if (load_sys(fname, buf))
+		if (load_sys_at(mdfd, "safe_mode_delay", buf))
 			goto abort;
 
 		/* remove a period, and count digits after it */
@@ -217,8 +222,7 @@ struct mdinfo *sysfs_read(int fd, char *devnm, unsigned long options)
 		sra->safe_mode_delay = msec;
 	}
 	if (options & GET_BITMAP_LOCATION) {
-		strcpy(base, "bitmap/location");
-		if (load_sys(fname, buf))
+		if (load_sys_at(mdfd, "bitmap/location", buf))
 			goto abort;
 		if (strncmp(buf, "file", 4) == 0)
 			sra->bitmap_offset = 1;
@@ -230,12 +234,13 @@ struct mdinfo *sysfs_read(int fd, char *devnm, unsigned long options)
 			goto abort;
 	}
 
-	if (! (options & GET_DEVS))
+	if (! (options & GET_DEVS)) {
+		close(mdfd);
 		return sra;
+	}
 
 	/* Get all the devices as well */
-	*base = 0;
-	dir = opendir(fname);
+	dir = fdopendir(mdfd);
 	if (!dir)
 		goto abort;
 	sra->array.spare_disks = 0;
@@ -247,20 +252,21 @@ struct mdinfo *sysfs_read(int fd, char *devnm, unsigned long options)
 		if (de->d_ino == 0 ||
 		    strncmp(de->d_name, "dev-", 4) != 0)
 			continue;
-		strcpy(base, de->d_name);
-		dbase = base + strlen(base);
-		*dbase++ = '/';
+		if (dfd >= 0)
+			close(dfd);
+		dfd = openat(mdfd, de->d_name, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+		if (dfd < 0)
+			/* device went away */
+			continue;
 
 		dev = xmalloc(sizeof(*dev));
 
 		/* Always get slot, major, minor */
-		strcpy(dbase, "slot");
-		if (load_sys(fname, buf)) {
+		if (load_sys_at(dfd, "slot", buf)) {
 			/* hmm... unable to read 'slot' maybe the device
 			 * is going away?
 			 */
-			strcpy(dbase, "block");
-			if (readlink(fname, buf, sizeof(buf)) < 0 &&
+			if (readlinkat(dfd, "block", buf, sizeof(buf)) < 0 &&
 			    errno != ENAMETOOLONG) {
 				/* ...yup device is gone */
 				free(dev);
@@ -279,8 +285,7 @@ struct mdinfo *sysfs_read(int fd, char *devnm, unsigned long options)
 		dev->disk.raid_disk = strtoul(buf, &ep, 10);
 		if (*ep) dev->disk.raid_disk = -1;
 
-		strcpy(dbase, "block/dev");
-		if (load_sys(fname, buf)) {
+		if (load_sys_at(dfd, "block/dev", buf)) {
 			/* assume this is a stale reference to a hot
 			 * removed device
 			 */
@@ -291,8 +296,7 @@ struct mdinfo *sysfs_read(int fd, char *devnm, unsigned long options)
 		sscanf(buf, "%d:%d", &dev->disk.major, &dev->disk.minor);
 
 		/* special case check for block devices that can go 'offline' */
-		strcpy(dbase, "block/device/state");
-		if (load_sys(fname, buf) == 0 &&
+		if (load_sys_at(dfd, "block/device/state", buf) == 0 &&
 		    strncmp(buf, "offline", 7) == 0) {
 			free(dev);
 			continue;
@@ -304,26 +308,22 @@ struct mdinfo *sysfs_read(int fd, char *devnm, unsigned long options)
 		dev->next = NULL;
 
 		if (options & GET_OFFSET) {
-			strcpy(dbase, "offset");
-			if (load_sys(fname, buf))
+			if (load_sys_at(dfd, "offset", buf))
 				goto abort;
 			dev->data_offset = strtoull(buf, NULL, 0);
-			strcpy(dbase, "new_offset");
-			if (load_sys(fname, buf) == 0)
+			if (load_sys_at(dfd, "new_offset", buf) == 0)
 				dev->new_data_offset = strtoull(buf, NULL, 0);
 			else
 				dev->new_data_offset = dev->data_offset;
 		}
 		if (options & GET_SIZE) {
-			strcpy(dbase, "size");
-			if (load_sys(fname, buf))
+			if (load_sys_at(dfd, "size", buf))
 				goto abort;
 			dev->component_size = strtoull(buf, NULL, 0) * 2;
 		}
 		if (options & GET_STATE) {
 			dev->disk.state = 0;
-			strcpy(dbase, "state");
-			if (load_sys(fname, buf))
+			if (load_sys_at(dfd, "state", buf))
 				goto abort;
 			if (strstr(buf, "in_sync"))
 				dev->disk.state |= (1<<MD_DISK_SYNC);
@@ -333,18 +333,23 @@ struct mdinfo *sysfs_read(int fd, char *devnm, unsigned long options)
 				sra->array.spare_disks++;
 		}
 		if (options & GET_ERROR) {
-			strcpy(buf, "errors");
-			if (load_sys(fname, buf))
+			if (load_sys_at(dfd, "errors", buf))
 				goto abort;
 			dev->errors = strtoul(buf, NULL, 0);
 		}
 	}
+	if (dfd >= 0)
+		close(dfd);
 	closedir(dir);
 	return sra;
 
  abort:
+	if (dfd >= 0)
+		close(dfd);
 	if (dir)
 		closedir(dir);
+	else if (mdfd >= 0)
+		close(mdfd);
 	sysfs_free(sra);
 	return NULL;
 }
@@ -384,15 +389,15 @@ unsigned long long get_component_size(int fd)
 	 * This returns in units of sectors.
 	 */
 	struct stat stb;
-	char fname[50];
+	char fname[PATH_MAX];
 	int n;
 	if (fstat(fd, &stb)) return 0;
 	if (major(stb.st_rdev) != (unsigned)get_mdp_major())
-		sprintf(fname, "/sys/block/md%d/md/component_size",
-			(int)minor(stb.st_rdev));
+		sprintf(fname, "%s/sys/block/md%d/md/component_size",
+			sys_root(), (int)minor(stb.st_rdev));
 	else
-		sprintf(fname, "/sys/block/md_d%d/md/component_size",
-			(int)minor(stb.st_rdev)>>MdpMinorShift);
+		sprintf(fname, "%s/sys/block/md_d%d/md/component_size",
+			sys_root(), (int)minor(stb.st_rdev)>>MdpMinorShift);
 	fd = open(fname, O_RDONLY);
 	if (fd < 0)
 		return 0;
@@ -404,25 +409,128 @@ unsigned long long get_component_size(int fd)
 	return strtoull(fname, NULL, 10) * 2;
 }
 
+/* Attributes such as sync_completed, suspend_lo/hi and reshape_position
+ * are read or written many times while a reshape or check is running.
+ * Rather than looking up and opening the path each time, the last
+ * few attributes used are kept open and accessed with pread/pwrite
+ * at offset 0, which makes sysfs regenerate or store the value.
+ *
+ * 'struct mdinfo' is copied and freed all over the place, so the
+ * cache is keyed by name rather than attached to it.  mdmon uses
+ * sysfs from two threads, so each thread gets its own cache.
+ *
+ * When an array is stopped or a device removed the kernel returns
+ * ENODEV for any open attribute, so a cached fd that fails that way
+ * is simply re-opened once.  sysfs_uncache() closes them eagerly.
+ */
+#define SYSFS_FD_CACHE	16
+static __thread struct sysfs_cached_fd {
+	char	name[64];	/* "md0/dev-sda/state" or "md0//sync_action" */
+	int	fd;
+	int	mode;		/* O_RDWR, O_RDONLY or O_WRONLY */
+	unsigned long used;	/* 0 if slot is free, else for LRU */
+} sysfs_fds[SYSFS_FD_CACHE];
+static __thread unsigned long sysfs_fd_clock;
+
+static void sysfs_cache_close(struct sysfs_cached_fd *c)
+{
+	if (c->used)
+		close(c->fd);
+	c->used = 0;
+	c->name[0] = 0;
+}
+
+static int sysfs_cache_fd(struct mdinfo *sra, struct mdinfo *dev,
+			  char *name, int mode, int reopen)
+{
+	/* Return an fd for the attribute that is open for at
+	 * least 'mode' (O_RDONLY or O_WRONLY).  It remains owned
+	 * by the cache.  If 'reopen', any cached fd is discarded.
+	 */
+	char key[sizeof(sysfs_fds[0].name)];
+	char fname[PATH_MAX];
+	struct sysfs_cached_fd *c, *victim = NULL;
+	int i, fd;
+
+	if (snprintf(key, sizeof(key), "%s/%s/%s", sra->sys_name,
+		     dev ? dev->sys_name : "", name) >= (int)sizeof(key))
+		return -1;
+	for (i = 0; i < SYSFS_FD_CACHE; i++) {
+		c = &sysfs_fds[i];
+		if (c->used && strcmp(c->name, key) == 0) {
+			if (reopen || (c->mode != O_RDWR && c->mode != mode)) {
+				sysfs_cache_close(c);
+				victim = c;
+				break;
+			}
+			c->used = ++sysfs_fd_clock;
+			return c->fd;
+		}
+		if (!victim || c->used < victim->used)
+			victim = c;
+	}
+
+	sprintf(fname, "%s/sys/block/%s/md/%s/%s", sys_root(),
+		sra->sys_name, dev ? dev->sys_name : "", name);
+	fd = open(fname, O_RDWR|O_CLOEXEC);
+	if (fd >= 0)
+		mode = O_RDWR;
+	else
+		fd = open(fname, mode|O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	sysfs_cache_close(victim);
+	strcpy(victim->name, key);
+	victim->fd = fd;
+	victim->mode = mode;
+	victim->used = ++sysfs_fd_clock;
+	return fd;
+}
+
+void sysfs_uncache(char *devnm, char *devname)
+{
+	/* Close cached attributes of array 'devnm', or only of
+	 * its member 'devname' if that is not NULL.
+	 */
+	int l = strlen(devnm);
+	int i;
+
+	for (i = 0; i < SYSFS_FD_CACHE; i++) {
+		struct sysfs_cached_fd *c = &sysfs_fds[i];
+		if (!c->used ||
+		    strncmp(c->name, devnm, l) != 0 || c->name[l] != '/')
+			continue;
+		if (devname &&
+		    (strncmp(c->name + l + 1, devname, strlen(devname)) != 0 ||
+		     c->name[l + 1 + strlen(devname)] != '/'))
+			continue;
+		sysfs_cache_close(c);
+	}
+}
+
 int sysfs_set_str(struct mdinfo *sra, struct mdinfo *dev,
 		  char *name, char *val)
 {
-	char fname[50];
 	unsigned int n;
 	int fd;
+	int reopen = 0;
 
-	sprintf(fname, "/sys/block/%s/md/%s/%s",
-		sra->sys_name, dev?dev->sys_name:"", name);
-	fd = open(fname, O_WRONLY);
+again:
+	fd = sysfs_cache_fd(sra, dev, name, O_WRONLY, reopen);
 	if (fd < 0)
 		return -1;
-	n = write(fd, val, strlen(val));
-	close(fd);
+	n = pwrite(fd, val, strlen(val), 0);
+	if ((int)n < 0 && errno == ENODEV && !reopen++)
+		goto again;
 	if (n != strlen(val)) {
-		dprintf("failed to write '%s' to '%s' (%s)\n",
-			val, fname, strerror(errno));
+		dprintf("failed to write '%s' to '%s/%s/%s' (%s)\n",
+			val, sra->sys_name, dev?dev->sys_name:"", name,
+			strerror(errno));
 		return -1;
 	}
+	if (dev && strcmp(name, "state") == 0 && strcmp(val, "remove") == 0)
+		sysfs_uncache(sra->sys_name, dev->sys_name);
 	return 0;
 }
 
@@ -444,11 +552,11 @@ int sysfs_set_num_signed(struct mdinfo *sra, struct mdinfo *dev,
 
 int sysfs_uevent(struct mdinfo *sra, char *event)
 {
-	char fname[50];
+	char fname[PATH_MAX];
 	int n;
 	int fd;
 
-	sprintf(fname, "/sys/block/%s/uevent",
+	sprintf(fname, "%s/sys/block/%s/uevent", sys_root(),
 		sra->sys_name);
 	fd = open(fname, O_WRONLY);
 	if (fd < 0)
@@ -465,10 +573,10 @@ int sysfs_uevent(struct mdinfo *sra, char *event)
 
 int sysfs_attribute_available(struct mdinfo *sra, struct mdinfo *dev, char *name)
 {
-	char fname[50];
+	char fname[PATH_MAX];
 	struct stat st;
 
-	sprintf(fname, "/sys/block/%s/md/%s/%s",
+	sprintf(fname, "%s/sys/block/%s/md/%s/%s", sys_root(),
 		sra->sys_name, dev?dev->sys_name:"", name);
 
 	return stat(fname, &st) == 0;
@@ -477,10 +585,10 @@ int sysfs_attribute_available(struct mdinfo *sra, struct mdinfo *dev, char *name
 int sysfs_get_fd(struct mdinfo *sra, struct mdinfo *dev,
 		       char *name)
 {
-	char fname[50];
+	char fname[PATH_MAX];
 	int fd;
 
-	sprintf(fname, "/sys/block/%s/md/%s/%s",
+	sprintf(fname, "%s/sys/block/%s/md/%s/%s", sys_root(),
 		sra->sys_name, dev?dev->sys_name:"", name);
 	fd = open(fname, O_RDWR);
 	if (fd < 0)
@@ -494,8 +602,7 @@ int sysfs_fd_get_ll(int fd, unsigned long long *val)
 	int n;
 	char *ep;
 
-	lseek(fd, 0, 0);
-	n = read(fd, buf, sizeof(buf));
+	n = pread(fd, buf, sizeof(buf), 0);
 	if (n <= 0 || n == sizeof(buf))
 		return -2;
 	buf[n] = 0;
@@ -510,12 +617,16 @@ int sysfs_get_ll(struct mdinfo *sra, struct mdinfo *dev,
 {
 	int n;
 	int fd;
+	int reopen = 0;
 
-	fd = sysfs_get_fd(sra, dev, name);
+again:
+	fd = sysfs_cache_fd(sra, dev, name, O_RDONLY, reopen);
 	if (fd < 0)
 		return -1;
+	errno = 0;
 	n = sysfs_fd_get_ll(fd, val);
-	close(fd);
+	if (n == -2 && errno == ENODEV && !reopen++)
+		goto again;
 	return n;
 }
 
@@ -530,8 +641,7 @@ int sysfs_fd_get_two(int fd, unsigned long long *v1, unsigned long long *v2)
 	int n;
 	char *ep, *ep2;
 
-	lseek(fd, 0, 0);
-	n = read(fd, buf, sizeof(buf));
+	n = pread(fd, buf, sizeof(buf), 0);
 	if (n <= 0 || n == sizeof(buf))
 		return -2;
 	buf[n] = 0;
@@ -553,12 +663,16 @@ int sysfs_get_two(struct mdinfo *sra, struct mdinfo *dev,
 {
 	int n;
 	int fd;
+	int reopen = 0;
 
-	fd = sysfs_get_fd(sra, dev, name);
+again:
+	fd = sysfs_cache_fd(sra, dev, name, O_RDONLY, reopen);
 	if (fd < 0)
 		return -1;
+	errno = 0;
 	n = sysfs_fd_get_two(fd, v1, v2);
-	close(fd);
+	if (n == -2 && errno == ENODEV && !reopen++)
+		goto again;
 	return n;
 }
 
@@ -566,8 +680,7 @@ int sysfs_fd_get_str(int fd, char *val, int size)
 {
 	int n;
 
-	lseek(fd, 0, 0);
-	n = read(fd, val, size);
+	n = pread(fd, val, size, 0);
 	if (n <= 0 || n == size)
 		return -1;
 	val[n] = 0;
@@ -579,12 +692,16 @@ int sysfs_get_str(struct mdinfo *sra, struct mdinfo *dev,
 {
 	int n;
 	int fd;
+	int reopen = 0;
 
-	fd = sysfs_get_fd(sra, dev, name);
+again:
+	fd = sysfs_cache_fd(sra, dev, name, O_RDONLY, reopen);
 	if (fd < 0)
 		return -1;
+	errno = 0;
 	n = sysfs_fd_get_str(fd, val, size);
-	close(fd);
+	if (n < 0 && errno == ENODEV && !reopen++)
+		goto again;
 	return n;
 }
 
@@ -719,7 +836,7 @@ int sysfs_disk_to_sg(int fd)
 	 * scsi_generic interface
 	 */
 	struct stat st;
-	char path[256];
+	char path[PATH_MAX];
 	char sg_path[256];
 	char sg_major_minor[10];
 	char *c;
@@ -730,8 +847,8 @@ int sysfs_disk_to_sg(int fd)
 	if (fstat(fd, &st))
 		return -1;
 
-	snprintf(path, sizeof(path), "/sys/dev/block/%d:%d/device",
-		 major(st.st_rdev), minor(st.st_rdev));
+	snprintf(path, sizeof(path), "%s/sys/dev/block/%d:%d/device",
+		 sys_root(), major(st.st_rdev), minor(st.st_rdev));
 
 	dir = opendir(path);
 	if (!dir)
@@ -790,8 +907,8 @@ int sysfs_disk_to_scsi_id(int fd, __u32 *id)
 	if (fstat(fd, &st))
 		return 1;
 
-	snprintf(path, sizeof(path), "/sys/dev/block/%d:%d/device/scsi_device",
-		 major(st.st_rdev), minor(st.st_rdev));
+	snprintf(path, sizeof(path), "%s/sys/dev/block/%d:%d/device/scsi_device",
+		 sys_root(), major(st.st_rdev), minor(st.st_rdev));
 
 	dir = opendir(path);
 	if (!dir)
@@ -830,10 +947,10 @@ int sysfs_unique_holder(char *devnm, long rdev)
 	 */
 	DIR *dir;
 	struct dirent *de;
-	char dirname[100];
-	char l;
+	char dirname[PATH_MAX];
+	int l;
 	int ret = 0;
-	sprintf(dirname, "/sys/dev/block/%d:%d/holders",
+	sprintf(dirname, "%s/sys/dev/block/%d:%d/holders", sys_root(),
 		major(rdev), minor(rdev));
 	dir = opendir(dirname);
 	if (!dir)
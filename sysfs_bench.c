@@ -0,0 +1,224 @@
+/*
+ * sysfs_bench - measure mdstat/sysfs parsing cost against a
+ * synthetic tree of many arrays.  Part of:
+ * mdadm - manage Linux "md" devices aka RAID arrays.
+ *
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Usage: sysfs_bench [-n] DIR ARRAYS MEMBERS [POLLS]
+ *
+ * A tree holding DIR/proc/mdstat and DIR/sys/block/mdN/... is written
+ * for ARRAYS raid5 arrays of MEMBERS devices each (unless -n is given,
+ * in which case an existing tree is reused).  MDADM_SYS_ROOT is then
+ * pointed at DIR and each poll does what "mdadm --monitor" does
+ * without touching real devices:  mdstat_read() followed by a
+ * sysfs_read() of every array and its members.
+ * CPU time per poll and peak memory use are reported.
+ */
+
+#include	"mdadm.h"
+#include	<stdarg.h>
+#include	<sys/resource.h>
+
+const char Name[] = "sysfs_bench";
+
+static void put(char *dir, char *name, char *fmt, ...)
+{
+	char path[PATH_MAX];
+	va_list ap;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	f = fopen(path, "w");
+	if (!f) {
+		perror(path);
+		exit(1);
+	}
+	va_start(ap, fmt);
+	vfprintf(f, fmt, ap);
+	va_end(ap);
+	fclose(f);
+}
+
+static void mkdir_p(char *dir, char *fmt, ...)
+{
+	char path[PATH_MAX];
+	char *p;
+	int n;
+	va_list ap;
+
+	n = snprintf(path, sizeof(path), "%s/", dir);
+	va_start(ap, fmt);
+	vsnprintf(path + n, sizeof(path) - n, fmt, ap);
+	va_end(ap);
+	for (p = path + 1; *p; p++)
+		if (*p == '/') {
+			*p = 0;
+			mkdir(path, 0755);
+			*p = '/';
+		}
+	if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+		perror(path);
+		exit(1);
+	}
+}
+
+static void generate(char *root, int arrays, int members)
+{
+	char md[PATH_MAX];
+	char dev[PATH_MAX + 32];
+	FILE *mdstat;
+	int a, m;
+
+	mkdir_p(root, "proc");
+	snprintf(md, sizeof(md), "%s/proc/mdstat", root);
+	mdstat = fopen(md, "w");
+	if (!mdstat) {
+		perror(md);
+		exit(1);
+	}
+	fprintf(mdstat, "Personalities : [raid6] [raid5] [raid4]\n");
+
+	for (a = 0; a < arrays; a++) {
+		snprintf(md, sizeof(md), "%s/sys/block/md%d", root, a);
+		mkdir_p(root, "sys/block/md%d/md", a);
+		put(md, "dev", "%d:%d\n", MD_MAJOR, a);
+		put(md, "uevent", "\n");
+		strcat(md, "/md");
+		put(md, "metadata_version", "1.2\n");
+		put(md, "level", "raid5\n");
+		put(md, "layout", "2\n");
+		put(md, "raid_disks", "%d\n", members);
+		put(md, "degraded", "0\n");
+		put(md, "component_size", "1048576\n");
+		put(md, "chunk_size", "524288\n");
+		put(md, "stripe_cache_size", "256\n");
+		put(md, "mismatch_cnt", "0\n");
+		put(md, "safe_mode_delay", "0.203\n");
+		put(md, "array_state", "clean\n");
+		put(md, "sync_action", "idle\n");
+		put(md, "sync_completed", "none\n");
+		put(md, "sync_speed", "none\n");
+		mkdir_p(md, "bitmap");
+		put(md, "bitmap/location", "none\n");
+
+		fprintf(mdstat, "md%d : active raid5", a);
+		for (m = members - 1; m >= 0; m--) {
+			snprintf(dev, sizeof(dev), "%s/dev-sim%dd%d", md, a, m);
+			mkdir_p(dev, "block/device");
+			put(dev, "block/dev", "%d:%d\n", 240 + a / 1024,
+			    (a % 1024) * members + m);
+			put(dev, "block/device/state", "running\n");
+			put(dev, "slot", "%d\n", m);
+			put(dev, "offset", "2048\n");
+			put(dev, "new_offset", "2048\n");
+			put(dev, "size", "1048576\n");
+			put(dev, "state", "in_sync\n");
+			put(dev, "errors", "0\n");
+			fprintf(mdstat, " sim%dd%d[%d]", a, m, m);
+		}
+		fprintf(mdstat,
+			"\n      %llu blocks super 1.2 level 5, 512k chunk, algorithm 2 [%d/%d] [",
+			1048576ULL * (members - 1), members, members);
+		for (m = 0; m < members; m++)
+			fputc('U', mdstat);
+		fprintf(mdstat, "]\n\n");
+	}
+	fprintf(mdstat, "unused devices: <none>\n");
+	fclose(mdstat);
+}
+
+static double cpu_ms(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000.0 +
+		(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000.0;
+}
+
+int main(int argc, char *argv[])
+{
+	int generate_tree = 1;
+	int arrays, members, polls = 10;
+	double t0, mdstat_ms = 0, sysfs_ms = 0;
+	struct rusage ru;
+	int p, found = 0, devs = 0;
+
+	if (argc > 1 && strcmp(argv[1], "-n") == 0) {
+		generate_tree = 0;
+		argv++;
+		argc--;
+	}
+	if (argc < 4 || argc > 5) {
+		fprintf(stderr, "Usage: %s [-n] dir arrays members [polls]\n",
+			Name);
+		exit(2);
+	}
+	arrays = atoi(argv[2]);
+	members = atoi(argv[3]);
+	if (argc == 5)
+		polls = atoi(argv[4]);
+	if (arrays < 1 || members < 1 || polls < 1) {
+		fprintf(stderr, "%s: arrays, members and polls must be positive\n",
+			Name);
+		exit(2);
+	}
+
+	if (generate_tree) {
+		mkdir_p(argv[1], "");
+		generate(argv[1], arrays, members);
+	}
+	setenv("MDADM_SYS_ROOT", argv[1], 1);
+
+	for (p = 0; p < polls; p++) {
+		struct mdstat_ent *ms, *e;
+
+		t0 = cpu_ms();
+		ms = mdstat_read(0, 0);
+		mdstat_ms += cpu_ms() - t0;
+
+		t0 = cpu_ms();
+		found = devs = 0;
+		for (e = ms; e; e = e->next) {
+			struct mdinfo *sra, *d;
+
+			sra = sysfs_read(-1, e->devnm,
+					 GET_VERSION|GET_LEVEL|GET_DISKS|
+					 GET_DEGRADED|GET_MISMATCH|
+					 GET_DEVS|GET_STATE|GET_ERROR);
+			if (!sra)
+				continue;
+			found++;
+			for (d = sra->devs; d; d = d->next)
+				devs++;
+			sysfs_free(sra);
+		}
+		sysfs_ms += cpu_ms() - t0;
+		free_mdstat(ms);
+	}
+	getrusage(RUSAGE_SELF, &ru);
+
+	printf("%d arrays, %d member devices, %d polls\n", found, devs, polls);
+	printf("mdstat_read: %8.3f ms cpu per poll\n", mdstat_ms / polls);
+	printf("sysfs_read:  %8.3f ms cpu per poll\n", sysfs_ms / polls);
+	printf("total:       %8.3f ms cpu per poll\n",
+	       (mdstat_ms + sysfs_ms) / polls);
+	printf("max rss:     %8ld KiB\n", ru.ru_maxrss);
+	return found == arrays ? 0 : 1;
+}
@@ -0,0 +1,194 @@
+/* mdadm - manage Linux "md" devices aka RAID arrays.
+ *
+ * Copyright (C) 2001-2009 Neil Brown <neilb@suse.de>
+ *
+ *
+ *    This program is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    This program is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with this program; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ *    Author: Neil Brown
+ *    Email: <neilb@suse.de>
+ */
+
+/*
+ * Timing trace for finding out where assembly or creation spends its
+ * time.  Interesting phases are bracketed with
+ *
+ *	unsigned long long t = trace_start();
+ *	...
+ *	trace_end(t, "phase", detail);
+ *
+ * which costs a test of trace_enabled unless --trace-timing (or
+ * MDADM_TRACE_TIMING in the environment) was given.  Events are kept in
+ * memory and reported at exit: a summary per phase on stderr, or, if a
+ * file was named, all events in Chrome's trace-event JSON format, which
+ * chrome://tracing and Perfetto can display.
+ */
+
+#include	"mdadm.h"
+#include	<time.h>
+#include	<sys/syscall.h>
+#if defined(USE_PTHREADS) && !defined(MDASSEMBLE)
+#include	<pthread.h>
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define trace_lock()	pthread_mutex_lock(&trace_mutex)
+#define trace_unlock()	pthread_mutex_unlock(&trace_mutex)
+#else
+#define trace_lock()	do { } while (0)
+#define trace_unlock()	do { } while (0)
+#endif
+
+struct trace_event {
+	const char *phase;
+	char *detail;
+	unsigned long long start, dur;	/* nanoseconds */
+	long tid;
+};
+
+int trace_enabled = 0;
+static char *trace_file;
+static pid_t trace_pid;
+static unsigned long long trace_epoch;
+static struct trace_event *events;
+static int nevents, maxevents;
+
+unsigned long long trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void __trace_end(unsigned long long start, const char *phase,
+		 const char *detail)
+{
+	unsigned long long now = trace_now();
+	struct trace_event *ev;
+
+	trace_lock();
+	if (nevents == maxevents) {
+		maxevents = maxevents ? maxevents * 2 : 256;
+		events = xrealloc(events, maxevents * sizeof(*events));
+	}
+	ev = &events[nevents++];
+	ev->phase = phase;
+	ev->detail = detail ? xstrdup(detail) : NULL;
+	ev->start = start;
+	ev->dur = now - start;
+	ev->tid = syscall(SYS_gettid);
+	trace_unlock();
+}
+
+static void json_string(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(f, "\\%c", *s);
+		else if ((unsigned char)*s < ' ')
+			fprintf(f, "\\u%04x", *s);
+		else
+			fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+static void trace_write_json(FILE *f)
+{
+	int i;
+
+	fprintf(f, "{\"traceEvents\":[\n");
+	for (i = 0; i < nevents; i++) {
+		struct trace_event *ev = &events[i];
+
+		fprintf(f, "{\"name\":");
+		json_string(f, ev->phase);
+		fprintf(f, ",\"cat\":\"mdadm\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%ld",
+			(ev->start - trace_epoch) / 1000.0, ev->dur / 1000.0,
+			(int)trace_pid, ev->tid);
+		if (ev->detail) {
+			fprintf(f, ",\"args\":{\"detail\":");
+			json_string(f, ev->detail);
+			fprintf(f, "}");
+		}
+		fprintf(f, "}%s\n", i + 1 < nevents ? "," : "");
+	}
+	fprintf(f, "],\"displayTimeUnit\":\"ms\"}\n");
+}
+
+static void trace_write_summary(FILE *f)
+{
+	/* One line per phase, in order of first appearance */
+	char *done = xcalloc(nevents ? nevents : 1, 1);
+	int i, j;
+
+	fprintf(f, "%s: timing trace, %.3f ms in total\n", Name,
+		(trace_now() - trace_epoch) / 1e6);
+	fprintf(f, "  %-20s %6s %12s %12s\n", "phase", "count",
+		"total ms", "max ms");
+	for (i = 0; i < nevents; i++) {
+		unsigned long long total = 0, max = 0;
+		int cnt = 0;
+
+		if (done[i])
+			continue;
+		for (j = i; j < nevents; j++) {
+			if (strcmp(events[j].phase, events[i].phase) != 0)
+				continue;
+			done[j] = 1;
+			cnt++;
+			total += events[j].dur;
+			if (events[j].dur > max)
+				max = events[j].dur;
+		}
+		fprintf(f, "  %-20s %6d %12.3f %12.3f\n", events[i].phase,
+			cnt, total / 1e6, max / 1e6);
+	}
+	free(done);
+}
+
+static void trace_report(void)
+{
+	FILE *f;
+
+	/* Children forked by Grow and friends inherit the events,
+	 * only report from the process that asked for them.
+	 */
+	if (getpid() != trace_pid)
+		return;
+	if (!trace_file) {
+		trace_write_summary(stderr);
+		return;
+	}
+	f = fopen(trace_file, "w");
+	if (!f) {
+		pr_err("cannot write timing trace to %s: %s\n",
+		       trace_file, strerror(errno));
+		return;
+	}
+	trace_write_json(f);
+	fclose(f);
+}
+
+void trace_init(char *file)
+{
+	if (trace_enabled)
+		return;
+	trace_enabled = 1;
+	trace_file = file && *file ? file : NULL;
+	trace_pid = getpid();
+	trace_epoch = trace_now();
+	atexit(trace_report);
+}
@@ -25,17 +25,23 @@
 #include	"mdadm.h"
 #include	"md_p.h"
 #include	<sys/poll.h>
+#include	<sys/inotify.h>
 #include	<sys/socket.h>
 #include	<sys/utsname.h>
 #include	<sys/wait.h>
 #include	<sys/un.h>
 #include	<sys/resource.h>
 #include	<sys/vfs.h>
+#include	<sys/syscall.h>
 #include	<linux/magic.h>
+#include	<linux/aio_abi.h>
 #include	<ctype.h>
 #include	<dirent.h>
 #include	<signal.h>
 #include	<dlfcn.h>
+#if defined(USE_PTHREADS) && !defined(MDASSEMBLE)
+#include	<pthread.h>
+#endif
 
 
 /*
@@ -929,12 +935,12 @@ int devnm2devid(char *devnm)
 	/* First look in /sys/block/$DEVNM/dev for %d:%d
 	 * If that fails, try parsing out a number
 	 */
-	char path[100];
+	char path[PATH_MAX];
 	char *ep;
 	int fd;
 	int mjr,mnr;
 
-	sprintf(path, "/sys/block/%s/dev", devnm);
+	sprintf(path, "%s/sys/block/%s/dev", sys_root(), devnm);
 	fd = open(path, O_RDONLY);
 	if (fd >= 0) {
 		char buf[20];
@@ -1034,6 +1040,7 @@ int dev_open(char *dev, int flags)
 	char devname[32];
 	int major;
 	int minor;
+	unsigned long long t = trace_start();
 
 	if (!dev) return -1;
 	flags |= O_DIRECT;
@@ -1056,6 +1063,7 @@ int dev_open(char *dev, int flags)
 		}
 	} else
 		fd = open(dev, flags);
+	trace_end(t, "dev_open", dev);
 	return fd;
 }
 
@@ -1114,28 +1122,118 @@ int same_dev(char *one, char *two)
 	return st1.st_rdev == st2.st_rdev;
 }
 
-void wait_for(char *dev, int fd)
+#define WAIT_FOR_MS 5000
+
+static int dev_is(char *dev, dev_t rdev)
 {
-	int i;
+	struct stat stb;
+
+	return stat(dev, &stb) == 0 &&
+		(stb.st_mode & S_IFMT) == S_IFBLK &&
+		stb.st_rdev == rdev;
+}
+
+/* Watch the directory that 'dev' will appear in, or the nearest
+ * ancestor that already exists if udev still has to create it
+ * (e.g. /dev/md).  Returns the length of the directory watched.
+ * The new watch is added before the old one goes, so that nothing
+ * created in between is missed.
+ */
+static int watch_dev_dir(int ifd, char *dev, int *wdp)
+{
+	char dir[PATH_MAX];
+	char *sl;
+	int wd;
+
+	if (strlen(dev) >= sizeof(dir))
+		return -1;
+	strcpy(dir, dev);
+	while ((sl = strrchr(dir, '/')) != NULL && sl > dir) {
+		*sl = 0;
+		wd = inotify_add_watch(ifd, dir,
+				       IN_CREATE | IN_MOVED_TO | IN_ATTRIB);
+		if (wd < 0)
+			continue;
+		/* the same directory gives the same wd */
+		if (*wdp >= 0 && *wdp != wd)
+			inotify_rm_watch(ifd, *wdp);
+		*wdp = wd;
+		return sl - dir;
+	}
+	return -1;
+}
+
+static void __wait_for(char *dev, int fd)
+{
+	/* Wait up to WAIT_FOR_MS for udev to create 'dev' for the
+	 * array open on 'fd'.  Rather than polling, watch /dev (or
+	 * /dev/md) with inotify and check again whenever something
+	 * is added there.
+	 */
 	struct stat stb_want;
+	struct timeval start, now;
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	int ifd, wd = -1, watched;
 	long delay = 1000;
+	int i;
 
 	if (fstat(fd, &stb_want) != 0 ||
 	    (stb_want.st_mode & S_IFMT) != S_IFBLK)
 		return;
+	if (dev_is(dev, stb_want.st_rdev))
+		return;
 
+	ifd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	if (ifd < 0)
+		goto poll_loop;
+	watched = watch_dev_dir(ifd, dev, &wd);
+	if (watched < 0) {
+		close(ifd);
+		goto poll_loop;
+	}
+	gettimeofday(&start, NULL);
+	while (1) {
+		struct pollfd pfd = { .fd = ifd, .events = POLLIN };
+		long left;
+
+		/* Checked after the watch is in place so nothing is missed */
+		if (dev_is(dev, stb_want.st_rdev))
+			break;
+		gettimeofday(&now, NULL);
+		left = WAIT_FOR_MS - ((now.tv_sec - start.tv_sec) * 1000 +
+				      (now.tv_usec - start.tv_usec) / 1000);
+		if (left <= 0 || poll(&pfd, 1, left) < 0) {
+			dprintf("timeout waiting for %s\n", dev);
+			break;
+		}
+		while (read(ifd, buf, sizeof(buf)) > 0)
+			;
+		/* The directory we wanted may have just been created */
+		if (dev[watched] == '/' && strchr(dev + watched + 1, '/'))
+			watched = watch_dev_dir(ifd, dev, &wd);
+		if (watched < 0)
+			break;
+	}
+	close(ifd);
+	return;
+
+poll_loop:
 	for (i = 0 ; i < 25 ; i++) {
-		struct stat stb;
-		if (stat(dev, &stb) == 0 &&
-		    (stb.st_mode & S_IFMT) == S_IFBLK &&
-		    (stb.st_rdev == stb_want.st_rdev))
+		if (dev_is(dev, stb_want.st_rdev))
 			return;
 		usleep(delay);
 		if (delay < 200000)
 			delay *= 2;
 	}
-	if (i == 25)
-		dprintf("timeout waiting for %s\n", dev);
+	dprintf("timeout waiting for %s\n", dev);
+}
+
+void wait_for(char *dev, int fd)
+{
+	unsigned long long t = trace_start();
+
+	__wait_for(dev, fd);
+	trace_end(t, "wait_for", dev);
 }
 
 struct superswitch *superlist[] =
@@ -1248,6 +1346,117 @@ struct supertype *dup_super(struct supertype *orig)
 	return st;
 }
 
+/* guess_super_type() asks every metadata handler in turn to look at
+ * a device, and between them they read the same few blocks at the
+ * start and end of the device many times over.  So while guessing, the
+ * head and tail of the device are read once into a probe window and
+ * handlers read through probe_read(), which serves anything that lies
+ * within the window from memory and falls back to read() otherwise.
+ */
+#define PROBE_HEAD	(64 * 1024)
+#define PROBE_TAIL	(128 * 1024)
+
+struct probe_window {
+	int fd;
+	char *head;
+	int head_len;
+	char *tail;
+	unsigned long long tail_start;
+	int tail_len;
+};
+static __thread struct probe_window *probe_win;
+
+static int probe_window_fill(int fd, char *buf, int len,
+			     unsigned long long offset)
+{
+	int n;
+
+	if (lseek64(fd, offset, 0) < 0)
+		return 0;
+	n = read(fd, buf, len);
+	return n < 0 ? 0 : n;
+}
+
+static struct probe_window *probe_window_open(int fd)
+{
+	struct probe_window *pw;
+	unsigned long long size;
+	off64_t pos;
+
+	if (!get_dev_size(fd, NULL, &size))
+		return NULL;
+	pos = lseek64(fd, 0, 1);
+	pw = xcalloc(1, sizeof(*pw));
+	pw->fd = fd;
+	if (posix_memalign((void**)&pw->head, 4096, PROBE_HEAD) != 0 ||
+	    posix_memalign((void**)&pw->tail, 4096, PROBE_TAIL) != 0) {
+		free(pw->head);
+		free(pw);
+		return NULL;
+	}
+	pw->head_len = probe_window_fill(fd, pw->head, PROBE_HEAD, 0);
+	if (size > PROBE_TAIL)
+		pw->tail_start = (size - PROBE_TAIL) & ~4095ULL;
+	pw->tail_len = probe_window_fill(fd, pw->tail, PROBE_TAIL,
+					 pw->tail_start);
+	lseek64(fd, pos, 0);
+	return pw;
+}
+
+static void probe_window_close(struct probe_window *pw)
+{
+	free(pw->head);
+	free(pw->tail);
+	free(pw);
+}
+
+void probe_window_drop(int fd)
+{
+	/* Forget what the probe window holds for fd, so that a
+	 * handler which waits for the metadata to settle sees the
+	 * device rather than the copy taken before it waited.
+	 */
+	struct probe_window *pw = probe_win;
+
+	if (!pw || pw->fd != fd)
+		return;
+	probe_win = NULL;
+	probe_window_close(pw);
+}
+
+ssize_t probe_pread(int fd, void *buf, size_t len, unsigned long long pos)
+{
+	/* Like pread(), but from the probe window when possible */
+	struct probe_window *pw = probe_win;
+	char *src = NULL;
+
+	if (!pw || pw->fd != fd)
+		return pread64(fd, buf, len, pos);
+	if (pos + len <= (unsigned long long)pw->head_len)
+		src = pw->head + pos;
+	else if (pos >= pw->tail_start &&
+		 pos + len <= pw->tail_start + pw->tail_len)
+		src = pw->tail + (pos - pw->tail_start);
+	if (!src)
+		return pread64(fd, buf, len, pos);
+	memcpy(buf, src, len);
+	return len;
+}
+
+ssize_t probe_read(int fd, void *buf, size_t len)
+{
+	/* Like read(), but from the probe window when possible */
+	struct probe_window *pw = probe_win;
+	ssize_t n;
+
+	if (!pw || pw->fd != fd)
+		return read(fd, buf, len);
+	n = probe_pread(fd, buf, len, lseek64(fd, 0, 1));
+	if (n > 0)
+		lseek64(fd, n, 1);
+	return n;
+}
+
 struct supertype *guess_super_type(int fd, enum guess_types guess_type)
 {
 	/* try each load_super to find the best match,
@@ -1255,13 +1464,19 @@ struct supertype *guess_super_type(int fd, enum guess_types guess_type)
 	 */
 	struct superswitch  *ss;
 	struct supertype *st;
+	struct supertype best;
+	struct probe_window *pw = NULL;
 	time_t besttime = 0;
 	int bestsuper = -1;
 	int i;
+	unsigned long long t = trace_start();
 
 	st = xcalloc(1, sizeof(*st));
 	st->container_devnm[0] = 0;
 
+	if (!probe_win)
+		probe_win = pw = probe_window_open(fd);
+
 	for (i = 0 ; superlist[i]; i++) {
 		int rv;
 		ss = superlist[i];
@@ -1275,28 +1490,289 @@ struct supertype *guess_super_type(int fd, enum guess_types guess_type)
 		if (rv == 0) {
 			struct mdinfo info;
 			st->ss->getinfo_super(st, &info, NULL);
+			ss->free_super(st);
 			if (bestsuper == -1 ||
 			    besttime < info.array.ctime) {
+				/* Remember how it was loaded rather
+				 * than loading it again at the end.
+				 */
 				bestsuper = i;
 				besttime = info.array.ctime;
+				best = *st;
 			}
-			ss->free_super(st);
 		}
 	}
+	if (pw && probe_win == pw) {
+		probe_win = NULL;
+		probe_window_close(pw);
+	}
+	trace_end(t, "guess_super", NULL);
 	if (bestsuper != -1) {
-		int rv;
-		memset(st, 0, sizeof(*st));
-		st->ignore_hw_compat = 1;
-		rv = superlist[bestsuper]->load_super(st, fd, NULL);
-		if (rv == 0) {
-			superlist[bestsuper]->free_super(st);
-			return st;
-		}
+		*st = best;
+		return st;
 	}
 	free(st);
 	return NULL;
 }
 
+/* Probing a device is mostly a matter of waiting for a handful of
+ * small reads, so with hundreds of devices it pays to have several
+ * outstanding at once.  probe_devices() runs 'fn' over each entry
+ * from a small pool of threads; as results are left in probes[],
+ * callers still see them in list order.
+ * 'fn' must only use code that is safe to run concurrently -
+ * anything touching process-wide caches needs probe_lock().
+ */
+#define PROBE_THREADS 16
+
+#if defined(USE_PTHREADS) && !defined(MDASSEMBLE)
+static pthread_mutex_t probe_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void probe_lock(void)
+{
+	pthread_mutex_lock(&probe_mutex);
+}
+
+void probe_unlock(void)
+{
+	pthread_mutex_unlock(&probe_mutex);
+}
+
+struct probe_pool {
+	struct dev_probe *probes;
+	int cnt;
+	int next;
+	pthread_mutex_t lock;
+	void (*fn)(struct dev_probe *dp, void *arg);
+	void *arg;
+};
+
+static void *probe_worker(void *v)
+{
+	struct probe_pool *pool = v;
+	int i;
+
+	while (1) {
+		pthread_mutex_lock(&pool->lock);
+		i = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+		if (i >= pool->cnt)
+			break;
+		pool->fn(&pool->probes[i], pool->arg);
+	}
+	return NULL;
+}
+
+void probe_devices(struct dev_probe *probes, int cnt,
+		   void (*fn)(struct dev_probe *dp, void *arg),
+		   void *arg)
+{
+	struct probe_pool pool;
+	pthread_t threads[PROBE_THREADS - 1];
+	int nthreads = 0;
+	int i;
+
+	pool.probes = probes;
+	pool.cnt = cnt;
+	pool.next = 0;
+	pool.fn = fn;
+	pool.arg = arg;
+	pthread_mutex_init(&pool.lock, NULL);
+
+	/* This thread is a worker too, so if no more can be
+	 * started we just end up probing serially.
+	 */
+	for (i = 1; i < cnt && i < PROBE_THREADS; i++) {
+		if (pthread_create(&threads[nthreads], NULL,
+				   probe_worker, &pool) != 0)
+			break;
+		nthreads++;
+	}
+	probe_worker(&pool);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&pool.lock);
+}
+#else
+void probe_lock(void)
+{
+}
+
+void probe_unlock(void)
+{
+}
+
+void probe_devices(struct dev_probe *probes, int cnt,
+		   void (*fn)(struct dev_probe *dp, void *arg),
+		   void *arg)
+{
+	int i;
+
+	for (i = 0; i < cnt; i++)
+		fn(&probes[i], arg);
+}
+#endif
+
+/*
+ * Metadata for a container is written to every member, and doing that
+ * one device at a time makes each update take as long as the sum of
+ * the device latencies.  Instead each step of an update is queued for
+ * all devices with batch_write_add() and batch_write_submit() hands the
+ * lot to the kernel with io_submit() and waits for all of them, so a
+ * step costs about one device write however many members there are.
+ * mdmon mustn't wait for memory while writing metadata, so nothing is
+ * allocated once the batch (and its aio context) has grown to size.
+ * Without Linux AIO the writes are just done one after the other.
+ */
+void batch_write_add(struct write_batch *wb, int fd, void *buf,
+		     size_t len, unsigned long long offset, void *owner)
+{
+	struct batch_write *w;
+
+	if (wb->cnt == wb->max) {
+		wb->max = wb->max ? wb->max * 2 : 16;
+		wb->w = xrealloc(wb->w, wb->max * sizeof(wb->w[0]));
+	}
+	w = &wb->w[wb->cnt++];
+	w->fd = fd;
+	w->buf = buf;
+	w->len = len;
+	w->offset = offset;
+	w->owner = owner;
+	w->err = 0;
+}
+
+void (*batch_write_done)(struct batch_write *w, unsigned long long usec);
+
+static void batch_write_sync(struct batch_write *w)
+{
+	unsigned long long start = batch_write_done ? trace_now() : 0;
+	ssize_t n = pwrite64(w->fd, w->buf, w->len, w->offset);
+
+	if (n < 0)
+		w->err = errno;
+	else if ((size_t)n != w->len)
+		w->err = EIO;
+	if (batch_write_done)
+		batch_write_done(w, (trace_now() - start) / 1000);
+}
+
+static int batch_write_aio(struct write_batch *wb)
+{
+	struct iocb *iocbs, **iocbp;
+	struct io_event *events;
+	int submitted = 0, done = 0;
+	unsigned long long start;
+	int i, n;
+
+	if (wb->ctx_size < wb->cnt) {
+		aio_context_t ctx = 0;
+
+		if (wb->ctx)
+			syscall(__NR_io_destroy, (aio_context_t)wb->ctx);
+		wb->ctx = 0;
+		wb->ctx_size = 0;
+		if (syscall(__NR_io_setup, wb->max, &ctx) < 0)
+			return -1;
+		wb->ctx = ctx;
+		wb->ctx_size = wb->max;
+		wb->iocbs = xrealloc(wb->iocbs,
+				     wb->max * (sizeof(*iocbs) + sizeof(*iocbp) +
+						sizeof(*events)));
+	}
+	iocbs = wb->iocbs;
+	iocbp = (struct iocb **)(iocbs + wb->ctx_size);
+	events = (struct io_event *)(iocbp + wb->ctx_size);
+
+	for (i = 0; i < wb->cnt; i++) {
+		struct batch_write *w = &wb->w[i];
+
+		memset(&iocbs[i], 0, sizeof(iocbs[i]));
+		iocbs[i].aio_lio_opcode = IOCB_CMD_PWRITE;
+		iocbs[i].aio_fildes = w->fd;
+		iocbs[i].aio_buf = (unsigned long)w->buf;
+		iocbs[i].aio_nbytes = w->len;
+		iocbs[i].aio_offset = w->offset;
+		iocbs[i].aio_data = i;
+		iocbp[i] = &iocbs[i];
+	}
+	start = batch_write_done ? trace_now() : 0;
+	for (i = 0; i < wb->cnt; ) {
+		n = syscall(__NR_io_submit, (aio_context_t)wb->ctx,
+			    wb->cnt - i, iocbp + i);
+		if (n > 0) {
+			submitted += n;
+			i += n;
+		} else {
+			/* This one was refused, maybe the device
+			 * doesn't do aio.  Write it directly.
+			 */
+			batch_write_sync(&wb->w[i]);
+			iocbp[i++] = NULL;
+		}
+	}
+	while (done < submitted) {
+		n = syscall(__NR_io_getevents, (aio_context_t)wb->ctx,
+			    1, submitted - done, events, NULL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			/* Destroying the context waits for what is
+			 * still in flight, and we can't tell what
+			 * that did.
+			 */
+			syscall(__NR_io_destroy, (aio_context_t)wb->ctx);
+			wb->ctx = 0;
+			wb->ctx_size = 0;
+			for (i = 0; i < wb->cnt; i++)
+				if (iocbp[i])
+					wb->w[i].err = EIO;
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			struct batch_write *w = &wb->w[events[i].data];
+
+			if (events[i].res < 0)
+				w->err = -events[i].res;
+			else if ((size_t)events[i].res != w->len)
+				w->err = EIO;
+			iocbp[events[i].data] = NULL;
+			if (batch_write_done)
+				batch_write_done(w,
+						 (trace_now() - start) / 1000);
+		}
+		done += n;
+	}
+	return 0;
+}
+
+/* Write everything in the batch, returning the number of writes that
+ * failed.  ->err is set for those.
+ */
+int batch_write_submit(struct write_batch *wb)
+{
+	int failed = 0;
+	int i;
+
+	if (wb->cnt == 1 || batch_write_aio(wb) < 0)
+		for (i = 0; i < wb->cnt; i++)
+			batch_write_sync(&wb->w[i]);
+
+	for (i = 0; i < wb->cnt; i++)
+		if (wb->w[i].err)
+			failed++;
+	return failed;
+}
+
+void batch_write_free(struct write_batch *wb)
+{
+	if (wb->ctx)
+		syscall(__NR_io_destroy, (aio_context_t)wb->ctx);
+	free(wb->w);
+	free(wb->iocbs);
+	memset(wb, 0, sizeof(*wb));
+}
+
 /* Return size of device in bytes */
 int get_dev_size(int fd, char *dname, unsigned long long *sizep)
 {
@@ -1482,7 +1958,7 @@ int open_container(int fd)
 	/* 'fd' is a block device.  Find out if it is in use
 	 * by a container, and return an open fd on that container.
 	 */
-	char path[256];
+	char path[PATH_MAX];
 	char *e;
 	DIR *dir;
 	struct dirent *de;
@@ -1493,7 +1969,7 @@ int open_container(int fd)
 
 	if (fstat(fd, &st) != 0)
 		return -1;
-	sprintf(path, "/sys/dev/block/%d:%d/holders",
+	sprintf(path, "%s/sys/dev/block/%d:%d/holders", sys_root(),
 		(int)major(st.st_rdev), (int)minor(st.st_rdev));
 	e = path + strlen(path);
 
@@ -1829,7 +2305,26 @@ int mdmon_running(char *devnm)
 	return 0;
 }
 
-int start_mdmon(char *devnm)
+/* Set while "mdadm -I --service" has stdout and stderr captured
+ * for a client: mdmon and systemctl get these instead.
+ */
+static int mdmon_stdio[2] = { -1, -1 };
+
+void set_mdmon_stdio(int out, int err)
+{
+	mdmon_stdio[0] = out;
+	mdmon_stdio[1] = err;
+}
+
+static void restore_mdmon_stdio(void)
+{
+	if (mdmon_stdio[0] >= 0)
+		dup2(mdmon_stdio[0], 1);
+	if (mdmon_stdio[1] >= 0)
+		dup2(mdmon_stdio[1], 2);
+}
+
+static int __start_mdmon(char *devnm)
 {
 	int i, skipped;
 	int len;
@@ -1863,6 +2358,7 @@ int start_mdmon(char *devnm)
 	if (!check_env("MDADM_NO_SYSTEMCTL"))
 		switch(fork()) {
 		case 0:
+			restore_mdmon_stdio();
 			/* FIXME yuk. CLOSE_EXEC?? */
 			skipped = 0;
 			for (i = 3; skipped < 20; i++)
@@ -1896,6 +2392,7 @@ int start_mdmon(char *devnm)
 	/* That failed, try running mdmon directly */
 	switch(fork()) {
 	case 0:
+		restore_mdmon_stdio();
 		/* FIXME yuk. CLOSE_EXEC?? */
 		skipped = 0;
 		for (i = 3; skipped < 20; i++)
@@ -1922,6 +2419,15 @@ int start_mdmon(char *devnm)
 	return 0;
 }
 
+int start_mdmon(char *devnm)
+{
+	unsigned long long t = trace_start();
+	int rv = __start_mdmon(devnm);
+
+	trace_end(t, "start_mdmon", devnm);
+	return rv;
+}
+
 __u32 random32(void)
 {
 	__u32 rv;
@@ -1937,6 +2443,8 @@ __u32 random32(void)
 int flush_metadata_updates(struct supertype *st)
 {
 	int sfd;
+	int batch;
+
 	if (!st->updates) {
 		st->update_tail = NULL;
 		return -1;
@@ -1946,8 +2454,36 @@ int flush_metadata_updates(struct supertype *st)
 	if (sfd < 0)
 		return -1;
 
+	/* If mdmon can, it takes them in batches, with one reply each */
+	batch = mdmon_feature(st->container_devnm, sfd, "updates");
 	while (st->updates) {
 		struct metadata_update *mu = st->updates;
+
+		if (batch) {
+			struct metadata_update *last = mu;
+			int cnt = 1, len = mu->len;
+
+			while (last->next && cnt < MSG_UPDATES_MAX &&
+			       len + last->next->len <= MSG_MAX_LEN) {
+				last = last->next;
+				len += last->len;
+				cnt++;
+			}
+			st->updates = last->next;
+			last->next = NULL;
+			if (send_batch(sfd, mu, 0) != 0 ||
+			    wait_reply(sfd, 0) != 0) {
+				pr_err("failed to pass metadata updates to mdmon for %s\n",
+				       st->container_devnm);
+				free_batch(&mu);
+				free_batch(&st->updates);
+				close(sfd);
+				st->update_tail = NULL;
+				return -1;
+			}
+			free_batch(&mu);
+			continue;
+		}
 		st->updates = mu->next;
 
 		send_message(sfd, mu, 0);